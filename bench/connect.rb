@@ -0,0 +1,82 @@
+##
+# Compares connect latency of DNSSD::HappyEyeballs with trying each address
+# in turn as DNSSD::Reply::Resolve#connect does by default.  Connects to a
+# local listener and reports latency percentiles.  Run after compiling the
+# extension:
+#
+#   ruby -Ilib bench/connect.rb
+#
+# The stalled case puts an address whose listener never accepts (its accept
+# queue is full) in front of the live one.  Serial connects then wait for
+# the connect timeout, 1 second here instead of the operating system's
+# minutes.
+
+require 'dnssd'
+require 'socket'
+
+def percentiles times
+  times = times.sort
+
+  [50, 90, 99].map do |p|
+    index = ((p / 100.0) * times.length).ceil - 1
+    '%8.3fms' % (times[index] * 1000)
+  end.join ' '
+end
+
+def measure n
+  Array.new n do
+    start = DNSSD.clock_time
+    socket = yield
+    elapsed = DNSSD.clock_time - start
+    socket.close
+    elapsed
+  end
+end
+
+def serial addresses, port
+  addresses.each_with_index do |address, i|
+    begin
+      return TCPSocket.new address, port, connect_timeout: 1
+    rescue SystemCallError, IOError # IO::TimeoutError
+      raise if i == addresses.length - 1
+    end
+  end
+end
+
+server = TCPServer.new '127.0.0.1', 0
+port   = server.addr[1]
+
+Thread.new do
+  loop { server.accept.close }
+end
+
+stalled = Socket.new :INET, :STREAM
+stalled.bind Addrinfo.tcp('127.0.0.2', port)
+stalled.listen 0
+
+fill = Array.new 4 do
+  client = Socket.new :INET, :STREAM
+  client.connect_nonblock stalled.local_address, exception: false
+  client
+end
+
+happy = DNSSD::HappyEyeballs.new port
+
+cases = [
+  ['live',            %w[127.0.0.1],           1000],
+  ['refused IPv6',    %w[::1 127.0.0.1],       1000],
+  ['stalled first',   %w[127.0.0.2 127.0.0.1],   10],
+]
+
+puts '%-15s %-6s %10s %10s %10s' % %w[case mode p50 p90 p99]
+
+cases.each do |name, addresses, n|
+  serial_times = measure(n) { serial addresses, port }
+  happy_times  = measure(n) { happy.connect addresses }
+
+  puts '%-15s %-6s %s' % [name, 'serial', percentiles(serial_times)]
+  puts '%-15s %-6s %s' % [name, 'happy',  percentiles(happy_times)]
+end
+
+fill.each { |client| client.close }
+stalled.close
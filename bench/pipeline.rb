@@ -0,0 +1,153 @@
+##
+# Benchmarks the reply pipeline: how many replies per second each kind of
+# service delivers, how many objects each reply allocates and how long a
+# reply waits between its callback and being yielded.  Also measures
+# DNSSD::TextRecord encoding and decoding and DNSSD::Reply#set_fullname.
+#
+# Runs offline.  Replies come from DNSSD::Service#_synthesize, which calls
+# the reply callbacks in ext/dnssd/service.c with canned data in bursts of
+# BURST, as DNSServiceProcessResult does when the daemon sends a burst.
+#
+# A summary is printed to stderr and the results as JSON to stdout, so
+# results of two releases can be saved and compared:
+#
+#   rake bench > dnssd-3.0.2.json
+#
+# or, after compiling the extension:
+#
+#   ruby -Ilib bench/pipeline.rb [seconds per benchmark] > results.json
+
+require 'dnssd'
+require 'json'
+
+BURST    = 64
+DURATION = (ARGV.shift || 1).to_f
+SAMPLES  = 10_000
+
+##
+# Reads the attributes a consumer of each kind of reply typically reads
+
+CONSUMERS = {
+  browse:       lambda { |r| r.name; r.type; r.domain; r.flags.add? },
+  resolve:      lambda { |r| r.target; r.port; r.text_record['path'] },
+  query_record: lambda { |r| r.fullname; r.record_data },
+  getaddrinfo:  lambda { |r| r.hostname; r.address; r.ttl },
+}
+
+def allocations
+  GC.stat :total_allocated_objects
+end
+
+def percentiles samples
+  samples = samples.sort
+
+  [50, 90, 99].map do |p|
+    index = ((p / 100.0) * samples.length).ceil - 1
+    ["p#{p}", samples[index].round(2)]
+  end.to_h.merge 'max' => samples.last.round(2)
+end
+
+##
+# Calls the block with a batch size until DURATION seconds have passed and
+# returns the rate and allocations per operation
+
+def measure name, unit
+  yield BURST # warm up
+
+  count     = 0
+  allocated = allocations
+  start     = DNSSD.clock_time
+
+  while (elapsed = DNSSD.clock_time - start) < DURATION do
+    yield BURST
+    count += BURST
+  end
+
+  allocated = allocations - allocated
+
+  {
+    'name'               => name.to_s,
+    'unit'               => unit,
+    'count'              => count,
+    'per_second'         => (count / elapsed).round,
+    'allocations_per_op' => (allocated.to_f / count).round(2),
+  }
+end
+
+##
+# Microseconds between the callback creating each reply and its yield
+
+def latency service, kind, consumer
+  samples = []
+
+  while samples.length < SAMPLES do
+    service.send :_synthesize, kind, BURST
+
+    service.drain_replies do |reply|
+      now     = Process.clock_gettime Process::CLOCK_REALTIME, :microsecond
+      created = reply.send :_created
+      consumer.call reply
+
+      samples << now - (created.tv_sec * 1_000_000 + created.tv_usec)
+    end
+  end
+
+  percentiles samples
+end
+
+results = []
+
+CONSUMERS.each do |kind, consumer|
+  service = DNSSD::Service.send :new
+
+  result = measure kind, 'replies' do |n|
+    service.send :_synthesize, kind, n
+    service.drain_replies(&consumer)
+  end
+
+  result['latency_us'] = latency service, kind, consumer
+
+  results << result
+end
+
+text_record = DNSSD::TextRecord.new(
+  'txtvers' => '1', 'path' => '/index.html', 'note' => 'benchmark',
+  'version' => DNSSD::VERSION, 'load' => '0.25', 'id' => 'x' * 32)
+encoded = text_record.encode
+
+results << measure(:text_record_encode, 'records') do |n|
+  n.times { text_record.encode }
+end
+
+results << measure(:text_record_decode, 'records') do |n|
+  n.times { DNSSD::TextRecord.decode encoded }
+end
+
+service = DNSSD::Service.send :new
+service.send :_synthesize, :browse, 1
+reply = service.shift_replies.first
+fullname = 'Synthetic\032Service\.\ 1._http._tcp.local.'
+
+results << measure(:set_fullname, 'names') do |n|
+  n.times { reply.set_fullname fullname }
+end
+
+$stderr.puts '%-20s %12s %10s %9s %9s %9s' %
+  %w[benchmark per_second allocs/op p50_us p99_us max_us]
+
+results.each do |result|
+  latency = result['latency_us'] || {}
+
+  $stderr.puts '%-20s %12d %10.2f %9s %9s %9s' % [
+    result['name'], result['per_second'], result['allocations_per_op'],
+    latency['p50'], latency['p99'], latency['max'],
+  ]
+end
+
+puts JSON.pretty_generate(
+  'benchmark' => 'dnssd reply pipeline',
+  'version'   => DNSSD::VERSION,
+  'ruby'      => RUBY_DESCRIPTION,
+  'burst'     => BURST,
+  'duration'  => DURATION,
+  'results'   => results)
@@ -0,0 +1,89 @@
+##
+# Compares the C rdata decoder behind DNSSD::Reply::QueryRecord#record_data
+# with the pure ruby one it replaced on large TXT and SRV answers.  Run after
+# compiling the extension:
+#
+#   ruby -Ilib bench/record_data.rb
+
+require 'benchmark'
+require 'dnssd'
+
+module RubyRecordData
+
+  def self.character_string_to_string character_string
+    length = character_string.slice 0
+    length = length.ord unless Numeric === length
+    string = character_string.slice 1, length
+
+    raise TypeError, 'invalid character string' if string.length != length
+
+    string
+  end
+
+  def self.domain_name_to_string domain_name
+    return '.' if domain_name == "\0"
+
+    domain_name = domain_name.dup
+    string = []
+
+    until domain_name.empty? do
+      string << character_string_to_string(domain_name)
+      domain_name.slice! 0, string.last.length + 1
+    end
+
+    string << nil unless string.last.empty?
+
+    string.join('.')
+  end
+
+  def self.decode record_type, record
+    case record_type
+    when DNSSD::Record::SRV then
+      srv = record.unpack 'nnnZ*'
+      srv[-1] = domain_name_to_string srv.last
+      srv
+    when DNSSD::Record::TXT then
+      record = record.dup
+      txt = []
+
+      until record.empty? do
+        txt << character_string_to_string(record)
+        record.slice! 0, txt.last.length + 1
+      end
+
+      txt
+    end
+  end
+
+end
+
+fullname = 'blackjack._blackjack._tcp.local.'
+IN = DNSSD::Record::IN
+
+[10, 100, 1000].each do |strings|
+  txt = DNSSD::Record.to_data DNSSD::Record::TXT,
+                              *Array.new(strings) { |i| "key#{i}=value#{i}" }
+
+  labels = Array.new(strings / 10 + 1) { |i| "label#{i}" }.join '.'
+  labels = labels[0, 250]
+  srv = DNSSD::Record.to_data DNSSD::Record::SRV, 0, 0, 80, "#{labels}."
+
+  n = 200_000 / strings
+
+  puts "#{strings} TXT strings (#{txt.bytesize} bytes), " \
+       "SRV target of #{srv.bytesize - 7} bytes, #{n} iterations"
+
+  txt_qr = DNSSD::Reply::QueryRecord.new nil, 0, 0, fullname,
+                                         DNSSD::Record::TXT, IN, txt, 120
+  srv_qr = DNSSD::Reply::QueryRecord.new nil, 0, 0, fullname,
+                                         DNSSD::Record::SRV, IN, srv, 120
+
+  Benchmark.bm 10 do |x|
+    x.report('ruby TXT') { n.times { RubyRecordData.decode DNSSD::Record::TXT, txt } }
+    x.report('C TXT')    { n.times { txt_qr.record_data } }
+    x.report('ruby SRV') { n.times { RubyRecordData.decode DNSSD::Record::SRV, srv } }
+    x.report('C SRV')    { n.times { srv_qr.record_data } }
+  end
+
+  puts
+end
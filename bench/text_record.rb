@@ -0,0 +1,74 @@
+##
+# Compares the C DNSSD::TextRecord codec with the pure ruby one it replaced
+# on records with many keys.  Run after compiling the extension:
+#
+#   ruby -Ilib bench/text_record.rb
+
+require 'benchmark'
+require 'dnssd'
+
+module RubyTextRecord
+
+  def self.decode text_record
+    record = {}
+
+    tr = text_record.unpack 'C*'
+
+    until tr.empty? do
+      size  = tr.shift
+
+      next if size.zero?
+
+      raise ArgumentError, 'ran out of data in text record' if tr.length < size
+
+      entry = tr.shift(size).pack('C*')
+
+      raise ArgumentError, 'key not found' unless entry =~ /^[^=]/
+
+      key, value = entry.split '=', 2
+
+      next unless key
+
+      record[key] = value
+    end
+
+    record
+  end
+
+  def self.encode hash
+    hash.sort.map do |key, value|
+      key = key.to_s
+
+      raise DNSSD::Error, "empty key" if key.empty?
+      raise DNSSD::Error, "key '#{key}' contains =" if key =~ /=/
+
+      record = value ? [key, value.to_s].join('=') : key
+
+      raise DNSSD::Error, "key value pair at '#{key}' too large to encode" if
+        record.length > 255
+
+      "#{record.length.chr}#{record}"
+    end.join ''
+  end
+
+end
+
+[10, 100, 1000].each do |keys|
+  hash = {}
+  keys.times { |i| hash["key#{i}"] = "value#{i}" * 4 }
+
+  record  = DNSSD::TextRecord.new hash
+  encoded = record.encode
+  n       = 200_000 / keys
+
+  puts "#{keys} keys, #{encoded.bytesize} bytes, #{n} iterations"
+
+  Benchmark.bm 14 do |x|
+    x.report('ruby decode') { n.times { RubyTextRecord.decode encoded } }
+    x.report('C decode')    { n.times { DNSSD::TextRecord.decode encoded } }
+    x.report('ruby encode') { n.times { RubyTextRecord.encode hash } }
+    x.report('C encode')    { n.times { record.encode } }
+  end
+
+  puts
+end
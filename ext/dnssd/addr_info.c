@@ -0,0 +1,118 @@
+#include "dnssd.h"
+
+static VALUE cDNSSDReplyAddrInfo;
+static VALUE cAddrinfo;
+static VALUE eSocketError;
+static ID id_new;
+
+/* Copies +sockaddr+ into +storage+ and returns its length.  Raises TypeError
+ * unless it holds a whole IPv4 or IPv6 sockaddr. */
+
+static socklen_t
+dnssd_addr_info_copy(VALUE sockaddr, struct sockaddr_storage *storage) {
+  long length;
+
+  StringValue(sockaddr);
+  length = RSTRING_LEN(sockaddr);
+
+  if (length < (long)sizeof(struct sockaddr_in) ||
+      length > (long)sizeof(*storage))
+    rb_raise(rb_eTypeError, "invalid sockaddr %+"PRIsVALUE, sockaddr);
+
+  memset(storage, 0, sizeof(*storage));
+  memcpy(storage, RSTRING_PTR(sockaddr), length);
+
+  if ((storage->ss_family != AF_INET && storage->ss_family != AF_INET6) ||
+      length < (long)SOCKADDR_LEN((struct sockaddr *)storage))
+    rb_raise(rb_eTypeError, "invalid sockaddr %+"PRIsVALUE, sockaddr);
+
+  return (socklen_t)SOCKADDR_LEN((struct sockaddr *)storage);
+}
+
+/* call-seq:
+ *   reply._sockaddr
+ *
+ * Returns the sockaddr the daemon sent as a frozen binary String, or nil for a
+ * reply created in ruby
+ */
+
+static VALUE
+dnssd_addr_info_sockaddr(VALUE self) {
+  dnssd_reply_t *reply = dnssd_reply_get(self);
+
+  if (reply->nfields < 2)
+    return Qnil;
+
+  return rb_obj_freeze(rb_str_new(reply->fields[1], reply->lengths[1]));
+}
+
+/* call-seq:
+ *   reply._unpack_sockaddr(sockaddr)
+ *
+ * Returns the port and numeric address of IPv4 or IPv6 +sockaddr+, like
+ * Socket.unpack_sockaddr_in
+ */
+
+static VALUE
+dnssd_addr_info_unpack_sockaddr(VALUE self, VALUE sockaddr) {
+  struct sockaddr_storage storage;
+  char host[NI_MAXHOST];
+  socklen_t length;
+  uint16_t port;
+  int error;
+
+  length = dnssd_addr_info_copy(sockaddr, &storage);
+
+  error = getnameinfo((struct sockaddr *)&storage, length, host, sizeof(host),
+      NULL, 0, NI_NUMERICHOST);
+
+  if (error)
+    rb_raise(eSocketError, "getnameinfo: %s", gai_strerror(error));
+
+  if (storage.ss_family == AF_INET6)
+    port = ntohs(((struct sockaddr_in6 *)&storage)->sin6_port);
+  else
+    port = ntohs(((struct sockaddr_in *)&storage)->sin_port);
+
+  return rb_assoc_new(INT2FIX(port), rb_usascii_str_new_cstr(host));
+}
+
+/* call-seq:
+ *   reply._addrinfo(sockaddr, port)
+ *
+ * Returns an Addrinfo for IPv4 or IPv6 +sockaddr+ with its port set to +port+
+ */
+
+static VALUE
+dnssd_addr_info_addrinfo(VALUE self, VALUE sockaddr, VALUE _port) {
+  struct sockaddr_storage storage;
+  socklen_t length;
+  uint16_t port = htons((uint16_t)NUM2UINT(_port));
+
+  length = dnssd_addr_info_copy(sockaddr, &storage);
+
+  if (storage.ss_family == AF_INET6)
+    ((struct sockaddr_in6 *)&storage)->sin6_port = port;
+  else
+    ((struct sockaddr_in *)&storage)->sin_port = port;
+
+  return rb_funcall(cAddrinfo, id_new, 1,
+      rb_str_new((const char *)&storage, length));
+}
+
+/* Document-class: DNSSD::Reply::AddrInfo
+ *
+ * The sockaddr helpers.  See lib/dnssd/reply/addr_info.rb
+ */
+
+void
+Init_DNSSD_AddrInfo(void) {
+  cDNSSDReplyAddrInfo = rb_path2class("DNSSD::Reply::AddrInfo");
+  cAddrinfo = rb_path2class("Addrinfo");
+  eSocketError = rb_path2class("SocketError");
+  id_new = rb_intern("new");
+
+  rb_define_private_method(cDNSSDReplyAddrInfo, "_addrinfo", dnssd_addr_info_addrinfo, 2);
+  rb_define_private_method(cDNSSDReplyAddrInfo, "_sockaddr", dnssd_addr_info_sockaddr, 0);
+  rb_define_private_method(cDNSSDReplyAddrInfo, "_unpack_sockaddr", dnssd_addr_info_unpack_sockaddr, 1);
+}
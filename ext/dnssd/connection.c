@@ -0,0 +1,262 @@
+#include "dnssd.h"
+
+static VALUE cDNSSDConnection;
+static VALUE cDNSSDRecord;
+
+static ID dnssd_id_record_registered;
+static ID dnssd_iv_connection;
+
+void
+dnssd_connection_release(dnssd_connection_t *connection) {
+  if (--connection->refs > 0)
+    return;
+
+  if (connection->ref)
+    DNSServiceRefDeallocate(connection->ref);
+
+  dnssd_wakeup_close(&connection->wakeup);
+
+  xfree(connection);
+}
+
+static void
+dnssd_connection_mark(void *ptr) {
+  dnssd_connection_t **connection = (dnssd_connection_t **)ptr;
+
+  if (*connection)
+    dnssd_wakeup_mark(&(*connection)->wakeup);
+}
+
+static void
+dnssd_connection_free(void *ptr) {
+  dnssd_connection_t **connection = (dnssd_connection_t **)ptr;
+
+  if (*connection)
+    dnssd_connection_release(*connection);
+
+  xfree(connection);
+}
+
+static const rb_data_type_t dnssd_connection_type = {
+    "DNSSD/connection",
+    {dnssd_connection_mark, dnssd_connection_free, 0,},
+    0, 0,
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+/* Returns the open daemon connection wrapped by +self+, raising DNSSD::Error
+ * if it has been closed. */
+
+dnssd_connection_t *
+dnssd_connection_get(VALUE self) {
+  dnssd_connection_t **connection;
+
+  TypedData_Get_Struct(self, dnssd_connection_t *, &dnssd_connection_type,
+      connection);
+
+  if (!*connection || !(*connection)->ref)
+    rb_raise(eDNSSDError, "connection is closed");
+
+  return *connection;
+}
+
+static VALUE
+dnssd_connection_s_allocate(VALUE klass) {
+  dnssd_connection_t **connection;
+  VALUE self;
+
+  self = TypedData_Make_Struct(klass, dnssd_connection_t *,
+      &dnssd_connection_type, connection);
+
+  *connection = ALLOC(dnssd_connection_t);
+  (*connection)->ref  = NULL;
+  (*connection)->refs = 1;
+  dnssd_wakeup_init(&(*connection)->wakeup);
+
+  return self;
+}
+
+/* call-seq:
+ *   connection._create
+ *
+ * Binding to DNSServiceCreateConnection
+ */
+
+static VALUE
+dnssd_connection_create(VALUE self) {
+  dnssd_connection_t **connection;
+  DNSServiceErrorType e;
+
+  TypedData_Get_Struct(self, dnssd_connection_t *, &dnssd_connection_type,
+      connection);
+
+#ifdef HAVE_DNSSERVICECREATECONNECTION
+  e = DNSServiceCreateConnection(&(*connection)->ref);
+#else
+  e = kDNSServiceErr_Unsupported;
+#endif
+
+  dnssd_check_error_code(e);
+
+  return self;
+}
+
+/* Closes the daemon socket.  Every service started on this connection stops
+ * receiving replies. */
+
+static VALUE
+dnssd_connection_close(VALUE self) {
+  dnssd_connection_t **connection;
+
+  TypedData_Get_Struct(self, dnssd_connection_t *, &dnssd_connection_type,
+      connection);
+
+  dnssd_wakeup_signal(&(*connection)->wakeup);
+
+  if ((*connection)->ref) {
+    DNSServiceRefDeallocate((*connection)->ref);
+    (*connection)->ref = NULL;
+  }
+
+  return self;
+}
+
+static VALUE
+dnssd_connection_ref_sock_fd(VALUE self) {
+  dnssd_connection_t *connection = dnssd_connection_get(self);
+
+  return INT2NUM(DNSServiceRefSockFD(connection->ref));
+}
+
+/* call-seq:
+ *   connection.process_result(timeout)
+ *
+ * Waits up to +timeout+ seconds (forever if +nil+) for a reply without holding
+ * the GVL, then calls DNSServiceProcessResult.  Returns false if no reply
+ * arrived before the timeout or the wait was interrupted.
+ */
+
+static VALUE
+dnssd_connection_process_result(VALUE self, VALUE timeout) {
+  dnssd_connection_t *connection = dnssd_connection_get(self);
+  DNSServiceErrorType e;
+  uint64_t started;
+
+  if (!dnssd_wait_readable(self, DNSServiceRefSockFD(connection->ref),
+        &connection->wakeup, timeout))
+    return Qfalse;
+
+  /* closed by another thread while waiting */
+  if (!connection->ref)
+    return Qfalse;
+
+  DNSSD_PROBE1(process_entry, self);
+  started = dnssd_clock_ns();
+  e = DNSServiceProcessResult(connection->ref);
+  dnssd_stats_process(NULL, started, e);
+  DNSSD_PROBE2(process_return, self, e);
+  dnssd_check_error_code(e);
+
+  return Qtrue;
+}
+
+#ifdef HAVE_DNSSERVICECREATECONNECTION
+static void DNSSD_API
+dnssd_connection_register_record_reply(DNSServiceRef client,
+    DNSRecordRef record_ref, DNSServiceFlags flags, DNSServiceErrorType e,
+    void *context) {
+  VALUE record, connection;
+
+  record = (VALUE)context;
+  connection = rb_ivar_get(record, dnssd_iv_connection);
+
+  rb_funcall(connection, dnssd_id_record_registered, 2, record,
+      dnssd_error_new(e));
+}
+#endif
+
+/* call-seq:
+ *   connection._register_record(flags, interface, fullname, type, class,
+ *                               data, ttl)
+ *
+ * Binding to DNSServiceRegisterRecord.  The request is sent without waiting
+ * for the daemon, which answers through #record_registered while replies are
+ * processed.  The returned DNSSD::Record must be kept alive until it is
+ * removed with DNSSD::Record#remove.
+ */
+
+static VALUE
+dnssd_connection_register_record(VALUE self, VALUE _flags, VALUE _interface,
+    VALUE _fullname, VALUE _rrtype, VALUE _rrclass, VALUE _rdata,
+    VALUE _ttl) {
+#ifdef HAVE_DNSSERVICECREATECONNECTION
+  dnssd_connection_t *connection = dnssd_connection_get(self);
+  DNSServiceFlags flags;
+  DNSServiceErrorType e;
+  DNSRecordRef *record;
+  uint32_t interface;
+  const char *fullname;
+  uint16_t rrtype, rrclass;
+  uint32_t ttl;
+  VALUE _record;
+
+  dnssd_utf8_cstr(_fullname, fullname);
+  StringValue(_rdata);
+
+  if (RSTRING_LEN(_rdata) > UINT16_MAX)
+    rb_raise(rb_eArgError, "record data too long (%ld bytes)",
+        RSTRING_LEN(_rdata));
+
+  flags     = (DNSServiceFlags)NUM2ULONG(_flags);
+  interface = (uint32_t)NUM2ULONG(_interface);
+  rrtype    = (uint16_t)NUM2UINT(_rrtype);
+  rrclass   = (uint16_t)NUM2UINT(_rrclass);
+  ttl       = (uint32_t)NUM2ULONG(_ttl);
+
+  _record = rb_class_new_instance(0, NULL, cDNSSDRecord);
+  record = dnssd_record_get(_record);
+
+  /* record will become invalid when this connection is closed */
+  rb_ivar_set(_record, dnssd_iv_connection, self);
+
+  e = DNSServiceRegisterRecord(connection->ref, record, flags, interface,
+      fullname, rrtype, rrclass, (uint16_t)RSTRING_LEN(_rdata),
+      RSTRING_PTR(_rdata), ttl, dnssd_connection_register_record_reply,
+      (void *)_record);
+
+  dnssd_check_error_code(e);
+
+  return _record;
+#else
+  dnssd_check_error_code(kDNSServiceErr_Unsupported);
+
+  return Qnil;
+#endif
+}
+
+/* Document-class: DNSSD::Connection
+ *
+ * A single connection to the DNS-SD daemon shared by many services.  See
+ * lib/dnssd/connection.rb
+ */
+
+void
+Init_DNSSD_Connection(void) {
+  VALUE mDNSSD = rb_define_module("DNSSD");
+
+  cDNSSDConnection = rb_define_class_under(mDNSSD, "Connection", rb_cObject);
+  cDNSSDRecord     = rb_path2class("DNSSD::Record");
+
+  dnssd_id_record_registered = rb_intern("record_registered");
+  dnssd_iv_connection        = rb_intern("@connection");
+
+  rb_define_alloc_func(cDNSSDConnection, dnssd_connection_s_allocate);
+
+  rb_define_private_method(cDNSSDConnection, "_create", dnssd_connection_create, 0);
+  rb_define_private_method(cDNSSDConnection, "_close", dnssd_connection_close, 0);
+  rb_define_private_method(cDNSSDConnection, "_register_record", dnssd_connection_register_record, 7);
+  rb_define_private_method(cDNSSDConnection, "ref_sock_fd", dnssd_connection_ref_sock_fd, 0);
+  rb_define_private_method(cDNSSDConnection, "process_result", dnssd_connection_process_result, 1);
+}
@@ -1,49 +1,321 @@
 #include "dnssd.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+
+#include <ruby/io.h>
+
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+#include <ruby/fiber/scheduler.h>
+#endif
+
+static ID dnssd_id_to_io;
+
+void Init_DNSSD_AddrInfo(void);
+void Init_DNSSD_Connection(void);
 void Init_DNSSD_Errors(void);
 void Init_DNSSD_Flags(void);
+void Init_DNSSD_Interface(void);
+void Init_DNSSD_QueryRecord(void);
+void Init_DNSSD_Reactor(void);
 void Init_DNSSD_Record(void);
+void Init_DNSSD_Reply(void);
 void Init_DNSSD_Service(void);
+void Init_DNSSD_Stats(void);
+void Init_DNSSD_TextRecord(void);
+void Init_DNSSD_Trace(void);
 
-/*
- * call-seq:
- *   DNSSD.interface_name(interface_index) # => interface_name
- *
- * Returns the interface name for interface +interface_index+.
- *
- *   DNSSD.interface_name 1 # => 'lo0'
- */
+/* Prepares +wakeup+ for dnssd_wakeup_open, nothing is allocated yet */
+
+void
+dnssd_wakeup_init(dnssd_wakeup_t *wakeup) {
+  wakeup->fds[0] = wakeup->fds[1] = -1;
+  wakeup->signalled = 0;
+#ifdef HAVE_SYS_EPOLL_H
+  wakeup->io = Qnil;
+#endif
+}
+
+/* Creates the descriptors of +wakeup+ if they don't exist yet.  An eventfd is
+ * used where there is one, otherwise a pipe. */
+
+void
+dnssd_wakeup_open(dnssd_wakeup_t *wakeup) {
+  if (wakeup->fds[0] >= 0)
+    return;
+
+#ifdef HAVE_SYS_EVENTFD_H
+  wakeup->fds[0] = wakeup->fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (wakeup->fds[0] < 0)
+    rb_sys_fail("eventfd");
+
+  rb_update_max_fd(wakeup->fds[0]);
+#else
+  if (rb_pipe(wakeup->fds) < 0)
+    rb_sys_fail("pipe");
+
+  fcntl(wakeup->fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(wakeup->fds[1], F_SETFL, O_NONBLOCK);
+#endif
+
+  if (wakeup->signalled)
+    dnssd_wakeup_signal(wakeup);
+}
+
+/* Interrupts every wait on +wakeup+, now and from now on.  It is never
+ * drained since it is only signalled when its owner stops for good. */
+
+void
+dnssd_wakeup_signal(dnssd_wakeup_t *wakeup) {
+  static const uint64_t one = 1;
+  ssize_t written;
+
+  wakeup->signalled = 1;
+
+  if (wakeup->fds[1] < 0)
+    return;
+
+  written = write(wakeup->fds[1], &one, sizeof(one));
+  (void)written; /* a full pipe is already readable */
+}
+
+/* Closes the descriptors of +wakeup+.  Only call this once nothing can be
+ * waiting on it, when its owner is freed. */
+
+void
+dnssd_wakeup_close(dnssd_wakeup_t *wakeup) {
+  if (wakeup->fds[0] >= 0) {
+    close(wakeup->fds[0]);
+
+    if (wakeup->fds[1] != wakeup->fds[0])
+      close(wakeup->fds[1]);
+  }
+
+  /* the epoll descriptor belongs to wakeup->io, which closes it when it is
+   * collected */
+  dnssd_wakeup_init(wakeup);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Returns an IO for an epoll descriptor that becomes readable when +fd+ or
+ * +wakeup+ does, so a Fiber scheduler can wait for both with one io_wait. */
 
 static VALUE
-dnssd_if_nametoindex(VALUE self, VALUE name) {
-  return UINT2NUM(if_nametoindex(StringValueCStr(name)));
+dnssd_wakeup_io(dnssd_wakeup_t *wakeup, int fd) {
+  struct epoll_event event;
+  int epfd, i;
+  int fds[2];
+
+  if (!NIL_P(wakeup->io))
+    return wakeup->io;
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (epfd < 0)
+    rb_sys_fail("epoll_create1");
+
+  fds[0] = fd;
+  fds[1] = wakeup->fds[0];
+
+  for (i = 0; i < 2; i++) {
+    memset(&event, 0, sizeof(event));
+    event.events  = EPOLLIN;
+    event.data.fd = fds[i];
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &event) < 0) {
+      int error = errno;
+
+      close(epfd);
+      rb_syserr_fail(error, "epoll_ctl");
+    }
+  }
+
+  rb_update_max_fd(epfd);
+
+  wakeup->io = rb_io_fdopen(epfd, O_RDONLY, NULL);
+
+  return wakeup->io;
 }
+#endif
 
-/*
- * call-seq:
- *   DNSSD.interface_index(interface_name) # => interface_index
- *
- * Returns the interface index for interface +interface_name+.
+#if defined(HAVE_POLL_H) && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL2)
+struct dnssd_wait {
+  int fd;
+  int wakeup;
+  int timeout;
+  int result;
+  int error;
+};
+
+/* Waits for wait->fd or wait->wakeup.  result is 1 if wait->fd is readable,
+ * 0 on timeout or wakeup and -1 on error. */
+
+static void *
+dnssd_wait_poll(void *ptr) {
+  struct dnssd_wait *wait = (struct dnssd_wait *)ptr;
+  struct pollfd pfds[2];
+  nfds_t nfds = 1;
+
+  pfds[0].fd      = wait->fd;
+  pfds[0].events  = POLLIN;
+  pfds[0].revents = 0;
+
+  if (wait->wakeup >= 0) {
+    pfds[1].fd      = wait->wakeup;
+    pfds[1].events  = POLLIN;
+    pfds[1].revents = 0;
+    nfds = 2;
+  }
+
+  wait->result = poll(pfds, nfds, wait->timeout);
+  wait->error  = errno;
+
+  if (wait->result > 0)
+    wait->result = pfds[0].revents != 0;
+
+  return NULL;
+}
+#endif
+
+/* Waits up to +timeout+ seconds (forever if +timeout+ is nil) for +fd+ to
+ * become readable or +wakeup+ (which may be NULL) to be signalled.  The GVL is
+ * released while waiting so other threads keep running.  If the current
+ * thread has a Fiber scheduler the wait is handed to its io_wait hook instead,
+ * so other fibers keep running.  With epoll the hook waits on both +fd+ and
+ * +wakeup+, otherwise only on <tt>owner.to_io</tt>, so a signalled +wakeup+
+ * is noticed when a reply arrives or +timeout+ expires.
  *
- *   DNSSD.interface_index 'lo0' # => 1
- */
+ * Returns 1 if +fd+ is readable and 0 if the timeout expired or the wait was
+ * woken or interrupted.  Pending interrupts such as Thread#raise are handled
+ * before returning. */
 
-static VALUE
-dnssd_if_indextoname(VALUE self, VALUE index) {
-  char buffer[IF_NAMESIZE];
+int
+dnssd_wait_readable(VALUE owner, int fd, dnssd_wakeup_t *wakeup,
+    VALUE timeout) {
+#if defined(HAVE_POLL_H) && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL2)
+  struct dnssd_wait wait;
+#endif
+
+  if (wakeup)
+    dnssd_wakeup_open(wakeup);
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+  {
+    VALUE scheduler = rb_fiber_scheduler_current();
 
-  if (if_indextoname(NUM2UINT(index), buffer))
-    return rb_str_new2(buffer);
+    /* a zero timeout can't block, so there is no point yielding to other
+     * fibers */
+    if (!NIL_P(scheduler) && (NIL_P(timeout) || NUM2DBL(timeout) > 0)) {
+      VALUE io;
 
-  rb_raise(rb_eArgError, "invalid interface %d", NUM2UINT(index));
+#ifdef HAVE_SYS_EPOLL_H
+      if (wakeup) {
+        io = dnssd_wakeup_io(wakeup, fd);
 
-  return Qnil;
+        if (!RTEST(rb_fiber_scheduler_io_wait(scheduler, io,
+                INT2NUM(RUBY_IO_READABLE), timeout)))
+          return 0;
+
+        /* the epoll descriptor is readable, find out if fd is */
+        timeout = INT2FIX(0);
+        goto poll_now;
+      }
+#endif
+
+      io = rb_funcall(owner, dnssd_id_to_io, 0);
+
+      return RTEST(rb_fiber_scheduler_io_wait(scheduler, io,
+            INT2NUM(RUBY_IO_READABLE), timeout));
+    }
+  }
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+poll_now:
+#endif
+#if defined(HAVE_POLL_H) && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL2)
+  wait.fd      = fd;
+  wait.wakeup  = wakeup ? wakeup->fds[0] : -1;
+  wait.timeout = -1;
+  wait.result  = 0;
+  wait.error   = 0;
+
+  if (!NIL_P(timeout)) {
+    double ms = NUM2DBL(timeout) * 1000.0;
+
+    if (ms <= 0) {
+      /* a zero timeout can't block, so keep the GVL */
+      wait.timeout = 0;
+      dnssd_wait_poll(&wait);
+
+      return wait.result > 0;
+    } else if (ms >= INT_MAX)
+      wait.timeout = INT_MAX;
+    else
+      wait.timeout = (int)ms + (ms > (int)ms); /* round up */
+  }
+
+  rb_thread_call_without_gvl2(dnssd_wait_poll, &wait, RUBY_UBF_IO, NULL);
+  rb_thread_check_ints();
+
+  if (wait.result < 0 && wait.error != EINTR)
+    rb_syserr_fail(wait.error, "poll");
+
+  return wait.result > 0;
+#else
+  {
+    struct timeval tv, *tvp = NULL;
+    rb_fdset_t fds;
+    int max = fd, result;
+
+    if (!NIL_P(timeout)) {
+      tv  = rb_time_interval(timeout);
+      tvp = &tv;
+    }
+
+    rb_fd_init(&fds);
+    rb_fd_set(fd, &fds);
+
+    if (wakeup) {
+      rb_fd_set(wakeup->fds[0], &fds);
+      if (wakeup->fds[0] > max) max = wakeup->fds[0];
+    }
+
+    result = rb_thread_fd_select(max + 1, &fds, NULL, NULL, tvp);
+    result = result > 0 && rb_fd_isset(fd, &fds);
+
+    rb_fd_term(&fds);
+
+    return result;
+  }
+#endif
 }
 
 void
 Init_dnssd(void) {
   VALUE mDNSSD = rb_define_module("DNSSD");
 
+  dnssd_id_to_io = rb_intern("to_io");
+
   /* All interfaces */
   rb_define_const(mDNSSD, "InterfaceAny",
       ULONG2NUM(kDNSServiceInterfaceIndexAny));
@@ -58,12 +330,18 @@ Init_dnssd(void) {
       ULONG2NUM(kDNSServiceInterfaceIndexUnicast));
 #endif
 
-  rb_define_singleton_method(mDNSSD, "interface_index", dnssd_if_nametoindex, 1);
-  rb_define_singleton_method(mDNSSD, "interface_name", dnssd_if_indextoname, 1);
-
   Init_DNSSD_Errors();
   Init_DNSSD_Flags();
+  Init_DNSSD_Interface();
   Init_DNSSD_Record();
+  Init_DNSSD_Reply();
+  Init_DNSSD_AddrInfo();
+  Init_DNSSD_QueryRecord();
+  Init_DNSSD_TextRecord();
+  Init_DNSSD_Stats();
+  Init_DNSSD_Trace();
   Init_DNSSD_Service();
+  Init_DNSSD_Connection();
+  Init_DNSSD_Reactor();
 }
 
@@ -8,6 +8,7 @@
 #include <arpa/inet.h>  /* htons ntohs */
 #include <sys/socket.h> /* struct sockaddr_in */
 #include <netdb.h>      /* getservbyport */
+#include <sys/time.h>   /* gettimeofday */
 
 /* if_indextoname and if_nametoindex */
 #ifdef HAVE_IPHLPAPI_H
@@ -17,10 +18,28 @@
 #include <net/if.h>
 #endif
 
+/* The length of IPv4 or IPv6 sockaddr +sa+ */
 #ifdef HAVE_ST_SIN_LEN
-#define SIN_LEN(si) (si)->sin_len
+#define SOCKADDR_LEN(sa) (sa)->sa_len
 #else
-#define SIN_LEN(si) sizeof(struct sockaddr_in)
+#define SOCKADDR_LEN(sa) ((sa)->sa_family == AF_INET6 ?\
+    sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in))
+#endif
+
+/* USDT probes in the "dnssd" provider, compiled in by --with-usdt.  See
+ * README.txt for the probes and their arguments. */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define DNSSD_PROBE1(name, a) DTRACE_PROBE1(dnssd, name, a)
+#define DNSSD_PROBE2(name, a, b) DTRACE_PROBE2(dnssd, name, a, b)
+#define DNSSD_PROBE3(name, a, b, c) DTRACE_PROBE3(dnssd, name, a, b, c)
+#define DNSSD_PROBE6(name, a, b, c, d, e, f) \
+  DTRACE_PROBE6(dnssd, name, a, b, c, d, e, f)
+#else
+#define DNSSD_PROBE1(name, a)
+#define DNSSD_PROBE2(name, a, b)
+#define DNSSD_PROBE3(name, a, b, c)
+#define DNSSD_PROBE6(name, a, b, c, d, e, f)
 #endif
 
 #include <ruby/encoding.h>
@@ -35,6 +54,140 @@
 extern VALUE eDNSSDError;
 
 void dnssd_check_error_code(DNSServiceErrorType e);
+VALUE dnssd_error_new(DNSServiceErrorType e);
+
+/* Interrupts dnssd_wait_readable when its owner stops.  fds is an eventfd
+ * (both the same) or a pipe, created on the first wait.  With epoll +io+
+ * wraps an epoll descriptor for waiting through a Fiber scheduler. */
+typedef struct dnssd_wakeup {
+  int fds[2];
+  int signalled;
+#ifdef HAVE_SYS_EPOLL_H
+  VALUE io;
+#endif
+} dnssd_wakeup_t;
+
+void dnssd_wakeup_init(dnssd_wakeup_t *wakeup);
+void dnssd_wakeup_open(dnssd_wakeup_t *wakeup);
+void dnssd_wakeup_signal(dnssd_wakeup_t *wakeup);
+void dnssd_wakeup_close(dnssd_wakeup_t *wakeup);
+
+#ifdef HAVE_SYS_EPOLL_H
+#define dnssd_wakeup_mark(wakeup) rb_gc_mark((wakeup)->io)
+#else
+#define dnssd_wakeup_mark(wakeup)
+#endif
+
+int dnssd_wait_readable(VALUE owner, int fd, dnssd_wakeup_t *wakeup,
+    VALUE timeout);
+
+/* A daemon connection created by DNSServiceCreateConnection.  It is shared by
+ * the DNSSD::Connection that created it and every service started on it, and
+ * is freed when the last of them lets go. */
+typedef struct dnssd_connection {
+  DNSServiceRef ref;
+  long refs;
+  dnssd_wakeup_t wakeup;
+} dnssd_connection_t;
+
+dnssd_connection_t *dnssd_connection_get(VALUE connection);
+void dnssd_connection_release(dnssd_connection_t *connection);
+
+DNSServiceRef dnssd_service_ref(VALUE service);
+
+DNSRecordRef *dnssd_record_get(VALUE record);
+
+/* Time spent in DNSServiceProcessResult */
+typedef struct dnssd_process_stats {
+  unsigned long long calls;
+  uint64_t ns;
+  uint64_t max_ns;
+  unsigned long long unknown_errors;
+} dnssd_process_stats_t;
+
+/* Counters for the whole process, see DNSSD.stats */
+typedef struct dnssd_stats {
+  unsigned long long services_started;
+  long long services_live;
+  unsigned long long replies;
+  unsigned long long replies_dropped;
+  unsigned long long replies_coalesced;
+  long queue_max;
+  dnssd_process_stats_t process;
+} dnssd_stats_t;
+
+extern dnssd_stats_t dnssd_stats;
+
+uint64_t dnssd_clock_ns(void);
+void dnssd_stats_process(dnssd_process_stats_t *stats, uint64_t started,
+    DNSServiceErrorType e);
+void dnssd_stats_process_hash(VALUE hash, const dnssd_process_stats_t *stats);
+
+/* The interface table, see interface.c */
+unsigned int dnssd_interface_index(VALUE name);
+VALUE dnssd_interface_name(unsigned int index);
+
+#define DNSSD_REPLY_FIELDS  3
+#define DNSSD_REPLY_NUMBERS 3
+
+/* The raw data of a reply from the daemon.  +fields+ point into +buffer+ and
+ * hold names, record data and the like; +numbers+ hold ports, TTLs and record
+ * types.  Which slot holds what depends on the reply class.  +raw+ is 0 for a
+ * reply created in ruby, which keeps everything in instance variables. */
+typedef struct dnssd_reply {
+  VALUE service;
+  DNSServiceFlags flags;
+  uint32_t interface;
+  int raw;
+  int has_interface;
+  struct timeval created;
+  uint32_t numbers[DNSSD_REPLY_NUMBERS];
+  int nfields;
+  const char *fields[DNSSD_REPLY_FIELDS];
+  long lengths[DNSSD_REPLY_FIELDS];
+  char *buffer;
+} dnssd_reply_t;
+
+dnssd_reply_t *dnssd_reply_get(VALUE self);
+VALUE dnssd_reply_new(VALUE klass, VALUE service, DNSServiceFlags flags,
+    uint32_t interface, dnssd_reply_t **reply);
+void dnssd_reply_set_fields(dnssd_reply_t *reply, int count,
+    const char **fields, const long *lengths);
+
+/* The callback a trace frame was recorded from, see trace.c */
+#define DNSSD_TRACE_BROWSE       1
+#define DNSSD_TRACE_DOMAIN       2
+#define DNSSD_TRACE_GETADDRINFO  3
+#define DNSSD_TRACE_QUERY_RECORD 4
+#define DNSSD_TRACE_REGISTER     5
+#define DNSSD_TRACE_RESOLVE      6
+
+/* A decoded trace frame */
+typedef struct dnssd_trace_record {
+  int kind;
+  DNSServiceFlags flags;
+  uint32_t interface;
+  int nfields;
+  const char *fields[DNSSD_REPLY_FIELDS];
+  long lengths[DNSSD_REPLY_FIELDS];
+  int nnumbers;
+  uint32_t numbers[DNSSD_REPLY_NUMBERS];
+} dnssd_trace_record_t;
+
+int dnssd_trace_recording(void);
+uint32_t dnssd_trace_next_id(void);
+void dnssd_trace_write(uint32_t service, int kind, DNSServiceFlags flags,
+    uint32_t interface, int nfields, const char **fields,
+    const long *lengths, int nnumbers, const uint32_t *numbers);
+void dnssd_trace_decode(VALUE frame, dnssd_trace_record_t *record,
+    char *buffer);
+
+#define DNSSD_TXT_MISSING  0
+#define DNSSD_TXT_NO_VALUE 1
+#define DNSSD_TXT_VALUE    2
+
+int dnssd_text_record_find(const char *data, long length, const char *key,
+    long key_length, const char **value, long *value_length);
 
 #endif /* RDNSSD_INCLUDED */
 
@@ -32,6 +32,32 @@ dnssd_check_error_code(DNSServiceErrorType err) {
   }
 }
 
+/* Returns an exception for error code +err+ without raising it, or nil if
+ * +err+ is kDNSServiceErr_NoError.  Used where the daemon reports an error
+ * from a callback that must not raise. */
+
+VALUE
+dnssd_error_new(DNSServiceErrorType err) {
+  VALUE klass = 0;
+  VALUE message;
+
+  if (!err)
+    return Qnil;
+
+  if (DNSSD_ERROR_START <= err && err < DNSSD_ERROR_END) {
+    klass = dnssd_errors[err - DNSSD_ERROR_START];
+    message = rb_sprintf("DNSSD operation failed with error code: %d", err);
+  }
+
+  if (!klass) {
+    klass = eDNSSDUnknownError;
+    message = rb_sprintf(
+        "DNSSD operation failed with unrecognized error code: %d", err);
+  }
+
+  return rb_exc_new_str(klass, message);
+}
+
 /* Document-class: DNSSD::Error
  *
  * Base class of all DNS Service Discovery related errors.
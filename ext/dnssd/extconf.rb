@@ -43,8 +43,14 @@ else
   have_func('if_indextoname', %w[sys/types.h sys/socket.h net/if.h]) &&
   have_func('if_nametoindex', %w[sys/types.h sys/socket.h net/if.h]) ||
   abort('unable to find if_indextoname or if_nametoindex')
+
+  have_func 'if_nameindex', %w[sys/types.h sys/socket.h net/if.h]
 end
 
+# for refreshing the interface table when links change
+have_header 'pthread.h'
+have_header 'linux/rtnetlink.h', %w[sys/socket.h linux/netlink.h]
+
 have_type('struct sockaddr_in', 'netinet/in.h') ||
 abort('unable to find struct sockaddr_in')
 
@@ -56,6 +62,7 @@ puts 'checking for missing avahi features'
 # avahi 0.6.25 is missing these functions
 have_func 'DNSServiceGetProperty', 'dns_sd.h'
 have_func 'DNSServiceGetAddrInfo', 'dns_sd.h'
+have_func 'DNSServiceCreateConnection', 'dns_sd.h'
 
 # avahi 0.6.25 is missing these flags
 have_func 'kDNSServiceFlagsForce', 'dns_sd.h'
@@ -66,9 +73,24 @@ have_func 'kDNSServiceFlagsShareConnection', 'dns_sd.h'
 # avahi 0.6.25 is missing errors after BadTime
 have_func 'kDNSServiceErr_BadSig', 'dns_sd.h'
 
+# USDT probes for bpftrace, perf and systemtap, see README.txt
+if with_config 'usdt' then
+  have_header('sys/sdt.h') ||
+    abort('--with-usdt needs sys/sdt.h (systemtap-sdt-dev or systemtap-sdt-devel)')
+end
+
+have_header 'poll.h'
+have_header 'sys/epoll.h'
+have_header 'sys/eventfd.h'
+have_func 'clock_gettime', 'time.h'
+
 puts
 puts 'checking for ruby features'
 have_header 'ruby/encoding.h'
+have_header 'ruby/thread.h'
+have_func 'rb_thread_call_without_gvl2', 'ruby/thread.h'
+have_header 'ruby/fiber/scheduler.h'
+have_func 'rb_fiber_scheduler_current', 'ruby/fiber/scheduler.h'
 
 puts
 create_makefile 'dnssd'
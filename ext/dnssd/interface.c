@@ -0,0 +1,304 @@
+#include "dnssd.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#if defined(HAVE_LINUX_RTNETLINK_H) && defined(HAVE_PTHREAD_H)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#define DNSSD_NETLINK 1
+#endif
+
+/* The process-wide interface table.  Interface names and indexes are looked
+ * up in two Hashes instead of calling if_indextoname and if_nametoindex for
+ * every reply and every service.  The table is filled from if_nameindex when
+ * it is first used or after it went stale.
+ *
+ * On Linux a native thread listens for RTM_NEWLINK and RTM_DELLINK on a
+ * netlink socket and marks the table stale, so the next lookup rebuilds it.
+ * Elsewhere, and if the netlink socket can't be opened, nothing tells us
+ * about changes so the table is rebuilt once it is DNSSD_INTERFACE_TTL old.
+ * In between a name or index missing from the table is looked up with a
+ * syscall and added to it. */
+
+static VALUE dnssd_interface_names   = Qnil; /* index => frozen name */
+static VALUE dnssd_interface_indexes = Qnil; /* name => index */
+
+/* set by the watcher thread, read with the GVL held */
+static volatile int dnssd_interface_stale = 1;
+
+/* when the table was last built, for expiring it without a watcher */
+static uint64_t dnssd_interface_built = 0;
+
+#define DNSSD_INTERFACE_TTL 1000000000 /* ns */
+
+#ifdef DNSSD_NETLINK
+static volatile int dnssd_interface_watching = 0;
+static int dnssd_interface_netlink = -1;
+
+/* Reads link messages until the socket fails.  This thread never touches a
+ * ruby object, it only marks the table stale. */
+
+static void *
+dnssd_interface_watch(void *unused) {
+  char buffer[8192];
+
+  for (;;) {
+    struct nlmsghdr *message = (struct nlmsghdr *)buffer;
+    ssize_t length = recv(dnssd_interface_netlink, buffer, sizeof(buffer), 0);
+
+    if (length < 0) {
+      if (errno == EINTR)
+        continue;
+
+      /* the kernel dropped messages, we may have missed a change */
+      if (errno == ENOBUFS) {
+        dnssd_interface_stale = 1;
+        continue;
+      }
+
+      break;
+    }
+
+    for (; NLMSG_OK(message, (size_t)length);
+        message = NLMSG_NEXT(message, length)) {
+      if (message->nlmsg_type == RTM_NEWLINK ||
+          message->nlmsg_type == RTM_DELLINK)
+        dnssd_interface_stale = 1;
+    }
+  }
+
+  dnssd_interface_watching = 0;
+  dnssd_interface_stale    = 1;
+
+  return NULL;
+}
+
+/* Opens the netlink socket and starts the watcher thread.  Returns without
+ * watching if either fails. */
+
+static void
+dnssd_interface_start_watch(void) {
+  struct sockaddr_nl address;
+  pthread_attr_t attr;
+  pthread_t thread;
+  int fd;
+
+  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+
+  if (fd < 0)
+    return;
+
+  rb_update_max_fd(fd);
+  rb_fd_fix_cloexec(fd);
+
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = RTMGRP_LINK;
+
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    close(fd);
+    return;
+  }
+
+  dnssd_interface_netlink  = fd;
+  dnssd_interface_watching = 1;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&thread, &attr, dnssd_interface_watch, NULL)) {
+    dnssd_interface_watching = 0;
+    dnssd_interface_netlink  = -1;
+    close(fd);
+  }
+
+  pthread_attr_destroy(&attr);
+}
+
+/* The watcher thread does not survive fork, the child starts its own */
+
+static void
+dnssd_interface_atfork_child(void) {
+  if (dnssd_interface_netlink >= 0)
+    close(dnssd_interface_netlink);
+
+  dnssd_interface_netlink  = -1;
+  dnssd_interface_watching = 0;
+  dnssd_interface_stale    = 1;
+}
+#endif
+
+static void
+dnssd_interface_add(unsigned int index, const char *cname) {
+  VALUE name = rb_obj_freeze(rb_str_new_cstr(cname));
+
+  rb_hash_aset(dnssd_interface_names, UINT2NUM(index), name);
+  rb_hash_aset(dnssd_interface_indexes, name, UINT2NUM(index));
+}
+
+/* Rebuilds the table if it went stale, or expired when no watcher tells us
+ * about changes */
+
+static void
+dnssd_interface_refresh(void) {
+#ifdef HAVE_IF_NAMEINDEX
+  struct if_nameindex *interfaces, *interface;
+#endif
+  int watching = 0;
+  uint64_t now = dnssd_clock_ns();
+
+#ifdef DNSSD_NETLINK
+  watching = dnssd_interface_watching;
+#endif
+
+  if (!dnssd_interface_stale &&
+      (watching || now - dnssd_interface_built < DNSSD_INTERFACE_TTL))
+    return;
+
+#ifdef DNSSD_NETLINK
+  if (!dnssd_interface_watching)
+    dnssd_interface_start_watch();
+#endif
+
+  /* cleared first so a change during the rebuild marks it stale again */
+  dnssd_interface_stale = 0;
+  dnssd_interface_built = now;
+
+  dnssd_interface_names   = rb_hash_new();
+  dnssd_interface_indexes = rb_hash_new();
+
+#ifdef HAVE_IF_NAMEINDEX
+  interfaces = if_nameindex();
+
+  /* try again on the next lookup, the misses go to the syscalls meanwhile */
+  if (!interfaces) {
+    dnssd_interface_stale = 1;
+    return;
+  }
+
+  for (interface = interfaces; interface->if_index; interface++)
+    dnssd_interface_add(interface->if_index, interface->if_name);
+
+  if_freenameindex(interfaces);
+#endif
+}
+
+/* Returns the index of interface +name+, 0 if there is no such interface */
+
+unsigned int
+dnssd_interface_index(VALUE name) {
+  unsigned int index;
+  VALUE cached;
+
+  dnssd_interface_refresh();
+
+  cached = rb_hash_lookup(dnssd_interface_indexes, StringValue(name));
+
+  if (!NIL_P(cached))
+    return NUM2UINT(cached);
+
+  index = if_nametoindex(StringValueCStr(name));
+
+  if (index)
+    dnssd_interface_add(index, RSTRING_PTR(name));
+
+  return index;
+}
+
+/* Returns the frozen name of interface +index+, or Qnil if there is no such
+ * interface */
+
+VALUE
+dnssd_interface_name(unsigned int index) {
+  char buffer[IF_NAMESIZE];
+  VALUE cached;
+
+  dnssd_interface_refresh();
+
+  cached = rb_hash_lookup(dnssd_interface_names, UINT2NUM(index));
+
+  if (!NIL_P(cached))
+    return cached;
+
+  if (!if_indextoname(index, buffer))
+    return Qnil;
+
+  dnssd_interface_add(index, buffer);
+
+  return rb_hash_lookup(dnssd_interface_names, UINT2NUM(index));
+}
+
+/*
+ * call-seq:
+ *   DNSSD.interface_index(interface_name) # => interface_index
+ *
+ * Returns the interface index for interface +interface_name+, 0 if there is
+ * no such interface.
+ *
+ *   DNSSD.interface_index 'lo0' # => 1
+ */
+
+static VALUE
+dnssd_if_nametoindex(VALUE self, VALUE name) {
+  return UINT2NUM(dnssd_interface_index(name));
+}
+
+/*
+ * call-seq:
+ *   DNSSD.interface_name(interface_index) # => interface_name
+ *
+ * Returns the interface name for interface +interface_index+ as a frozen
+ * String.
+ *
+ *   DNSSD.interface_name 1 # => 'lo0'
+ */
+
+static VALUE
+dnssd_if_indextoname(VALUE self, VALUE _index) {
+  unsigned int index = NUM2UINT(_index);
+  VALUE name = dnssd_interface_name(index);
+
+  if (NIL_P(name))
+    rb_raise(rb_eArgError, "invalid interface %d", index);
+
+  return name;
+}
+
+/*
+ * call-seq:
+ *   DNSSD.interfaces # => { interface_index => interface_name }
+ *
+ * Returns a frozen Hash of the interfaces in the interface table.
+ */
+
+static VALUE
+dnssd_interfaces(VALUE self) {
+  VALUE interfaces;
+
+  dnssd_interface_refresh();
+
+  interfaces = rb_hash_dup(dnssd_interface_names);
+
+  return rb_obj_freeze(interfaces);
+}
+
+void
+Init_DNSSD_Interface(void) {
+  VALUE mDNSSD = rb_define_module("DNSSD");
+
+  rb_gc_register_address(&dnssd_interface_names);
+  rb_gc_register_address(&dnssd_interface_indexes);
+
+#ifdef DNSSD_NETLINK
+  pthread_atfork(NULL, NULL, dnssd_interface_atfork_child);
+#endif
+
+  rb_define_singleton_method(mDNSSD, "interface_index", dnssd_if_nametoindex, 1);
+  rb_define_singleton_method(mDNSSD, "interface_name", dnssd_if_indextoname, 1);
+  rb_define_singleton_method(mDNSSD, "interfaces", dnssd_interfaces, 0);
+}
@@ -0,0 +1,320 @@
+#include "dnssd.h"
+
+static VALUE cDNSSDReplyQueryRecord;
+
+/* Layouts of the record types #_decode_rdata understands, one character per
+ * field:
+ *
+ *   C  8 bit integer
+ *   n  16 bit integer
+ *   N  32 bit integer
+ *   d  domain-name
+ *   s  character-string
+ *   S  character-strings until the end of the rdata
+ *   b  binary String of the rest of the rdata
+ *   T  NSEC type bitmap, an Array of record types
+ *
+ * A layout of a single field decodes to that field alone, otherwise the
+ * fields are returned in an Array. */
+
+typedef struct {
+  uint16_t type;
+  const char *layout;
+} dnssd_rdata_layout_t;
+
+static const dnssd_rdata_layout_t dnssd_rdata_layouts[] = {
+  { kDNSServiceType_AFSDB, "nd" },
+  { kDNSServiceType_CERT,  "nnCb" },
+  { kDNSServiceType_CNAME, "d" },
+  { kDNSServiceType_DHCID, "b" },
+  { kDNSServiceType_DNAME, "d" },
+  { kDNSServiceType_DNSKEY, "nCCb" },
+  { kDNSServiceType_DS,    "nCCb" },
+  { kDNSServiceType_HINFO, "ss" },
+  { kDNSServiceType_ISDN,  "S" },
+  { kDNSServiceType_KEY,   "nCCb" },
+  { kDNSServiceType_KX,    "nd" },
+  { kDNSServiceType_MB,    "d" },
+  { kDNSServiceType_MD,    "d" },
+  { kDNSServiceType_MF,    "d" },
+  { kDNSServiceType_MG,    "d" },
+  { kDNSServiceType_MINFO, "dd" },
+  { kDNSServiceType_MR,    "d" },
+  { kDNSServiceType_MX,    "nd" },
+  { kDNSServiceType_NAPTR, "nnsssd" },
+  { kDNSServiceType_NS,    "d" },
+  { kDNSServiceType_NSEC,  "dT" },
+  { kDNSServiceType_PTR,   "d" },
+  { kDNSServiceType_PX,    "ndd" },
+  { kDNSServiceType_RP,    "dd" },
+  { kDNSServiceType_RRSIG, "nCCNNNndb" },
+  { kDNSServiceType_RT,    "nd" },
+  { kDNSServiceType_SIG,   "nCCNNNndb" },
+  { kDNSServiceType_SOA,   "ddNNNNN" },
+  { kDNSServiceType_SRV,   "nnnd" },
+  { kDNSServiceType_SSHFP, "CCb" },
+  { kDNSServiceType_TXT,   "S" },
+  { kDNSServiceType_X25,   "S" },
+};
+
+static uint32_t
+dnssd_rdata_uint32(const unsigned char *data) {
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+    (uint32_t)data[2] << 8 | data[3];
+}
+
+static void
+dnssd_rdata_short(VALUE rdata) {
+  rb_raise(rb_eTypeError, "rdata too short in %+"PRIsVALUE, rdata);
+}
+
+static VALUE
+dnssd_rdata_str(const unsigned char *ptr, long length) {
+  return rb_obj_freeze(rb_enc_str_new((const char *)ptr, length,
+        rb_utf8_encoding()));
+}
+
+/* Reads the character-string at +*data+ and advances past it */
+
+static VALUE
+dnssd_rdata_character_string(VALUE rdata, const unsigned char **data,
+    const unsigned char *end) {
+  const unsigned char *string = *data;
+  long length;
+
+  if (string >= end)
+    dnssd_rdata_short(rdata);
+
+  length = *string++;
+
+  if (end - string < length)
+    rb_raise(rb_eTypeError,
+        "invalid character string, expected %ld got %ld in %+"PRIsVALUE,
+        length, (long)(end - string), rdata);
+
+  *data = string + length;
+
+  return dnssd_rdata_str(string, length);
+}
+
+/* Reads the domain-name at +*data+ into a String with one "." after each
+ * label and advances past it.  Names in rdata from the daemon are already
+ * expanded so there is no message for a compression pointer to refer to. */
+
+static VALUE
+dnssd_rdata_domain_name(VALUE rdata, const unsigned char **data,
+    const unsigned char *end) {
+  const unsigned char *label = *data;
+  char name[kDNSServiceMaxDomainName];
+  long length = 0;
+
+  for (;;) {
+    long size;
+
+    if (label >= end)
+      dnssd_rdata_short(rdata);
+
+    size = *label++;
+
+    if (!size)
+      break;
+
+    if (size & 0xC0)
+      rb_raise(rb_eTypeError, "compressed domain name in %+"PRIsVALUE, rdata);
+
+    if (end - label < size)
+      rb_raise(rb_eTypeError,
+          "invalid character string, expected %ld got %ld in %+"PRIsVALUE,
+          size, (long)(end - label), rdata);
+
+    if (length + size + 1 >= (long)sizeof(name))
+      rb_raise(rb_eTypeError, "domain name too long in %+"PRIsVALUE, rdata);
+
+    memcpy(name + length, label, size);
+    length += size;
+    name[length++] = '.';
+
+    label += size;
+  }
+
+  *data = label;
+
+  if (!length)
+    return dnssd_rdata_str((const unsigned char *)".", 1);
+
+  return dnssd_rdata_str((const unsigned char *)name, length);
+}
+
+/* Decodes an NSEC type bitmap (RFC 4034 section 4.1.2) into the record
+ * types it lists */
+
+static VALUE
+dnssd_rdata_type_bitmap(VALUE rdata, const unsigned char *data,
+    const unsigned char *end) {
+  VALUE types = rb_ary_new();
+
+  while (data < end) {
+    unsigned int window, length, i, bit;
+
+    if (end - data < 2)
+      dnssd_rdata_short(rdata);
+
+    window = data[0];
+    length = data[1];
+    data += 2;
+
+    if (length < 1 || length > 32 || end - data < (long)length)
+      rb_raise(rb_eTypeError, "invalid type bitmap in %+"PRIsVALUE, rdata);
+
+    for (i = 0; i < length; i++)
+      for (bit = 0; bit < 8; bit++)
+        if (data[i] & (0x80 >> bit))
+          rb_ary_push(types, UINT2NUM(window * 256 + i * 8 + bit));
+
+    data += length;
+  }
+
+  return rb_obj_freeze(types);
+}
+
+/* Decodes a LOC size or precision byte into centimeters */
+
+static VALUE
+dnssd_rdata_loc_size(unsigned char size) {
+  unsigned long centimeters = size >> 4;
+  int exponent = size & 0x0F;
+
+  while (exponent-- > 0)
+    centimeters *= 10;
+
+  return ULONG2NUM(centimeters);
+}
+
+/* Decodes a version 0 LOC record (RFC 1876) */
+
+static VALUE
+dnssd_rdata_loc(VALUE rdata, const unsigned char *data, long length) {
+  VALUE loc;
+
+  if (length != 16 || data[0] != 0)
+    return Qnil;
+
+  loc = rb_ary_new_capa(7);
+
+  rb_ary_push(loc, INT2FIX(0));
+  rb_ary_push(loc, dnssd_rdata_loc_size(data[1]));
+  rb_ary_push(loc, dnssd_rdata_loc_size(data[2]));
+  rb_ary_push(loc, dnssd_rdata_loc_size(data[3]));
+  /* thousandths of an arc second north or east, centimeters above sea */
+  rb_ary_push(loc, LL2NUM((LONG_LONG)dnssd_rdata_uint32(data + 4) - 2147483648LL));
+  rb_ary_push(loc, LL2NUM((LONG_LONG)dnssd_rdata_uint32(data + 8) - 2147483648LL));
+  rb_ary_push(loc, LL2NUM((LONG_LONG)dnssd_rdata_uint32(data + 12) - 10000000LL));
+
+  return rb_obj_freeze(loc);
+}
+
+static const char *
+dnssd_rdata_layout(uint16_t type) {
+  size_t i;
+
+  for (i = 0; i < sizeof(dnssd_rdata_layouts) / sizeof(dnssd_rdata_layouts[0]); i++)
+    if (dnssd_rdata_layouts[i].type == type)
+      return dnssd_rdata_layouts[i].layout;
+
+  return NULL;
+}
+
+/* call-seq:
+ *   _decode_rdata(record_type, rdata) # => Object or nil
+ *
+ * Decodes +rdata+ of +record_type+ in a single pass.  Returns a frozen
+ * String, Integer or Array of them, or nil if +record_type+ is not handled.
+ * Raises TypeError if +rdata+ does not match the layout of +record_type+.
+ */
+
+static VALUE
+dnssd_query_record_decode_rdata(VALUE self, VALUE _type, VALUE rdata) {
+  uint16_t type = (uint16_t)NUM2UINT(_type);
+  const unsigned char *data, *end;
+  const char *layout;
+  VALUE fields, field = Qnil;
+
+  StringValue(rdata);
+
+  data = (const unsigned char *)RSTRING_PTR(rdata);
+  end  = data + RSTRING_LEN(rdata);
+
+  if (type == kDNSServiceType_LOC)
+    return dnssd_rdata_loc(rdata, data, RSTRING_LEN(rdata));
+
+  if (!(layout = dnssd_rdata_layout(type)))
+    return Qnil;
+
+  fields = rb_ary_new_capa((long)strlen(layout));
+
+  for (; *layout; layout++) {
+    switch (*layout) {
+    case 'C':
+      if (end - data < 1)
+        dnssd_rdata_short(rdata);
+      field = INT2FIX(data[0]);
+      data += 1;
+      break;
+    case 'n':
+      if (end - data < 2)
+        dnssd_rdata_short(rdata);
+      field = INT2FIX(data[0] << 8 | data[1]);
+      data += 2;
+      break;
+    case 'N':
+      if (end - data < 4)
+        dnssd_rdata_short(rdata);
+      field = ULONG2NUM(dnssd_rdata_uint32(data));
+      data += 4;
+      break;
+    case 'd':
+      field = dnssd_rdata_domain_name(rdata, &data, end);
+      break;
+    case 's':
+      field = dnssd_rdata_character_string(rdata, &data, end);
+      break;
+    case 'S':
+      field = rb_ary_new();
+      while (data < end)
+        rb_ary_push(field, dnssd_rdata_character_string(rdata, &data, end));
+      rb_obj_freeze(field);
+      break;
+    case 'b':
+      field = rb_obj_freeze(rb_str_new((const char *)data, end - data));
+      data = end;
+      break;
+    case 'T':
+      field = dnssd_rdata_type_bitmap(rdata, data, end);
+      data = end;
+      break;
+    }
+
+    rb_ary_push(fields, field);
+  }
+
+  if (data != end)
+    rb_raise(rb_eTypeError, "%ld extra bytes in %+"PRIsVALUE,
+        (long)(end - data), rdata);
+
+  if (RARRAY_LEN(fields) == 1)
+    return field;
+
+  return rb_obj_freeze(fields);
+}
+
+/* Document-class: DNSSD::Reply::QueryRecord
+ *
+ * The rdata decoder.  See lib/dnssd/reply/query_record.rb
+ */
+
+void
+Init_DNSSD_QueryRecord(void) {
+  cDNSSDReplyQueryRecord = rb_path2class("DNSSD::Reply::QueryRecord");
+
+  rb_define_private_method(cDNSSDReplyQueryRecord, "_decode_rdata", dnssd_query_record_decode_rdata, 2);
+}
@@ -0,0 +1,355 @@
+#include "dnssd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+
+#include <ruby/io.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL2)
+#define DNSSD_REACTOR_EPOLL 1
+#define DNSSD_REACTOR_MAX_EVENTS 256
+#endif
+
+static VALUE cDNSSDReactor;
+
+/* The sockets watched by a DNSSD::Reactor.  With epoll they live in the
+ * kernel's interest list, otherwise in +fds+ for rb_thread_fd_select.
+ * +wakeup+ is a pipe that interrupts a wait when written to. */
+typedef struct dnssd_reactor {
+  int wakeup[2];
+#ifdef DNSSD_REACTOR_EPOLL
+  int epfd;
+#else
+  int *fds;
+  long nfds;
+  long capa;
+#endif
+} dnssd_reactor_t;
+
+static void
+dnssd_reactor_free(void *ptr) {
+  dnssd_reactor_t *reactor = (dnssd_reactor_t *)ptr;
+
+  if (reactor->wakeup[0] >= 0) {
+    close(reactor->wakeup[0]);
+    close(reactor->wakeup[1]);
+  }
+
+#ifdef DNSSD_REACTOR_EPOLL
+  if (reactor->epfd >= 0)
+    close(reactor->epfd);
+#else
+  xfree(reactor->fds);
+#endif
+
+  xfree(reactor);
+}
+
+static const rb_data_type_t dnssd_reactor_type = {
+    "DNSSD/reactor",
+    {0, dnssd_reactor_free, 0,},
+    0, 0,
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+static void
+dnssd_reactor_watch(dnssd_reactor_t *reactor, int fd) {
+#ifdef DNSSD_REACTOR_EPOLL
+  struct epoll_event event;
+
+  event.events  = EPOLLIN;
+  event.data.fd = fd;
+
+  if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &event) < 0 &&
+      errno != EEXIST)
+    rb_sys_fail("epoll_ctl");
+#else
+  long i;
+
+  for (i = 0; i < reactor->nfds; i++)
+    if (reactor->fds[i] == fd)
+      return;
+
+  if (reactor->nfds == reactor->capa) {
+    reactor->capa = reactor->capa ? reactor->capa * 2 : 16;
+    REALLOC_N(reactor->fds, int, reactor->capa);
+  }
+
+  reactor->fds[reactor->nfds++] = fd;
+#endif
+}
+
+static VALUE
+dnssd_reactor_s_allocate(VALUE klass) {
+  dnssd_reactor_t *reactor;
+  VALUE self;
+
+  self = TypedData_Make_Struct(klass, dnssd_reactor_t, &dnssd_reactor_type,
+      reactor);
+
+  reactor->wakeup[0] = reactor->wakeup[1] = -1;
+#ifdef DNSSD_REACTOR_EPOLL
+  reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (reactor->epfd < 0)
+    rb_sys_fail("epoll_create1");
+#endif
+
+  if (rb_pipe(reactor->wakeup) < 0)
+    rb_sys_fail("pipe");
+
+  fcntl(reactor->wakeup[0], F_SETFL, O_NONBLOCK);
+  fcntl(reactor->wakeup[1], F_SETFL, O_NONBLOCK);
+
+  dnssd_reactor_watch(reactor, reactor->wakeup[0]);
+
+  return self;
+}
+
+/* call-seq:
+ *   reactor._add(fd)
+ *
+ * Starts watching +fd+ for readability
+ */
+
+static VALUE
+dnssd_reactor_add(VALUE self, VALUE _fd) {
+  dnssd_reactor_t *reactor;
+
+  TypedData_Get_Struct(self, dnssd_reactor_t, &dnssd_reactor_type, reactor);
+
+  dnssd_reactor_watch(reactor, NUM2INT(_fd));
+
+  return self;
+}
+
+/* call-seq:
+ *   reactor._remove(fd)
+ *
+ * Stops watching +fd+
+ */
+
+static VALUE
+dnssd_reactor_remove(VALUE self, VALUE _fd) {
+  dnssd_reactor_t *reactor;
+  int fd = NUM2INT(_fd);
+
+  TypedData_Get_Struct(self, dnssd_reactor_t, &dnssd_reactor_type, reactor);
+
+#ifdef DNSSD_REACTOR_EPOLL
+  /* ENOENT and EBADF mean the socket is already gone */
+  if (epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, fd, NULL) < 0 &&
+      errno != ENOENT && errno != EBADF)
+    rb_sys_fail("epoll_ctl");
+#else
+  {
+    long i;
+
+    for (i = 0; i < reactor->nfds; i++) {
+      if (reactor->fds[i] == fd) {
+        reactor->fds[i] = reactor->fds[--reactor->nfds];
+        break;
+      }
+    }
+  }
+#endif
+
+  return self;
+}
+
+/* Interrupts a thread blocked in #_wait so it can pick up new timeouts or
+ * notice the reactor shutting down. */
+
+static VALUE
+dnssd_reactor_wakeup(VALUE self) {
+  dnssd_reactor_t *reactor;
+  ssize_t written;
+
+  TypedData_Get_Struct(self, dnssd_reactor_t, &dnssd_reactor_type, reactor);
+
+  /* a full pipe already has a wakeup pending */
+  written = write(reactor->wakeup[1], "", 1);
+  (void)written;
+
+  return self;
+}
+
+static void
+dnssd_reactor_drain(dnssd_reactor_t *reactor) {
+  char buffer[64];
+
+  while (read(reactor->wakeup[0], buffer, sizeof(buffer)) > 0)
+    ;
+}
+
+#ifdef DNSSD_REACTOR_EPOLL
+struct dnssd_reactor_wait {
+  int epfd;
+  int timeout;
+  int result;
+  int error;
+  struct epoll_event events[DNSSD_REACTOR_MAX_EVENTS];
+};
+
+static void *
+dnssd_reactor_epoll_wait(void *ptr) {
+  struct dnssd_reactor_wait *wait = (struct dnssd_reactor_wait *)ptr;
+
+  wait->result = epoll_wait(wait->epfd, wait->events,
+      DNSSD_REACTOR_MAX_EVENTS, wait->timeout);
+  wait->error = errno;
+
+  return NULL;
+}
+#else
+struct dnssd_reactor_select {
+  dnssd_reactor_t *reactor;
+  rb_fdset_t fds;
+  struct timeval *timeout;
+};
+
+static VALUE
+dnssd_reactor_select(VALUE ptr) {
+  struct dnssd_reactor_select *sel = (struct dnssd_reactor_select *)ptr;
+  dnssd_reactor_t *reactor = sel->reactor;
+  VALUE ready = rb_ary_new();
+  int max = -1;
+  long i;
+
+  for (i = 0; i < reactor->nfds; i++) {
+    rb_fd_set(reactor->fds[i], &sel->fds);
+
+    if (reactor->fds[i] > max)
+      max = reactor->fds[i];
+  }
+
+  if (rb_thread_fd_select(max + 1, &sel->fds, NULL, NULL,
+        sel->timeout) <= 0)
+    return ready;
+
+  for (i = 0; i < reactor->nfds; i++) {
+    int fd = reactor->fds[i];
+
+    if (!rb_fd_isset(fd, &sel->fds))
+      continue;
+
+    if (fd == reactor->wakeup[0])
+      dnssd_reactor_drain(reactor);
+    else
+      rb_ary_push(ready, INT2NUM(fd));
+  }
+
+  return ready;
+}
+
+static VALUE
+dnssd_reactor_select_ensure(VALUE ptr) {
+  struct dnssd_reactor_select *sel = (struct dnssd_reactor_select *)ptr;
+
+  rb_fd_term(&sel->fds);
+
+  return Qnil;
+}
+#endif
+
+/* call-seq:
+ *   reactor._wait(timeout) # => [fd, ...]
+ *
+ * Waits up to +timeout+ seconds (forever if +nil+) without holding the GVL
+ * and returns the watched file descriptors that are readable.  Returns an
+ * empty Array on timeout or wakeup.
+ */
+
+static VALUE
+dnssd_reactor_wait(VALUE self, VALUE timeout) {
+  dnssd_reactor_t *reactor;
+#ifdef DNSSD_REACTOR_EPOLL
+  struct dnssd_reactor_wait wait;
+  VALUE ready;
+  int i;
+#else
+  struct dnssd_reactor_select sel;
+  struct timeval tv;
+#endif
+
+  TypedData_Get_Struct(self, dnssd_reactor_t, &dnssd_reactor_type, reactor);
+
+#ifdef DNSSD_REACTOR_EPOLL
+  wait.epfd    = reactor->epfd;
+  wait.timeout = -1;
+  wait.result  = 0;
+  wait.error   = 0;
+
+  if (!NIL_P(timeout)) {
+    double ms = NUM2DBL(timeout) * 1000.0;
+
+    wait.timeout = ms <= 0 ? 0 : ms >= INT_MAX ? INT_MAX :
+      (int)ms + (ms > (int)ms);
+  }
+
+  rb_thread_call_without_gvl2(dnssd_reactor_epoll_wait, &wait, RUBY_UBF_IO,
+      NULL);
+  rb_thread_check_ints();
+
+  if (wait.result < 0 && wait.error != EINTR)
+    rb_syserr_fail(wait.error, "epoll_wait");
+
+  ready = rb_ary_new2(wait.result > 0 ? wait.result : 0);
+
+  for (i = 0; i < wait.result; i++) {
+    int fd = wait.events[i].data.fd;
+
+    if (fd == reactor->wakeup[0])
+      dnssd_reactor_drain(reactor);
+    else
+      rb_ary_push(ready, INT2NUM(fd));
+  }
+
+  return ready;
+#else
+  sel.reactor = reactor;
+  sel.timeout = NULL;
+
+  if (!NIL_P(timeout)) {
+    tv = rb_time_interval(timeout);
+    sel.timeout = &tv;
+  }
+
+  rb_fd_init(&sel.fds);
+
+  return rb_ensure(dnssd_reactor_select, (VALUE)&sel,
+      dnssd_reactor_select_ensure, (VALUE)&sel);
+#endif
+}
+
+/* Document-class: DNSSD::Reactor
+ *
+ * Waits on the sockets of every asynchronous service from one thread.  See
+ * lib/dnssd/reactor.rb
+ */
+
+void
+Init_DNSSD_Reactor(void) {
+  VALUE mDNSSD = rb_define_module("DNSSD");
+
+  cDNSSDReactor = rb_define_class_under(mDNSSD, "Reactor", rb_cObject);
+
+  rb_define_alloc_func(cDNSSDReactor, dnssd_reactor_s_allocate);
+
+  rb_define_private_method(cDNSSDReactor, "_add", dnssd_reactor_add, 1);
+  rb_define_private_method(cDNSSDReactor, "_remove", dnssd_reactor_remove, 1);
+  rb_define_private_method(cDNSSDReactor, "_wait", dnssd_reactor_wait, 1);
+  rb_define_method(cDNSSDReactor, "wakeup", dnssd_reactor_wakeup, 0);
+}
@@ -2,22 +2,134 @@
 
 static VALUE cDNSSDRecord;
 
+static ID dnssd_iv_connection;
+static ID dnssd_iv_service;
+
 static void
 dnssd_record_free(void *ptr) {
   DNSRecordRef *record = (DNSRecordRef *)ptr;
 
-  /* TODO */
+  /* The DNSRecordRef belongs to the DNSServiceRef it was added to and is
+   * freed along with it.  It can't be removed here as the owner may already
+   * be gone, so a record that is garbage collected stays registered until its
+   * owner stops. */
+
+  xfree(record);
+}
 
-  free(record);
+static size_t
+dnssd_record_memsize(const void *ptr) {
+  return sizeof(DNSRecordRef);
+}
+
+static const rb_data_type_t dnssd_record_type = {
+    "DNSSD/record",
+    {0, dnssd_record_free, dnssd_record_memsize,},
+    0, 0,
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+/* Returns the record handle of DNSSD::Record +self+ for DNSServiceAddRecord
+ * or DNSServiceRegisterRecord to fill in */
+
+DNSRecordRef *
+dnssd_record_get(VALUE self) {
+  DNSRecordRef *record;
+
+  TypedData_Get_Struct(self, DNSRecordRef, &dnssd_record_type, record);
+
+  return record;
 }
 
 static VALUE
 dnssd_record_s_allocate(VALUE klass) {
-  DNSRecordRef *record = ALLOC(DNSRecordRef);
+  DNSRecordRef *record;
+  VALUE self;
+
+  self = TypedData_Make_Struct(klass, DNSRecordRef, &dnssd_record_type,
+      record);
 
   *record = NULL;
 
-  return Data_Wrap_Struct(klass, 0, dnssd_record_free, record);
+  return self;
+}
+
+/* Returns the DNSServiceRef +self+ was added to or registered on, raising
+ * DNSSD::Error if it has stopped or the record was removed. */
+
+static DNSServiceRef
+dnssd_record_owner(VALUE self, DNSRecordRef *record) {
+  VALUE owner;
+
+  if (!*record)
+    rb_raise(eDNSSDError, "record was removed");
+
+  owner = rb_ivar_get(self, dnssd_iv_connection);
+
+  if (!NIL_P(owner))
+    return dnssd_connection_get(owner)->ref;
+
+  owner = rb_ivar_get(self, dnssd_iv_service);
+
+  if (NIL_P(owner))
+    rb_raise(eDNSSDError, "record was never added");
+
+  return dnssd_service_ref(owner);
+}
+
+/* call-seq:
+ *   record._update(flags, data, ttl)
+ *
+ * Binding to DNSServiceUpdateRecord
+ */
+
+static VALUE
+dnssd_record_update(VALUE self, VALUE _flags, VALUE _rdata, VALUE _ttl) {
+  DNSRecordRef *record = dnssd_record_get(self);
+  DNSServiceRef owner = dnssd_record_owner(self, record);
+  DNSServiceErrorType e;
+
+  StringValue(_rdata);
+
+  if (RSTRING_LEN(_rdata) > UINT16_MAX)
+    rb_raise(rb_eArgError, "record data too long (%ld bytes)",
+        RSTRING_LEN(_rdata));
+
+  e = DNSServiceUpdateRecord(owner, *record,
+      (DNSServiceFlags)NUM2ULONG(_flags), (uint16_t)RSTRING_LEN(_rdata),
+      RSTRING_PTR(_rdata), (uint32_t)NUM2ULONG(_ttl));
+
+  dnssd_check_error_code(e);
+
+  return self;
+}
+
+/* call-seq:
+ *   record._remove
+ *
+ * Binding to DNSServiceRemoveRecord.  Returns false if the record was already
+ * removed.
+ */
+
+static VALUE
+dnssd_record_remove(VALUE self) {
+  DNSRecordRef *record = dnssd_record_get(self);
+  DNSServiceRef owner;
+  DNSServiceErrorType e;
+
+  if (!*record)
+    return Qfalse;
+
+  owner = dnssd_record_owner(self, record);
+
+  e = DNSServiceRemoveRecord(owner, *record, 0);
+  *record = NULL;
+
+  dnssd_check_error_code(e);
+
+  return Qtrue;
 }
 
 void
@@ -28,6 +140,12 @@ Init_DNSSD_Record(void) {
 
   rb_define_alloc_func(cDNSSDRecord, dnssd_record_s_allocate);
 
+  dnssd_iv_connection = rb_intern("@connection");
+  dnssd_iv_service    = rb_intern("@service");
+
+  rb_define_private_method(cDNSSDRecord, "_remove", dnssd_record_remove, 0);
+  rb_define_private_method(cDNSSDRecord, "_update", dnssd_record_update, 3);
+
   /* Internet service class */
   rb_define_const(cDNSSDRecord, "IN", UINT2NUM(kDNSServiceClass_IN));
 
@@ -43,10 +161,8 @@ Init_DNSSD_Record(void) {
   /* IPv6 Address. */
   rb_define_const(cDNSSDRecord, "AAAA", UINT2NUM(kDNSServiceType_AAAA));
 
-#ifdef kDNSServiceType_APL
   /* Address Prefix List */
   rb_define_const(cDNSSDRecord, "APL", UINT2NUM(kDNSServiceType_APL));
-#endif
 
   /* AFS cell database. */
   rb_define_const(cDNSSDRecord, "AFSDB", UINT2NUM(kDNSServiceType_AFSDB));
@@ -63,23 +179,17 @@ Init_DNSSD_Record(void) {
   /* Canonical name. */
   rb_define_const(cDNSSDRecord, "CNAME", UINT2NUM(kDNSServiceType_CNAME));
 
-#ifdef kDNSServiceType_DHCID
   /* DHCID */
   rb_define_const(cDNSSDRecord, "DHCID", UINT2NUM(kDNSServiceType_DHCID));
-#endif
 
   /* Non-terminal DNAME (for IPv6) */
   rb_define_const(cDNSSDRecord, "DNAME", UINT2NUM(kDNSServiceType_DNAME));
 
-#ifdef kDNSServiceType_DNSKEY
   /* DNSKEY */
   rb_define_const(cDNSSDRecord, "DNSKEY", UINT2NUM(kDNSServiceType_DNSKEY));
-#endif
 
-#ifdef kDNSServiceType_DS
   /* Delegation Signer */
   rb_define_const(cDNSSDRecord, "DS", UINT2NUM(kDNSServiceType_DS));
-#endif
 
   /* Endpoint identifier. */
   rb_define_const(cDNSSDRecord, "EID", UINT2NUM(kDNSServiceType_EID));
@@ -90,10 +200,8 @@ Init_DNSSD_Record(void) {
   /* Host information. */
   rb_define_const(cDNSSDRecord, "HINFO", UINT2NUM(kDNSServiceType_HINFO));
 
-#ifdef kDNSServiceType_IPSECKEY
   /* IPSECKEY */
   rb_define_const(cDNSSDRecord, "IPSECKEY", UINT2NUM(kDNSServiceType_IPSECKEY));
-#endif
 
   /* ISDN calling address. */
   rb_define_const(cDNSSDRecord, "ISDN", UINT2NUM(kDNSServiceType_ISDN));
@@ -152,10 +260,8 @@ Init_DNSSD_Record(void) {
   /* Reverse NSAP lookup (deprecated). */
   rb_define_const(cDNSSDRecord, "NSAP_PTR", UINT2NUM(kDNSServiceType_NSAP_PTR));
 
-#ifdef kDNSServiceType_NSEC
   /* NSEC */
   rb_define_const(cDNSSDRecord, "NSEC", UINT2NUM(kDNSServiceType_NSEC));
-#endif
 
   /* Null resource record. */
   rb_define_const(cDNSSDRecord, "NULL", UINT2NUM(kDNSServiceType_NULL));
@@ -175,10 +281,8 @@ Init_DNSSD_Record(void) {
   /* Responsible person. */
   rb_define_const(cDNSSDRecord, "RP", UINT2NUM(kDNSServiceType_RP));
 
-#ifdef kDNSServiceType_RRSIG
   /* RRSIG */
   rb_define_const(cDNSSDRecord, "RRSIG", UINT2NUM(kDNSServiceType_RRSIG));
-#endif
 
   /* Router. */
   rb_define_const(cDNSSDRecord, "RT", UINT2NUM(kDNSServiceType_RT));
@@ -195,10 +299,8 @@ Init_DNSSD_Record(void) {
   /* Server Selection. */
   rb_define_const(cDNSSDRecord, "SRV", UINT2NUM(kDNSServiceType_SRV));
 
-#ifdef kDNSServiceType_SSHFP
   /* SSH Key Fingerprint */
   rb_define_const(cDNSSDRecord, "SSHFP", UINT2NUM(kDNSServiceType_SSHFP));
-#endif
 
   /* Transaction key */
   rb_define_const(cDNSSDRecord, "TKEY", UINT2NUM(kDNSServiceType_TKEY));
@@ -0,0 +1,447 @@
+#include "dnssd.h"
+
+static VALUE cDNSSDReply;
+
+static void
+dnssd_reply_mark(void *ptr) {
+  dnssd_reply_t *reply = (dnssd_reply_t *)ptr;
+
+  rb_gc_mark(reply->service);
+}
+
+static void
+dnssd_reply_free(void *ptr) {
+  dnssd_reply_t *reply = (dnssd_reply_t *)ptr;
+
+  xfree(reply->buffer);
+  xfree(reply);
+}
+
+static size_t
+dnssd_reply_memsize(const void *ptr) {
+  const dnssd_reply_t *reply = (const dnssd_reply_t *)ptr;
+  size_t size = sizeof(dnssd_reply_t);
+  int i;
+
+  for (i = 0; i < reply->nfields; i++)
+    size += reply->lengths[i] + 1;
+
+  return size;
+}
+
+static const rb_data_type_t dnssd_reply_type = {
+    "DNSSD/reply",
+    {dnssd_reply_mark, dnssd_reply_free, dnssd_reply_memsize,},
+    0, 0,
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+    RUBY_TYPED_FREE_IMMEDIATELY,
+#endif
+};
+
+dnssd_reply_t *
+dnssd_reply_get(VALUE self) {
+  dnssd_reply_t *reply;
+
+  TypedData_Get_Struct(self, dnssd_reply_t, &dnssd_reply_type, reply);
+
+  return reply;
+}
+
+static VALUE
+dnssd_reply_s_allocate(VALUE klass) {
+  dnssd_reply_t *reply;
+  VALUE self;
+
+  self = TypedData_Make_Struct(klass, dnssd_reply_t, &dnssd_reply_type,
+      reply);
+
+  reply->service = Qnil;
+
+  return self;
+}
+
+/* Creates a reply of +klass+ straight from a DNS-SD callback without running
+ * its initialize method.  The Ruby objects for its readers are built from the
+ * raw data the first time they are needed. */
+
+VALUE
+dnssd_reply_new(VALUE klass, VALUE service, DNSServiceFlags flags,
+    uint32_t interface, dnssd_reply_t **reply) {
+  VALUE self = dnssd_reply_s_allocate(klass);
+
+  *reply = dnssd_reply_get(self);
+
+  (*reply)->raw           = 1;
+  (*reply)->service       = service;
+  (*reply)->flags         = flags;
+  (*reply)->interface     = interface;
+  (*reply)->has_interface = 1;
+
+  gettimeofday(&(*reply)->created, NULL);
+
+  return self;
+}
+
+/* Copies +count+ byte strings into a single buffer owned by +reply+.  Each
+ * copy is NUL terminated so names can be used as C strings. */
+
+void
+dnssd_reply_set_fields(dnssd_reply_t *reply, int count, const char **fields,
+    const long *lengths) {
+  long size = 0;
+  char *buffer;
+  int i;
+
+  for (i = 0; i < count; i++)
+    size += lengths[i] + 1;
+
+  buffer = reply->buffer = ALLOC_N(char, size);
+
+  for (i = 0; i < count; i++) {
+    memcpy(buffer, fields[i], lengths[i]);
+    buffer[lengths[i]] = '\0';
+
+    reply->fields[i]  = buffer;
+    reply->lengths[i] = lengths[i];
+
+    buffer += lengths[i] + 1;
+  }
+
+  reply->nfields = count;
+}
+
+/* Copies the raw reply data for #dup and #clone */
+
+static VALUE
+dnssd_reply_init_copy(VALUE self, VALUE other) {
+  dnssd_reply_t *reply, *source;
+  const char *fields[DNSSD_REPLY_FIELDS];
+
+  if (self == other)
+    return self;
+
+  rb_call_super(1, &other);
+
+  reply  = dnssd_reply_get(self);
+  source = dnssd_reply_get(other);
+
+  xfree(reply->buffer);
+  *reply = *source;
+  reply->buffer = NULL;
+
+  if (source->nfields) {
+    memcpy(fields, source->fields, sizeof(fields));
+    dnssd_reply_set_fields(reply, source->nfields, fields, source->lengths);
+  }
+
+  return self;
+}
+
+/* call-seq:
+ *   reply._flags
+ *
+ * The raw flags from the daemon, nil for a reply created in ruby
+ */
+
+static VALUE
+dnssd_reply_flags(VALUE self) {
+  dnssd_reply_t *reply = dnssd_reply_get(self);
+
+  if (!reply->raw)
+    return Qnil;
+
+  return ULONG2NUM(reply->flags);
+}
+
+/* call-seq:
+ *   reply._interface
+ *
+ * The raw interface index from the daemon, nil for a reply created in ruby or
+ * one the daemon gives no interface for
+ */
+
+static VALUE
+dnssd_reply_interface(VALUE self) {
+  dnssd_reply_t *reply = dnssd_reply_get(self);
+
+  if (!reply->raw || !reply->has_interface)
+    return Qnil;
+
+  return ULONG2NUM(reply->interface);
+}
+
+/* call-seq:
+ *   reply._service
+ *
+ * The service that received this reply
+ */
+
+static VALUE
+dnssd_reply_service(VALUE self) {
+  return dnssd_reply_get(self)->service;
+}
+
+/* call-seq:
+ *   reply._field(index)
+ *
+ * Returns a new UTF-8 String holding raw field +index+, or nil if there is no
+ * such field
+ */
+
+static VALUE
+dnssd_reply_field(VALUE self, VALUE _index) {
+  dnssd_reply_t *reply = dnssd_reply_get(self);
+  int index = NUM2INT(_index);
+  VALUE field;
+
+  if (index < 0 || index >= reply->nfields)
+    return Qnil;
+
+  field = rb_str_new(reply->fields[index], reply->lengths[index]);
+  rb_enc_associate(field, rb_utf8_encoding());
+
+  return field;
+}
+
+/* call-seq:
+ *   reply._number(index)
+ *
+ * Returns raw number +index+ (a port, TTL, record type or record class), or
+ * nil for a reply created in ruby
+ */
+
+static VALUE
+dnssd_reply_number(VALUE self, VALUE _index) {
+  dnssd_reply_t *reply = dnssd_reply_get(self);
+  int index = NUM2INT(_index);
+
+  if (!reply->raw || index < 0 || index >= DNSSD_REPLY_NUMBERS)
+    return Qnil;
+
+  return ULONG2NUM(reply->numbers[index]);
+}
+
+/* call-seq:
+ *   reply._created
+ *
+ * The Time the reply was received, nil for a reply created in ruby
+ */
+
+static VALUE
+dnssd_reply_created(VALUE self) {
+  dnssd_reply_t *reply = dnssd_reply_get(self);
+
+  if (!reply->raw)
+    return Qnil;
+
+  return rb_time_new(reply->created.tv_sec, reply->created.tv_usec);
+}
+
+/* Looks up +key+ in the TXT record held in raw field +index+ of +self+ */
+
+static int
+dnssd_reply_txt_find(VALUE self, VALUE _index, VALUE key, const char **value,
+    long *value_length) {
+  dnssd_reply_t *reply = dnssd_reply_get(self);
+  int index = NUM2INT(_index);
+
+  StringValue(key);
+
+  if (index < 0 || index >= reply->nfields)
+    return DNSSD_TXT_MISSING;
+
+  return dnssd_text_record_find(reply->fields[index], reply->lengths[index],
+      RSTRING_PTR(key), RSTRING_LEN(key), value, value_length);
+}
+
+/* call-seq:
+ *   reply._txt_value(index, key)
+ *
+ * The value of +key+ in the TXT record in raw field +index+, nil if the key
+ * is missing or has no value
+ */
+
+static VALUE
+dnssd_reply_txt_value(VALUE self, VALUE index, VALUE key) {
+  const char *value;
+  long value_length;
+
+  if (dnssd_reply_txt_find(self, index, key, &value, &value_length) !=
+      DNSSD_TXT_VALUE)
+    return Qnil;
+
+  return rb_str_new(value, value_length);
+}
+
+/* call-seq:
+ *   reply._txt_key?(index, key)
+ *
+ * True if the TXT record in raw field +index+ has an entry for +key+
+ */
+
+static VALUE
+dnssd_reply_txt_key_p(VALUE self, VALUE index, VALUE key) {
+  const char *value;
+  long value_length;
+
+  return dnssd_reply_txt_find(self, index, key, &value, &value_length) ==
+    DNSSD_TXT_MISSING ? Qfalse : Qtrue;
+}
+
+/* Appends +length+ bytes of label +label+ to +string+, escaping "." and "\"
+ * so the label survives being split again */
+
+static void
+dnssd_reply_cat_label(VALUE string, const char *label, long length) {
+  const char *end = label + length, *start = label;
+
+  for (; label < end; label++) {
+    if (*label != '.' && *label != '\\')
+      continue;
+
+    rb_str_cat(string, start, label - start);
+    rb_str_cat(string, "\\", 1);
+    start = label;
+  }
+
+  rb_str_cat(string, start, end - start);
+}
+
+/* call-seq:
+ *   reply._split_fullname(fullname) # => [name, type, domain]
+ *
+ * Splits the DNS-SD +fullname+ into its unescaped service name, its two label
+ * service type and its domain in a single pass.  \DDD escapes become the byte
+ * DDD and any other escaped character stands for itself.  Dots and
+ * backslashes in domain labels stay escaped.
+ */
+
+static VALUE
+dnssd_reply_split_fullname(VALUE self, VALUE fullname) {
+  const char *data, *end;
+  char *buffer;
+  long *labels, nlabels = 0, length = 0, start = 0, i;
+  VALUE tmp_buffer, tmp_labels, name = Qnil, type, domain;
+  rb_encoding *utf8 = rb_utf8_encoding();
+
+  StringValue(fullname);
+
+  data = RSTRING_PTR(fullname);
+  end  = data + RSTRING_LEN(fullname);
+
+  /* unescaped label bytes, and the start and length of each label */
+  buffer = ALLOCV_N(char, tmp_buffer, RSTRING_LEN(fullname) + 1);
+  labels = ALLOCV_N(long, tmp_labels, RSTRING_LEN(fullname) + 2);
+
+  for (; data <= end; data++) {
+    if (data == end || *data == '.') {
+      if (length > start) {
+        labels[nlabels++] = start;
+        labels[nlabels++] = length - start;
+      }
+
+      start = length;
+      continue;
+    }
+
+    if (*data != '\\') {
+      buffer[length++] = *data;
+      continue;
+    }
+
+    if (++data == end)
+      break;
+
+    if (ISDIGIT(*data)) {
+      int digits = 0, byte = 0;
+
+      for (; data < end && digits < 3 && ISDIGIT(*data); data++, digits++)
+        byte = byte * 10 + (*data - '0');
+
+      if (byte > 255)
+        rb_raise(rb_eArgError, "invalid escape \\%d in %+"PRIsVALUE, byte,
+            fullname);
+
+      buffer[length++] = (char)byte;
+      data--;
+    } else {
+      buffer[length++] = *data;
+    }
+  }
+
+  /* a trailing lone backslash ends the last label */
+  if (length > start) {
+    labels[nlabels++] = start;
+    labels[nlabels++] = length - start;
+  }
+
+  nlabels /= 2;
+
+  if (nlabels > 0)
+    name = rb_enc_str_new(buffer + labels[0], labels[1], utf8);
+
+  type = rb_enc_str_new(NULL, 0, utf8);
+
+  for (i = 1; i < nlabels && i < 3; i++) {
+    if (i > 1)
+      rb_str_cat(type, ".", 1);
+
+    rb_str_cat(type, buffer + labels[i * 2], labels[i * 2 + 1]);
+  }
+
+  domain = rb_enc_str_new(NULL, 0, utf8);
+
+  for (i = 3; i < nlabels; i++) {
+    dnssd_reply_cat_label(domain, buffer + labels[i * 2], labels[i * 2 + 1]);
+    rb_str_cat(domain, ".", 1);
+  }
+
+  if (nlabels < 4)
+    rb_str_cat(domain, ".", 1);
+
+  ALLOCV_END(tmp_buffer);
+  ALLOCV_END(tmp_labels);
+
+  return rb_ary_new_from_args(3, name, type, domain);
+}
+
+/* Document-class: DNSSD::Reply
+ *
+ * Replies created by the daemon hold its raw data in C until a reader needs
+ * it.  See lib/dnssd/reply.rb
+ */
+
+void
+Init_DNSSD_Reply(void) {
+  static const char *subclasses[] = {
+    "DNSSD::Reply::AddrInfo",
+    "DNSSD::Reply::Browse",
+    "DNSSD::Reply::Domain",
+    "DNSSD::Reply::QueryRecord",
+    "DNSSD::Reply::Register",
+    "DNSSD::Reply::Resolve",
+  };
+  size_t i;
+
+  cDNSSDReply = rb_path2class("DNSSD::Reply");
+
+  rb_define_alloc_func(cDNSSDReply, dnssd_reply_s_allocate);
+
+  /* the subclasses were defined in ruby before this allocator existed, and
+   * newer rubies copy the allocator when a class is created */
+  for (i = 0; i < sizeof(subclasses) / sizeof(subclasses[0]); i++)
+    rb_define_alloc_func(rb_path2class(subclasses[i]),
+        dnssd_reply_s_allocate);
+
+  rb_define_private_method(cDNSSDReply, "initialize_copy", dnssd_reply_init_copy, 1);
+
+  rb_define_private_method(cDNSSDReply, "_created", dnssd_reply_created, 0);
+  rb_define_private_method(cDNSSDReply, "_field", dnssd_reply_field, 1);
+  rb_define_private_method(cDNSSDReply, "_flags", dnssd_reply_flags, 0);
+  rb_define_private_method(cDNSSDReply, "_interface", dnssd_reply_interface, 0);
+  rb_define_private_method(cDNSSDReply, "_number", dnssd_reply_number, 1);
+  rb_define_private_method(cDNSSDReply, "_service", dnssd_reply_service, 0);
+  rb_define_private_method(cDNSSDReply, "_split_fullname", dnssd_reply_split_fullname, 1);
+  rb_define_private_method(cDNSSDReply, "_txt_key?", dnssd_reply_txt_key_p, 2);
+  rb_define_private_method(cDNSSDReply, "_txt_value", dnssd_reply_txt_value, 2);
+}
@@ -16,51 +16,141 @@ static VALUE cDNSSDTextRecord;
 static VALUE rb_cSocket;
 
 static ID dnssd_id_join;
-static ID dnssd_id_push;
+static ID dnssd_id_read_ahead;
+static ID dnssd_id_ready;
 
+static ID dnssd_iv_connection;
 static ID dnssd_iv_continue;
 static ID dnssd_iv_records;
-static ID dnssd_iv_replies;
 static ID dnssd_iv_service;
 static ID dnssd_iv_thread;
 static ID dnssd_iv_type;
 
+/* A service's DNSServiceRef.  When +connection+ is set the ref is a
+ * subordinate of that shared daemon connection and becomes invalid once the
+ * connection is closed.
+ *
+ * +replies+ is a ring buffer of +capa+ replies the callbacks have queued but
+ * nobody has taken yet, starting at +head+.  With a +limit+ it is allocated
+ * once with room for exactly +limit+ replies and never grows.  Without one it
+ * grows when a burst doesn't fit, since one DNSServiceProcessResult call may
+ * make any number of callbacks and a fixed size would lose replies nobody
+ * asked to drop.  +more_coming+ is set when the last queued reply had
+ * kDNSServiceFlagsMoreComing.
+ *
+ * +trace_id+ identifies the service in a trace, it is 0 until a reply for the
+ * service is recorded.
+ *
+ * +live+ is set while the service counts towards DNSSD.stats
+ * services_live.  The rest are counters for #stats.
+ *
+ * +wakeup+ interrupts a thread or fiber waiting in process_result when the
+ * service is stopped.
+ *
+ * +limit+ caps +count+ (0 for no limit) and +overflow+ says what happens to a
+ * reply that arrives when the queue is full, see #limit_replies. */
+typedef struct dnssd_service {
+  DNSServiceRef ref;
+  dnssd_connection_t *connection;
+  VALUE *replies;
+  long capa;
+  long head;
+  long count;
+  int more_coming;
+  uint32_t trace_id;
+  int live;
+  unsigned long long replies_total;
+  long queue_max;
+  dnssd_process_stats_t process;
+  dnssd_wakeup_t wakeup;
+  long limit;
+  int overflow;
+  unsigned long long dropped;
+  unsigned long long coalesced;
+  unsigned long long blocked;
+} dnssd_service_t;
+
+#define DNSSD_SERVICE_REPLIES_INITIAL 8
+
+#define DNSSD_OVERFLOW_BLOCK       0
+#define DNSSD_OVERFLOW_DROP_OLDEST 1
+#define DNSSD_OVERFLOW_COALESCE    2
+
 static void
-dnssd_service_free_client(DNSServiceRef *client) {
-  if (*client) {
-    DNSServiceRefDeallocate(*client);
-    *client = NULL;
+dnssd_service_free_client(dnssd_service_t *client) {
+  if (client->live) {
+    dnssd_stats.services_live--;
+    client->live = 0;
+  }
+
+  if (client->ref) {
+    if (!client->connection || client->connection->ref)
+      DNSServiceRefDeallocate(client->ref);
+
+    client->ref = NULL;
+  }
+
+  if (client->connection) {
+    dnssd_connection_release(client->connection);
+    client->connection = NULL;
   }
 }
 
+static void
+dnssd_service_mark(void *ptr) {
+  dnssd_service_t *client = (dnssd_service_t*)ptr;
+  long i;
+
+  for (i = 0; i < client->count; i++)
+    rb_gc_mark(client->replies[(client->head + i) % client->capa]);
+
+  dnssd_wakeup_mark(&client->wakeup);
+}
+
 static void
 dnssd_service_free(void *ptr) {
-  DNSServiceRef *client = (DNSServiceRef*)ptr;
+  dnssd_service_t *client = (dnssd_service_t*)ptr;
 
-  if (client)
+  if (client) {
     dnssd_service_free_client(client);
+    dnssd_wakeup_close(&client->wakeup);
+    xfree(client->replies);
+  }
 
-  free(client);
+  xfree(client);
+}
+
+static size_t
+dnssd_service_memsize(const void *ptr) {
+  const dnssd_service_t *client = (const dnssd_service_t*)ptr;
+
+  return sizeof(dnssd_service_t) + client->capa * sizeof(VALUE);
 }
 
 static const rb_data_type_t dnssd_service_type = {
     "DNSSD/service",
-    {0, dnssd_service_free, 0,},
+    {dnssd_service_mark, dnssd_service_free, dnssd_service_memsize,},
     0, 0,
 #ifdef RUBY_TYPED_FREE_IMMEDIATELY
     RUBY_TYPED_FREE_IMMEDIATELY,
 #endif
 };
 
-#define get(klass, obj, type, var) \
-  do {\
-    Check_Type(obj, T_DATA);\
-    if (rb_obj_is_kind_of(obj, klass) != Qtrue)\
-    rb_raise(rb_eTypeError,\
-        "wrong argument type %s",\
-        rb_class2name(CLASS_OF(obj)));\
-    Data_Get_Struct(obj, type, var);\
-  } while (0)
+/* Returns the DNSServiceRef of +service+, raising DNSSD::Error if it has been
+ * stopped or its connection has been closed.  Records added to the service
+ * are only valid while this succeeds. */
+
+DNSServiceRef
+dnssd_service_ref(VALUE service) {
+  dnssd_service_t *client;
+
+  TypedData_Get_Struct(service, dnssd_service_t, &dnssd_service_type, client);
+
+  if (!client->ref || (client->connection && !client->connection->ref))
+    rb_raise(eDNSSDError, "service is stopped");
+
+  return client->ref;
+}
 
 static VALUE
 create_fullname(const char *name, const char *regtype,
@@ -142,11 +232,64 @@ dnssd_service_s_get_property(VALUE klass, VALUE _property) {
 
 static VALUE
 dnssd_service_s_allocate(VALUE klass) {
-  DNSServiceRef *client = ALLOC(DNSServiceRef);
+  dnssd_service_t *client;
+  VALUE self;
 
-  *client = NULL;
+  self = TypedData_Make_Struct(klass, dnssd_service_t, &dnssd_service_type,
+      client);
+  dnssd_wakeup_init(&client->wakeup);
 
-  return Data_Wrap_Struct(klass, 0, dnssd_service_free, client);
+  return self;
+}
+
+/* Creates a new, unstarted service of +klass+.  When +_connection+ is a
+ * DNSSD::Connection the service will be started as a subordinate of its
+ * daemon socket, so kDNSServiceFlagsShareConnection is added to +flags+. */
+
+static VALUE
+dnssd_service_new(VALUE klass, VALUE _connection, DNSServiceFlags *flags,
+    dnssd_service_t **client) {
+  dnssd_connection_t *connection = NULL;
+  VALUE self;
+
+  if (!NIL_P(_connection)) {
+#ifdef HAVE_KDNSSERVICEFLAGSSHARECONNECTION
+    connection = dnssd_connection_get(_connection);
+    *flags |= kDNSServiceFlagsShareConnection;
+#else
+    dnssd_check_error_code(kDNSServiceErr_Unsupported);
+#endif
+  }
+
+  self = TypedData_Make_Struct(klass, dnssd_service_t, &dnssd_service_type,
+      *client);
+  dnssd_wakeup_init(&(*client)->wakeup);
+  rb_obj_call_init(self, 0, 0);
+
+  if (connection) {
+    (*client)->ref = connection->ref;
+    (*client)->connection = connection;
+    connection->refs++;
+
+    rb_ivar_set(self, dnssd_iv_connection, _connection);
+  }
+
+  return self;
+}
+
+/* Checks the result of starting +client+.  A subordinate that failed to start
+ * must not deallocate the connection's ref it was seeded with. */
+
+static void
+dnssd_service_check_start(dnssd_service_t *client, DNSServiceErrorType e) {
+  if (e && client->connection)
+    client->ref = NULL;
+
+  dnssd_check_error_code(e);
+
+  client->live = 1;
+  dnssd_stats.services_started++;
+  dnssd_stats.services_live++;
 }
 
 /* Stops the service, closing the underlying socket and killing the underlying
@@ -163,10 +306,13 @@ dnssd_service_s_allocate(VALUE klass) {
 
 static VALUE
 dnssd_service_stop(VALUE self) {
-  DNSServiceRef *client;
+  dnssd_service_t *client;
 
-  TypedData_Get_Struct(self, DNSServiceRef, &dnssd_service_type, client);
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
 
+  DNSSD_PROBE2(service_stop, self, client->replies_total);
+
+  dnssd_wakeup_signal(&client->wakeup);
   dnssd_service_free_client(client);
 
   return self;
@@ -174,24 +320,430 @@ dnssd_service_stop(VALUE self) {
 
 static VALUE
 dnssd_ref_sock_fd(VALUE self) {
-  DNSServiceRef *client;
-  TypedData_Get_Struct(self, DNSServiceRef, &dnssd_service_type, client);
+  dnssd_service_t *client;
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
 
-  return INT2NUM(DNSServiceRefSockFD(*client));
+  return INT2NUM(DNSServiceRefSockFD(client->ref));
 }
 
+/* call-seq:
+ *   service.process_result(timeout)
+ *
+ * Waits up to +timeout+ seconds (forever if +nil+) for a reply without holding
+ * the GVL, then calls DNSServiceProcessResult.  Returns false if no reply
+ * arrived before the timeout or the wait was interrupted, and at once without
+ * reading if the reply queue is full under the :block policy.
+ */
+
 static VALUE
-dnssd_process_result(VALUE self) {
-  DNSServiceRef *client;
+dnssd_process_result(VALUE self, VALUE timeout) {
+  dnssd_service_t *client;
   DNSServiceErrorType e;
-  TypedData_Get_Struct(self, DNSServiceRef, &dnssd_service_type, client);
+  uint64_t started;
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  if (!client->ref)
+    rb_raise(eDNSSDError, "service is stopped");
 
-  e = DNSServiceProcessResult(*client);
+  /* leave replies in the socket until the queue has room */
+  if (client->limit && client->overflow == DNSSD_OVERFLOW_BLOCK &&
+      client->count >= client->limit) {
+    client->blocked++;
+    return Qfalse;
+  }
+
+  if (!dnssd_wait_readable(self, DNSServiceRefSockFD(client->ref),
+        &client->wakeup, timeout))
+    return Qfalse;
+
+  /* stopped by another thread while waiting */
+  if (!client->ref)
+    return Qfalse;
+
+  DNSSD_PROBE1(process_entry, self);
+  started = dnssd_clock_ns();
+  e = DNSServiceProcessResult(client->ref);
+  dnssd_stats_process(&client->process, started, e);
+  DNSSD_PROBE2(process_return, self, e);
   dnssd_check_error_code(e);
 
   return Qtrue;
 }
 
+static VALUE dnssd_service_dequeue(dnssd_service_t *client);
+
+/* The number of leading fields and numbers of a reply of +klass+ that say
+ * what it is about, as opposed to its state.  0 if replies of +klass+ can't be
+ * coalesced. */
+
+static int
+dnssd_service_reply_key(VALUE klass, int *nnumbers) {
+  *nnumbers = 0;
+
+  if (klass == cDNSSDReplyBrowse || klass == cDNSSDReplyRegister)
+    return 3; /* name, type, domain */
+
+  if (klass == cDNSSDReplyDomain || klass == cDNSSDReplyResolve)
+    return 1; /* domain or fullname */
+
+  if (klass == cDNSSDReplyAddrInfo)
+    return 2; /* hostname and address */
+
+  if (klass == cDNSSDReplyQueryRecord) {
+    *nnumbers = 2; /* record type and class */
+    return 2;      /* fullname and record data */
+  }
+
+  return 0;
+}
+
+/* Replaces the queued reply with the same key as +reply+, see
+ * dnssd_service_reply_key.  Returns 1 if one was replaced. */
+
+static int
+dnssd_service_coalesce(dnssd_service_t *client, VALUE reply) {
+  VALUE klass = rb_obj_class(reply);
+  dnssd_reply_t *raw, *other;
+  int nfields, nnumbers, i;
+  long n;
+
+  nfields = dnssd_service_reply_key(klass, &nnumbers);
+
+  if (!nfields)
+    return 0;
+
+  raw = dnssd_reply_get(reply);
+
+  if (!raw->raw || raw->nfields < nfields)
+    return 0;
+
+  for (n = 0; n < client->count; n++) {
+    long index = (client->head + n) % client->capa;
+    VALUE queued = client->replies[index];
+
+    if (rb_obj_class(queued) != klass)
+      continue;
+
+    other = dnssd_reply_get(queued);
+
+    if (!other->raw || other->nfields < nfields ||
+        other->interface != raw->interface)
+      continue;
+
+    for (i = 0; i < nfields; i++)
+      if (other->lengths[i] != raw->lengths[i] ||
+          memcmp(other->fields[i], raw->fields[i], raw->lengths[i]))
+        break;
+
+    if (i < nfields)
+      continue;
+
+    for (i = 0; i < nnumbers; i++)
+      if (other->numbers[i] != raw->numbers[i])
+        break;
+
+    if (i < nnumbers)
+      continue;
+
+    client->replies[index] = reply;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Makes room for one more reply in the full queue of +client+ as its
+ * overflow policy says.  Returns 1 if +reply+ was coalesced into a queued
+ * reply and must not be added.
+ *
+ * The :block policy never discards a reply.  process_result stops reading
+ * once the queue is full, but one DNSServiceProcessResult call may make
+ * several callbacks, so the queue grows past the limit for those. */
+
+static int
+dnssd_service_overflow(dnssd_service_t *client, VALUE reply) {
+  switch (client->overflow) {
+    case DNSSD_OVERFLOW_BLOCK:
+      break;
+    case DNSSD_OVERFLOW_COALESCE:
+      if (dnssd_service_coalesce(client, reply)) {
+        client->coalesced++;
+        dnssd_stats.replies_coalesced++;
+        return 1;
+      }
+
+      /* nothing to coalesce with, fall back to dropping */
+    case DNSSD_OVERFLOW_DROP_OLDEST:
+      while (client->count >= client->limit) {
+        dnssd_service_dequeue(client);
+        client->dropped++;
+        dnssd_stats.replies_dropped++;
+      }
+      break;
+  }
+
+  return 0;
+}
+
+/* Replaces the reply ring of +client+ with one of exactly +capa+ replies.
+ * The oldest replies that don't fit are dropped. */
+
+static void
+dnssd_service_resize(dnssd_service_t *client, long capa) {
+  VALUE *replies = ALLOC_N(VALUE, capa);
+  long i;
+
+  while (client->count > capa) {
+    dnssd_service_dequeue(client);
+    client->dropped++;
+    dnssd_stats.replies_dropped++;
+  }
+
+  for (i = 0; i < client->count; i++)
+    replies[i] = client->replies[(client->head + i) % client->capa];
+
+  xfree(client->replies);
+
+  client->replies = replies;
+  client->capa    = capa;
+  client->head    = 0;
+}
+
+/* Adds +reply+ to the end of the reply queue of +self+.  A service on a
+ * DNSSD::Connection tells the connection when its queue stops being empty so
+ * the connection knows whose replies to deliver. */
+
+static void
+dnssd_service_enqueue(VALUE self, VALUE reply, DNSServiceFlags flags) {
+  dnssd_service_t *client;
+  int was_empty;
+
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  /* a connection already knows about a service whose queue was not empty,
+   * even if the overflow policy empties it */
+  was_empty = client->count == 0;
+
+  if (client->limit && client->count >= client->limit &&
+      dnssd_service_overflow(client, reply)) {
+    client->more_coming = (flags & kDNSServiceFlagsMoreComing) != 0;
+    client->replies_total++;
+    dnssd_stats.replies++;
+    return;
+  }
+
+  /* a limited queue was made room in above, only an unlimited one or a
+   * :block one overrun by a single read grows.  The latter goes back to its
+   * fixed size once it has drained below the limit. */
+  if (client->count == client->capa)
+    dnssd_service_resize(client, client->capa ?
+        client->capa * 2 : DNSSD_SERVICE_REPLIES_INITIAL);
+  else if (client->limit && client->capa > client->limit &&
+      client->count < client->limit)
+    dnssd_service_resize(client, client->limit);
+
+  client->replies[(client->head + client->count) % client->capa] = reply;
+  client->count++;
+  client->more_coming = (flags & kDNSServiceFlagsMoreComing) != 0;
+
+  client->replies_total++;
+  dnssd_stats.replies++;
+
+  if (client->count > client->queue_max) {
+    client->queue_max = client->count;
+
+    if (client->count > dnssd_stats.queue_max)
+      dnssd_stats.queue_max = client->count;
+  }
+
+  if (client->connection && was_empty)
+    rb_funcall(rb_ivar_get(self, dnssd_iv_connection), dnssd_id_ready, 1,
+        self);
+}
+
+static VALUE
+dnssd_service_dequeue(dnssd_service_t *client) {
+  VALUE reply = client->replies[client->head];
+
+  client->replies[client->head] = Qnil;
+  client->head = (client->head + 1) % client->capa;
+  client->count--;
+
+  return reply;
+}
+
+/* call-seq:
+ *   service.push(reply)
+ *
+ * Adds +reply+ to the replies waiting to be yielded by #each
+ */
+
+static VALUE
+dnssd_service_push(VALUE self, VALUE reply) {
+  dnssd_service_enqueue(self, reply, 0);
+
+  return self;
+}
+
+/* call-seq:
+ *   service.drain_replies { |reply| ... }
+ *
+ * Removes each waiting reply and yields it.  Replies are discarded if no
+ * block is given.  A reply is removed before it is yielded, so breaking out of
+ * the block leaves the rest waiting.
+ *
+ * When the queue is limited the replies the daemon sent while the block ran
+ * are read after each one, see #limit_replies.  Those are left waiting for
+ * the next drain, only the replies waiting when the drain started are
+ * yielded, so a daemon that keeps sending can't keep the caller from
+ * checking its deadline.  Use #replies_waiting? to find out if any are left.
+ */
+
+static VALUE
+dnssd_service_drain_replies(VALUE self) {
+  dnssd_service_t *client;
+  int yield = rb_block_given_p();
+  long n;
+
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  n = client->count;
+
+  while (n-- > 0 && client->count) {
+    VALUE reply = dnssd_service_dequeue(client);
+
+    if (!yield)
+      continue;
+
+    rb_yield(reply);
+
+    /* the block may have stopped the service or closed its connection */
+    if (client->limit && client->ref &&
+        (!client->connection || client->connection->ref))
+      rb_funcall(self, dnssd_id_read_ahead, 1, LONG2NUM(client->limit));
+  }
+
+  return self;
+}
+
+/* call-seq:
+ *   service.shift_replies # => [reply, ...]
+ *
+ * Removes and returns every waiting reply
+ */
+
+static VALUE
+dnssd_service_shift_replies(VALUE self) {
+  dnssd_service_t *client;
+  VALUE replies;
+
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  replies = rb_ary_new2(client->count);
+
+  while (client->count)
+    rb_ary_push(replies, dnssd_service_dequeue(client));
+
+  return replies;
+}
+
+/* call-seq:
+ *   service._limit_replies(limit, overflow)
+ *
+ * Caps the reply queue at +limit+ replies, 0 for no cap.  +overflow+ is
+ * :block, :drop_oldest or :coalesce, see #limit_replies.  The queue is
+ * reallocated to hold exactly +limit+ replies, dropping the oldest waiting
+ * replies that don't fit unless +overflow+ is :block.
+ */
+
+static VALUE
+dnssd_service_limit_replies(VALUE self, VALUE _limit, VALUE _overflow) {
+  dnssd_service_t *client;
+  long limit = NUM2LONG(_limit);
+  ID overflow;
+
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  if (limit < 0)
+    rb_raise(rb_eArgError, "reply limit must not be negative");
+
+  Check_Type(_overflow, T_SYMBOL);
+  overflow = SYM2ID(_overflow);
+
+  if (overflow == rb_intern("block")) {
+    if (client->connection)
+      rb_raise(rb_eArgError,
+          "a service on a DNSSD::Connection can't block the shared socket");
+
+    client->overflow = DNSSD_OVERFLOW_BLOCK;
+  } else if (overflow == rb_intern("drop_oldest")) {
+    client->overflow = DNSSD_OVERFLOW_DROP_OLDEST;
+  } else if (overflow == rb_intern("coalesce")) {
+    client->overflow = DNSSD_OVERFLOW_COALESCE;
+  } else {
+    rb_raise(rb_eArgError, "unknown overflow policy %"PRIsVALUE, _overflow);
+  }
+
+  client->limit = limit;
+
+  /* :block never drops a reply, a queue already over the new limit shrinks
+   * once it has drained */
+  if (limit && limit != client->capa &&
+      !(client->overflow == DNSSD_OVERFLOW_BLOCK && client->count > limit))
+    dnssd_service_resize(client, limit);
+
+  return self;
+}
+
+/* call-seq:
+ *   service.reply_queue_full?
+ *
+ * True if the reply queue is at its limit and new replies are left in the
+ * socket until it drains
+ */
+
+static VALUE
+dnssd_service_reply_queue_full_p(VALUE self) {
+  dnssd_service_t *client;
+
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  return client->limit && client->overflow == DNSSD_OVERFLOW_BLOCK &&
+    client->count >= client->limit ? Qtrue : Qfalse;
+}
+
+/* call-seq:
+ *   service.replies_waiting?
+ *
+ * True if replies are waiting to be yielded
+ */
+
+static VALUE
+dnssd_service_replies_waiting_p(VALUE self) {
+  dnssd_service_t *client;
+
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  return client->count ? Qtrue : Qfalse;
+}
+
+/* call-seq:
+ *   service.more_coming?
+ *
+ * True if the daemon set kDNSServiceFlagsMoreComing on the last reply, so
+ * another reply of the same burst is already on its way
+ */
+
+static VALUE
+dnssd_service_more_coming_p(VALUE self) {
+  dnssd_service_t *client;
+
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  return client->more_coming ? Qtrue : Qfalse;
+}
+
 /* call-seq:
  *   service._add_record(flags, type, data, ttl)
  *
@@ -202,7 +754,7 @@ static VALUE
 dnssd_service_add_record(VALUE self, VALUE _flags, VALUE _rrtype, VALUE _rdata,
     VALUE _ttl) {
   VALUE _record = Qnil;
-  DNSServiceRef *client;
+  DNSServiceRef ref;
   DNSRecordRef *record;
   DNSServiceFlags flags;
   DNSServiceErrorType e;
@@ -218,13 +770,13 @@ dnssd_service_add_record(VALUE self, VALUE _flags, VALUE _rrtype, VALUE _rdata,
   rdata = (void *)StringValuePtr(_rdata);
   ttl = (uint32_t)NUM2ULONG(_ttl);
 
-  TypedData_Get_Struct(self, DNSServiceRef, &dnssd_service_type, client);
+  ref = dnssd_service_ref(self);
 
   _record = rb_class_new_instance(0, NULL, cDNSSDRecord);
 
-  get(cDNSSDRecord, _record, DNSRecordRef, record);
+  record = dnssd_record_get(_record);
 
-  e = DNSServiceAddRecord(*client, record, flags, rrtype, rdlen, rdata, ttl);
+  e = DNSServiceAddRecord(ref, record, flags, rrtype, rdlen, rdata, ttl);
 
   dnssd_check_error_code(e);
 
@@ -234,47 +786,96 @@ dnssd_service_add_record(VALUE self, VALUE _flags, VALUE _rrtype, VALUE _rdata,
   return _record;
 }
 
+/* call-seq:
+ *   service._update_text_record(data, ttl)
+ *
+ * Binding to DNSServiceUpdateRecord for the service's primary TXT record
+ */
+
+static VALUE
+dnssd_service_update_text_record(VALUE self, VALUE _rdata, VALUE _ttl) {
+  DNSServiceRef ref = dnssd_service_ref(self);
+  DNSServiceErrorType e;
+
+  StringValue(_rdata);
+
+  if (RSTRING_LEN(_rdata) > UINT16_MAX)
+    rb_raise(rb_eArgError, "TXT record too long (%ld bytes)",
+        RSTRING_LEN(_rdata));
+
+  e = DNSServiceUpdateRecord(ref, NULL, 0, (uint16_t)RSTRING_LEN(_rdata),
+      RSTRING_PTR(_rdata), (uint32_t)NUM2ULONG(_ttl));
+
+  dnssd_check_error_code(e);
+
+  return self;
+}
+
+/* Records a callback for +service+ in the trace, if one is being recorded */
+
+static void
+dnssd_service_trace(VALUE service, int kind, DNSServiceFlags flags,
+    uint32_t interface, int nfields, const char **fields, const long *lengths,
+    int nnumbers, const uint32_t *numbers) {
+  dnssd_service_t *client;
+
+  if (!dnssd_trace_recording())
+    return;
+
+  TypedData_Get_Struct(service, dnssd_service_t, &dnssd_service_type, client);
+
+  if (!client->trace_id)
+    client->trace_id = dnssd_trace_next_id();
+
+  dnssd_trace_write(client->trace_id, kind, flags, interface, nfields, fields,
+      lengths, nnumbers, numbers);
+}
+
 static void DNSSD_API
 dnssd_service_browse_reply(DNSServiceRef client, DNSServiceFlags flags,
     uint32_t interface, DNSServiceErrorType e, const char *name,
     const char *type, const char *domain, void *context) {
-  VALUE service, reply, argv[6];
+  VALUE service, reply;
+  dnssd_reply_t *raw;
+  const char *fields[3];
+  long lengths[3];
 
   dnssd_check_error_code(e);
 
   service = (VALUE)context;
 
-  argv[0] = service;
-  argv[1] = ULONG2NUM(flags);
-  argv[2] = ULONG2NUM(interface);
-  argv[3] = rb_str_new2(name);
-  rb_enc_associate(argv[3], rb_utf8_encoding());
-  argv[4] = rb_str_new2(type);
-  rb_enc_associate(argv[4], rb_utf8_encoding());
-  argv[5] = rb_str_new2(domain);
-  rb_enc_associate(argv[5], rb_utf8_encoding());
+  reply = dnssd_reply_new(cDNSSDReplyBrowse, service, flags, interface, &raw);
+
+  fields[0] = name;   lengths[0] = strlen(name);
+  fields[1] = type;   lengths[1] = strlen(type);
+  fields[2] = domain; lengths[2] = strlen(domain);
+
+  DNSSD_PROBE6(reply, service, "browse", name, type, domain, flags);
 
-  reply = rb_class_new_instance(6, argv, cDNSSDReplyBrowse);
+  dnssd_service_trace(service, DNSSD_TRACE_BROWSE, flags, interface, 3,
+      fields, lengths, 0, NULL);
 
-  rb_funcall(service, dnssd_id_push, 1, reply);
+  dnssd_reply_set_fields(raw, 3, fields, lengths);
+
+  dnssd_service_enqueue(service, reply, flags);
 }
 
 /* call-seq:
- *   service._browse(flags, interface, type, domain)
+ *   service._browse(flags, interface, type, domain, connection)
  *
  * Binding to DNSServiceBrowse
  */
 
 static VALUE
 dnssd_service_browse(VALUE klass, VALUE _flags, VALUE _interface, VALUE _type,
-    VALUE _domain) {
+    VALUE _domain, VALUE _connection) {
   const char *type;
   const char *domain = NULL;
   DNSServiceFlags flags = 0;
   uint32_t interface = 0;
 
   DNSServiceErrorType e;
-  DNSServiceRef *client;
+  dnssd_service_t *client;
   VALUE self;
 
   dnssd_utf8_cstr(_type, type);
@@ -288,14 +889,13 @@ dnssd_service_browse(VALUE klass, VALUE _flags, VALUE _interface, VALUE _type,
   if (!NIL_P(_interface))
     interface = (uint32_t)NUM2ULONG(_interface);
 
-  client = xcalloc(1, sizeof(DNSServiceRef));
-  self = TypedData_Wrap_Struct(klass, &dnssd_service_type, client);
-  rb_obj_call_init(self, 0, 0);
+  self = dnssd_service_new(klass, _connection, &flags, &client);
 
-  e = DNSServiceBrowse(client, flags, interface, type, domain,
+  e = DNSServiceBrowse(&client->ref, flags, interface, type, domain,
       dnssd_service_browse_reply, (void *)self);
 
-  dnssd_check_error_code(e);
+  dnssd_service_check_start(client, e);
+  DNSSD_PROBE3(service_create, self, "browse", flags);
 
   return self;
 }
@@ -304,37 +904,41 @@ static void DNSSD_API
 dnssd_service_enumerate_domains_reply(DNSServiceRef client,
     DNSServiceFlags flags, uint32_t interface, DNSServiceErrorType e,
     const char *domain, void *context) {
-  VALUE service, reply, argv[4];
+  VALUE service, reply;
+  dnssd_reply_t *raw;
+  long length = strlen(domain);
 
   dnssd_check_error_code(e);
 
   service = (VALUE)context;
 
-  argv[0] = service;
-  argv[1] = ULONG2NUM(flags);
-  argv[2] = ULONG2NUM(interface);
-  argv[3] = rb_str_new2(domain);
-  rb_enc_associate(argv[3], rb_utf8_encoding());
+  reply = dnssd_reply_new(cDNSSDReplyDomain, service, flags, interface, &raw);
+
+  DNSSD_PROBE6(reply, service, "domain", "", "", domain, flags);
+
+  dnssd_service_trace(service, DNSSD_TRACE_DOMAIN, flags, interface, 1,
+      &domain, &length, 0, NULL);
 
-  reply = rb_class_new_instance(4, argv, cDNSSDReplyDomain);
+  dnssd_reply_set_fields(raw, 1, &domain, &length);
 
-  rb_funcall(service, dnssd_id_push, 1, reply);
+  dnssd_service_enqueue(service, reply, flags);
 }
 
 /* call-seq:
- *   service._enumerate_domains(flags, interface)
+ *   service._enumerate_domains(flags, interface, connection)
  *
  * Binding to DNSServiceEnumerateDomains
  */
 
 static VALUE
-dnssd_service_enumerate_domains(VALUE klass, VALUE _flags, VALUE _interface) {
+dnssd_service_enumerate_domains(VALUE klass, VALUE _flags, VALUE _interface,
+    VALUE _connection) {
   DNSServiceFlags flags = 0;
   uint32_t interface = 0;
   VALUE self;
 
   DNSServiceErrorType e;
-  DNSServiceRef *client;
+  dnssd_service_t *client;
 
   if (!NIL_P(_flags))
     flags = (DNSServiceFlags)NUM2ULONG(_flags);
@@ -342,14 +946,13 @@ dnssd_service_enumerate_domains(VALUE klass, VALUE _flags, VALUE _interface) {
   if (!NIL_P(_interface))
     interface = (uint32_t)NUM2ULONG(_interface);
 
-  client = xcalloc(1, sizeof(DNSServiceRef));
-  self = TypedData_Wrap_Struct(klass, &dnssd_service_type, client);
-  rb_obj_call_init(self, 0, 0);
+  self = dnssd_service_new(klass, _connection, &flags, &client);
 
-  e = DNSServiceEnumerateDomains(client, flags, interface,
+  e = DNSServiceEnumerateDomains(&client->ref, flags, interface,
       dnssd_service_enumerate_domains_reply, (void *)self);
 
-  dnssd_check_error_code(e);
+  dnssd_service_check_start(client, e);
+  DNSSD_PROBE3(service_create, self, "domain", flags);
 
   return self;
 }
@@ -359,35 +962,44 @@ static void DNSSD_API
 dnssd_service_getaddrinfo_reply(DNSServiceRef client, DNSServiceFlags flags,
     uint32_t interface, DNSServiceErrorType e, const char *host,
     const struct sockaddr *address, uint32_t ttl, void *context) {
-  VALUE service, reply, argv[6];
+  VALUE service, reply;
+  dnssd_reply_t *raw;
+  const char *fields[2];
+  long lengths[2];
 
   dnssd_check_error_code(e);
 
   service = (VALUE)context;
 
-  argv[0] = service;
-  argv[1] = ULONG2NUM(flags);
-  argv[2] = ULONG2NUM(interface);
-  argv[3] = rb_str_new2(host);
-  rb_enc_associate(argv[3], rb_utf8_encoding());
-  argv[4] = rb_str_new((char *)address, SIN_LEN((struct sockaddr_in*)address));
-  rb_enc_associate(argv[4], rb_utf8_encoding());
-  argv[5] = ULONG2NUM(ttl);
+  reply = dnssd_reply_new(cDNSSDReplyAddrInfo, service, flags, interface,
+      &raw);
+
+  fields[0]  = host;
+  lengths[0] = strlen(host);
+  fields[1]  = (const char *)address;
+  lengths[1] = SOCKADDR_LEN(address);
+
+  dnssd_reply_set_fields(raw, 2, fields, lengths);
 
-  reply = rb_class_new_instance(6, argv, cDNSSDReplyAddrInfo);
+  raw->numbers[0] = ttl;
 
-  rb_funcall(service, dnssd_id_push, 1, reply);
+  DNSSD_PROBE6(reply, service, "getaddrinfo", host, "", "", flags);
+
+  dnssd_service_trace(service, DNSSD_TRACE_GETADDRINFO, flags, interface, 2,
+      fields, lengths, 1, raw->numbers);
+
+  dnssd_service_enqueue(service, reply, flags);
 }
 
 /* call-seq:
- *   service._getaddrinfo(flags, interface, host, protocol)
+ *   service._getaddrinfo(flags, interface, protocol, host, connection)
  *
  * Binding to DNSServiceGetAddrInfo
  */
 
 static VALUE
 dnssd_service_getaddrinfo(VALUE klass, VALUE _flags, VALUE _interface,
-    VALUE _protocol, VALUE _host) {
+    VALUE _protocol, VALUE _host, VALUE _connection) {
   DNSServiceFlags flags = 0;
   uint32_t interface = 0;
   DNSServiceProtocol protocol = 0;
@@ -395,7 +1007,7 @@ dnssd_service_getaddrinfo(VALUE klass, VALUE _flags, VALUE _interface,
   VALUE self;
 
   DNSServiceErrorType e;
-  DNSServiceRef *client;
+  dnssd_service_t *client;
 
   dnssd_utf8_cstr(_host, host);
 
@@ -407,14 +1019,13 @@ dnssd_service_getaddrinfo(VALUE klass, VALUE _flags, VALUE _interface,
   if (!NIL_P(_interface))
     interface = (uint32_t)NUM2ULONG(_interface);
 
-  client = xcalloc(1, sizeof(DNSServiceRef));
-  self = TypedData_Wrap_Struct(klass, &dnssd_service_type, client);
-  rb_obj_call_init(self, 0, 0);
+  self = dnssd_service_new(klass, _connection, &flags, &client);
 
-  e = DNSServiceGetAddrInfo(client, flags, interface, protocol, host,
+  e = DNSServiceGetAddrInfo(&client->ref, flags, interface, protocol, host,
       dnssd_service_getaddrinfo_reply, (void *)self);
 
-  dnssd_check_error_code(e);
+  dnssd_service_check_start(client, e);
+  DNSSD_PROBE3(service_create, self, "getaddrinfo", flags);
 
   return self;
 }
@@ -425,38 +1036,46 @@ dnssd_service_query_record_reply(DNSServiceRef client, DNSServiceFlags flags,
     uint32_t interface, DNSServiceErrorType e, const char *fullname,
     uint16_t rrtype, uint16_t rrclass, uint16_t rdlen, const void *rdata,
     uint32_t ttl, void *context) {
-  VALUE service, reply, argv[8];
+  VALUE service, reply;
+  dnssd_reply_t *raw;
+  const char *fields[2];
+  long lengths[2];
 
   dnssd_check_error_code(e);
 
   service = (VALUE)context;
 
-  argv[0] = service;
-  argv[1] = ULONG2NUM(flags);
-  argv[2] = ULONG2NUM(interface);
-  argv[3] = rb_str_new2(fullname);
-  rb_enc_associate(argv[3], rb_utf8_encoding());
-  argv[4] = UINT2NUM(rrtype);
-  argv[5] = UINT2NUM(rrclass);
-  argv[6] = rb_str_new((char *)rdata, rdlen);
-  rb_enc_associate(argv[6], rb_utf8_encoding());
-  argv[7] = ULONG2NUM(ttl);
+  reply = dnssd_reply_new(cDNSSDReplyQueryRecord, service, flags, interface,
+      &raw);
+
+  fields[0] = fullname;              lengths[0] = strlen(fullname);
+  fields[1] = (const char *)rdata;   lengths[1] = rdlen;
 
-  reply = rb_class_new_instance(8, argv, cDNSSDReplyQueryRecord);
+  dnssd_reply_set_fields(raw, 2, fields, lengths);
 
-  rb_funcall(service, dnssd_id_push, 1, reply);
+  raw->numbers[0] = rrtype;
+  raw->numbers[1] = rrclass;
+  raw->numbers[2] = ttl;
+
+  DNSSD_PROBE6(reply, service, "query_record", fullname, "", "", flags);
+
+  dnssd_service_trace(service, DNSSD_TRACE_QUERY_RECORD, flags, interface, 2,
+      fields, lengths, 3, raw->numbers);
+
+  dnssd_service_enqueue(service, reply, flags);
 }
 
 /* call-seq:
- *   service._query_record(flags, interface, fullname, record_type, record_class)
+ *   service._query_record(flags, interface, fullname, record_type, record_class,
+ *                        connection)
  *
  * Binding to DNSServiceQueryRecord
  */
 
 static VALUE
 dnssd_service_query_record(VALUE klass, VALUE _flags, VALUE _interface,
-    VALUE _fullname, VALUE _rrtype, VALUE _rrclass) {
-  DNSServiceRef *client;
+    VALUE _fullname, VALUE _rrtype, VALUE _rrclass, VALUE _connection) {
+  dnssd_service_t *client;
   DNSServiceFlags flags;
   DNSServiceErrorType e;
   char *fullname;
@@ -471,14 +1090,13 @@ dnssd_service_query_record(VALUE klass, VALUE _flags, VALUE _interface,
   rrtype = NUM2UINT(_rrtype);
   rrclass = NUM2UINT(_rrclass);
 
-  client = xcalloc(1, sizeof(DNSServiceRef));
-  self = TypedData_Wrap_Struct(klass, &dnssd_service_type, client);
-  rb_obj_call_init(self, 0, 0);
+  self = dnssd_service_new(klass, _connection, &flags, &client);
 
-  e = DNSServiceQueryRecord(client, flags, interface, fullname, rrtype,
+  e = DNSServiceQueryRecord(&client->ref, flags, interface, fullname, rrtype,
       rrclass, dnssd_service_query_record_reply, (void *)self);
 
-  dnssd_check_error_code(e);
+  dnssd_service_check_start(client, e);
+  DNSSD_PROBE3(service_create, self, "query_record", flags);
 
   return self;
 }
@@ -487,35 +1105,45 @@ static void DNSSD_API
 dnssd_service_register_reply(DNSServiceRef client, DNSServiceFlags flags,
     DNSServiceErrorType e, const char *name, const char *type,
     const char *domain, void *context) {
-  VALUE service, reply, argv[5];
+  VALUE service, reply;
+  dnssd_reply_t *raw;
+  const char *fields[3];
+  long lengths[3];
 
   dnssd_check_error_code(e);
 
   service = (VALUE)context;
 
-  argv[0] = service;
-  argv[1] = ULONG2NUM(flags);
-  argv[2] = rb_str_new2(name);
-  rb_enc_associate(argv[2], rb_utf8_encoding());
-  argv[3] = rb_str_new2(type);
-  rb_enc_associate(argv[3], rb_utf8_encoding());
-  argv[4] = rb_str_new2(domain);
-  rb_enc_associate(argv[4], rb_utf8_encoding());
+  reply = dnssd_reply_new(cDNSSDReplyRegister, service, flags, 0, &raw);
+
+  /* registration replies don't say which interface */
+  raw->has_interface = 0;
+
+  fields[0] = name;   lengths[0] = strlen(name);
+  fields[1] = type;   lengths[1] = strlen(type);
+  fields[2] = domain; lengths[2] = strlen(domain);
+
+  DNSSD_PROBE6(reply, service, "register", name, type, domain, flags);
+
+  dnssd_service_trace(service, DNSSD_TRACE_REGISTER, flags, 0, 3, fields,
+      lengths, 0, NULL);
 
-  reply = rb_class_new_instance(5, argv, cDNSSDReplyRegister);
+  dnssd_reply_set_fields(raw, 3, fields, lengths);
 
-  rb_funcall(service, dnssd_id_push, 1, reply);
+  dnssd_service_enqueue(service, reply, flags);
 }
 
 /* call-seq:
- *   service._register(flags, interface, name, type, domain, host, port, text_record)
+ *   service._register(flags, interface, name, type, domain, host, port,
+ *                    text_record, connection)
  *
  * Binding to DNSServiceRegister
  */
 
 static VALUE
 dnssd_service_register(VALUE klass, VALUE _flags, VALUE _interface, VALUE _name,
-    VALUE _type, VALUE _domain, VALUE _host, VALUE _port, VALUE _text_record) {
+    VALUE _type, VALUE _domain, VALUE _host, VALUE _port, VALUE _text_record,
+    VALUE _connection) {
   const char *name = NULL, *type, *host = NULL, *domain = NULL;
   uint16_t port;
   uint16_t txt_len = 0;
@@ -525,7 +1153,7 @@ dnssd_service_register(VALUE klass, VALUE _flags, VALUE _interface, VALUE _name,
   DNSServiceRegisterReply callback = NULL;
 
   DNSServiceErrorType e;
-  DNSServiceRef *client;
+  dnssd_service_t *client;
   VALUE self;
 
   if (!NIL_P(_name)) {
@@ -561,14 +1189,14 @@ dnssd_service_register(VALUE klass, VALUE _flags, VALUE _interface, VALUE _name,
 
   callback = dnssd_service_register_reply;
 
-  client = xcalloc(1, sizeof(DNSServiceRef));
-  self = TypedData_Wrap_Struct(cDNSSDServiceRegister, &dnssd_service_type, client);
-  rb_obj_call_init(self, 0, 0);
+  self = dnssd_service_new(cDNSSDServiceRegister, _connection, &flags,
+      &client);
 
-  e = DNSServiceRegister(client, flags, interface, name, type,
+  e = DNSServiceRegister(&client->ref, flags, interface, name, type,
       domain, host, port, txt_len, txt_rec, callback, (void*)self);
 
-  dnssd_check_error_code(e);
+  dnssd_service_check_start(client, e);
+  DNSSD_PROBE3(service_create, self, "register", flags);
 
   return self;
 }
@@ -578,44 +1206,50 @@ dnssd_service_resolve_reply(DNSServiceRef client, DNSServiceFlags flags,
     uint32_t interface, DNSServiceErrorType e, const char *name,
     const char *target, uint16_t port, uint16_t txt_len,
     const unsigned char *txt_rec, void *context) {
-  VALUE service, reply, argv[7];
+  VALUE service, reply;
+  dnssd_reply_t *raw;
+  const char *fields[3];
+  long lengths[3];
 
   dnssd_check_error_code(e);
 
   service = (VALUE)context;
 
-  argv[0] = service;
-  argv[1] = ULONG2NUM(flags);
-  argv[2] = ULONG2NUM(interface);
-  argv[3] = rb_str_new2(name);
-  rb_enc_associate(argv[3], rb_utf8_encoding());
-  argv[4] = rb_str_new2(target);
-  rb_enc_associate(argv[4], rb_utf8_encoding());
-  argv[5] = UINT2NUM(ntohs(port));
-  argv[6] = rb_str_new((char *)txt_rec, txt_len);
-  rb_enc_associate(argv[6], rb_utf8_encoding());
+  reply = dnssd_reply_new(cDNSSDReplyResolve, service, flags, interface,
+      &raw);
+
+  fields[0] = name;                  lengths[0] = strlen(name);
+  fields[1] = target;                lengths[1] = strlen(target);
+  fields[2] = (const char *)txt_rec; lengths[2] = txt_len;
+
+  dnssd_reply_set_fields(raw, 3, fields, lengths);
 
-  reply = rb_class_new_instance(7, argv, cDNSSDReplyResolve);
+  raw->numbers[0] = ntohs(port);
 
-  rb_funcall(service, dnssd_id_push, 1, reply);
+  DNSSD_PROBE6(reply, service, "resolve", name, "", "", flags);
+
+  dnssd_service_trace(service, DNSSD_TRACE_RESOLVE, flags, interface, 3,
+      fields, lengths, 1, raw->numbers);
+
+  dnssd_service_enqueue(service, reply, flags);
 }
 
 /* call-seq:
- *   service._resolve(flags, interface, name, type, domain)
+ *   service._resolve(flags, interface, name, type, domain, connection)
  *
  * Binding to DNSServiceResolve
  */
 
 static VALUE
 dnssd_service_resolve(VALUE klass, VALUE _flags, VALUE _interface, VALUE _name,
-    VALUE _type, VALUE _domain) {
+    VALUE _type, VALUE _domain, VALUE _connection) {
   const char *name, *type, *domain;
   DNSServiceFlags flags = 0;
   uint32_t interface = 0;
   VALUE self;
 
   DNSServiceErrorType e;
-  DNSServiceRef *client;
+  dnssd_service_t *client;
 
   dnssd_utf8_cstr(_name, name);
   dnssd_utf8_cstr(_type, type);
@@ -627,16 +1261,200 @@ dnssd_service_resolve(VALUE klass, VALUE _flags, VALUE _interface, VALUE _name,
   if (!NIL_P(_interface))
     interface = (uint32_t)NUM2ULONG(_interface);
 
-  client = xcalloc(1, sizeof(DNSServiceRef));
-  self = TypedData_Wrap_Struct(klass, &dnssd_service_type, client);
-  rb_obj_call_init(self, 0, 0);
+  self = dnssd_service_new(klass, _connection, &flags, &client);
 
-  e = DNSServiceResolve(client, flags, interface, name, type, domain,
+  e = DNSServiceResolve(&client->ref, flags, interface, name, type, domain,
       dnssd_service_resolve_reply, (void *)self);
 
-  dnssd_check_error_code(e);
+  dnssd_service_check_start(client, e);
+  DNSSD_PROBE3(service_create, self, "resolve", flags);
+
+  return self;
+}
+
+/* call-seq:
+ *   service._synthesize(kind, count)
+ *
+ * Calls the reply callback of +kind+ (:browse, :resolve, :query_record or
+ * :getaddrinfo) +count+ times with canned data, as DNSServiceProcessResult
+ * does for a burst of +count+ replies from the daemon.  This drives the reply
+ * pipeline without a daemon for bench/pipeline.rb.
+ */
+
+static VALUE
+dnssd_service_synthesize(VALUE self, VALUE _kind, VALUE _count) {
+  static const char txt[] =
+    "\011txtvers=1\020path=/index.html\016note=synthetic";
+  static const char srv[] =
+    "\000\000\000\000\037\220\007example\005local\000";
+  struct sockaddr_in sin;
+  DNSServiceFlags flags;
+  ID kind = SYM2ID(_kind);
+  long count = NUM2LONG(_count);
+  long i;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family      = AF_INET;
+  sin.sin_addr.s_addr = htonl(0xc0000207); /* 192.0.2.7 */
+
+  for (i = 0; i < count; i++) {
+    flags = kDNSServiceFlagsAdd;
+
+    if (i < count - 1)
+      flags |= kDNSServiceFlagsMoreComing;
+
+    if (kind == rb_intern("browse")) {
+      dnssd_service_browse_reply(NULL, flags, 1, 0, "Synthetic Service",
+          "_http._tcp.", "local.", (void *)self);
+    } else if (kind == rb_intern("resolve")) {
+      dnssd_service_resolve_reply(NULL, flags, 1, 0,
+          "Synthetic\\032Service._http._tcp.local.", "example.local.",
+          htons(8080), sizeof(txt) - 1, (const unsigned char *)txt,
+          (void *)self);
+    } else if (kind == rb_intern("query_record")) {
+      dnssd_service_query_record_reply(NULL, flags, 1, 0,
+          "Synthetic\\032Service._http._tcp.local.", kDNSServiceType_SRV,
+          kDNSServiceClass_IN, sizeof(srv) - 1, srv, 120, (void *)self);
+#ifdef HAVE_DNSSERVICEGETADDRINFO
+    } else if (kind == rb_intern("getaddrinfo")) {
+      dnssd_service_getaddrinfo_reply(NULL, flags, 1, 0, "example.local.",
+          (struct sockaddr *)&sin, 120, (void *)self);
+#endif
+    } else {
+      rb_raise(rb_eArgError, "unknown reply kind %"PRIsVALUE, _kind);
+    }
+  }
+
+  return self;
+}
+
+/* call-seq:
+ *   service.stats # => Hash
+ *
+ * Returns counters for this service:
+ *
+ * replies:: replies queued
+ * queued:: replies waiting to be taken now
+ * queue_max:: the most replies waiting at once
+ * dropped:: replies dropped because the queue was full
+ * coalesced:: replies that replaced a queued reply because the queue was full
+ * blocked:: reads skipped because the queue was full
+ * process_calls:: calls to DNSServiceProcessResult for this service
+ * process_time:: seconds spent in DNSServiceProcessResult
+ * process_time_max:: the longest single call in seconds
+ * unknown_errors:: DNSSD::UnknownError results #each ignored
+ *
+ * A service on a DNSSD::Connection is processed through the connection, so
+ * only its reply counters change.  See also DNSSD.stats.
+ */
+
+static VALUE
+dnssd_service_stats(VALUE self) {
+  dnssd_service_t *client;
+  VALUE hash = rb_hash_new();
+
+  TypedData_Get_Struct(self, dnssd_service_t, &dnssd_service_type, client);
+
+  rb_hash_aset(hash, ID2SYM(rb_intern("replies")),
+      ULL2NUM(client->replies_total));
+  rb_hash_aset(hash, ID2SYM(rb_intern("queued")), LONG2NUM(client->count));
+  rb_hash_aset(hash, ID2SYM(rb_intern("queue_max")),
+      LONG2NUM(client->queue_max));
+  rb_hash_aset(hash, ID2SYM(rb_intern("dropped")),
+      ULL2NUM(client->dropped));
+  rb_hash_aset(hash, ID2SYM(rb_intern("coalesced")),
+      ULL2NUM(client->coalesced));
+  rb_hash_aset(hash, ID2SYM(rb_intern("blocked")),
+      ULL2NUM(client->blocked));
+
+  dnssd_stats_process_hash(hash, &client->process);
+
+  return hash;
+}
+
+/* call-seq:
+ *   service._replay(frame)
+ *
+ * Calls the reply callback recorded in trace +frame+ as
+ * DNSServiceProcessResult would have.  Used by DNSSD::Trace#replay.
+ */
+
+static VALUE
+dnssd_service_replay(VALUE self, VALUE frame) {
+  dnssd_trace_record_t record;
+  const char **fields = record.fields;
+  uint32_t *numbers = record.numbers;
+  VALUE buffer_v;
+  char *buffer;
+
+  StringValue(frame);
+
+  buffer = ALLOCV_N(char, buffer_v, RSTRING_LEN(frame));
+
+  dnssd_trace_decode(frame, &record, buffer);
+
+#define EXPECT(nf, nn) \
+  if (record.nfields != (nf) || record.nnumbers != (nn)) goto malformed
+
+  switch (record.kind) {
+    case DNSSD_TRACE_BROWSE:
+      EXPECT(3, 0);
+      dnssd_service_browse_reply(NULL, record.flags, record.interface, 0,
+          fields[0], fields[1], fields[2], (void *)self);
+      break;
+    case DNSSD_TRACE_DOMAIN:
+      EXPECT(1, 0);
+      dnssd_service_enumerate_domains_reply(NULL, record.flags,
+          record.interface, 0, fields[0], (void *)self);
+      break;
+#ifdef HAVE_DNSSERVICEGETADDRINFO
+    case DNSSD_TRACE_GETADDRINFO: {
+      struct sockaddr_storage address;
+
+      EXPECT(2, 1);
+      if (record.lengths[1] > (long)sizeof(address)) goto malformed;
+
+      /* the sockaddr in the frame may not be aligned */
+      memset(&address, 0, sizeof(address));
+      memcpy(&address, fields[1], record.lengths[1]);
+
+      dnssd_service_getaddrinfo_reply(NULL, record.flags, record.interface, 0,
+          fields[0], (struct sockaddr *)&address, numbers[0], (void *)self);
+      break;
+    }
+#endif
+    case DNSSD_TRACE_QUERY_RECORD:
+      EXPECT(2, 3);
+      dnssd_service_query_record_reply(NULL, record.flags, record.interface,
+          0, fields[0], (uint16_t)numbers[0], (uint16_t)numbers[1],
+          (uint16_t)record.lengths[1], fields[1], numbers[2], (void *)self);
+      break;
+    case DNSSD_TRACE_REGISTER:
+      EXPECT(3, 0);
+      dnssd_service_register_reply(NULL, record.flags, 0, fields[0],
+          fields[1], fields[2], (void *)self);
+      break;
+    case DNSSD_TRACE_RESOLVE:
+      EXPECT(3, 1);
+      dnssd_service_resolve_reply(NULL, record.flags, record.interface, 0,
+          fields[0], fields[1], htons((uint16_t)numbers[0]),
+          (uint16_t)record.lengths[2], (const unsigned char *)fields[2],
+          (void *)self);
+      break;
+    default:
+      goto malformed;
+  }
+
+#undef EXPECT
+
+  ALLOCV_END(buffer_v);
 
   return self;
+
+malformed:
+  ALLOCV_END(buffer_v);
+
+  rb_raise(rb_eArgError, "malformed trace frame");
 }
 
 void
@@ -646,11 +1464,12 @@ Init_DNSSD_Service(void) {
   mDNSSD = rb_define_module("DNSSD");
 
   dnssd_id_join = rb_intern("join");
-  dnssd_id_push = rb_intern("push");
+  dnssd_id_read_ahead = rb_intern("read_ahead");
+  dnssd_id_ready = rb_intern("ready");
 
+  dnssd_iv_connection  = rb_intern("@connection");
   dnssd_iv_continue    = rb_intern("@continue");
   dnssd_iv_records     = rb_intern("@records");
-  dnssd_iv_replies     = rb_intern("@replies");
   dnssd_iv_service     = rb_intern("@service");
   dnssd_iv_thread      = rb_intern("@thread");
   dnssd_iv_type        = rb_intern("@type");
@@ -712,17 +1531,29 @@ Init_DNSSD_Service(void) {
   rb_define_private_method(cDNSSDService, "_stop", dnssd_service_stop, 0);
 
   rb_define_private_method(cDNSSDServiceRegister, "_add_record", dnssd_service_add_record, 4);
+  rb_define_private_method(cDNSSDServiceRegister, "_update_text_record", dnssd_service_update_text_record, 2);
   rb_define_private_method(cDNSSDService, "ref_sock_fd", dnssd_ref_sock_fd, 0);
-  rb_define_private_method(cDNSSDService, "process_result", dnssd_process_result, 0);
+  rb_define_private_method(cDNSSDService, "process_result", dnssd_process_result, 1);
+
+  rb_define_method(cDNSSDService, "push", dnssd_service_push, 1);
+  rb_define_method(cDNSSDService, "drain_replies", dnssd_service_drain_replies, 0);
+  rb_define_method(cDNSSDService, "shift_replies", dnssd_service_shift_replies, 0);
+  rb_define_method(cDNSSDService, "replies_waiting?", dnssd_service_replies_waiting_p, 0);
+  rb_define_method(cDNSSDService, "stats", dnssd_service_stats, 0);
+  rb_define_private_method(cDNSSDService, "more_coming?", dnssd_service_more_coming_p, 0);
+  rb_define_private_method(cDNSSDService, "_limit_replies", dnssd_service_limit_replies, 2);
+  rb_define_private_method(cDNSSDService, "reply_queue_full?", dnssd_service_reply_queue_full_p, 0);
+  rb_define_private_method(cDNSSDService, "_synthesize", dnssd_service_synthesize, 2);
+  rb_define_private_method(cDNSSDService, "_replay", dnssd_service_replay, 1);
 
   /* private class methods */
-  rb_define_private_method(sDNSSDService, "_browse", dnssd_service_browse, 4);
-  rb_define_private_method(sDNSSDService, "_enumerate_domains", dnssd_service_enumerate_domains, 2);
+  rb_define_private_method(sDNSSDService, "_browse", dnssd_service_browse, 5);
+  rb_define_private_method(sDNSSDService, "_enumerate_domains", dnssd_service_enumerate_domains, 3);
 #ifdef HAVE_DNSSERVICEGETADDRINFO
-  rb_define_private_method(sDNSSDService, "_getaddrinfo", dnssd_service_getaddrinfo, 4);
+  rb_define_private_method(sDNSSDService, "_getaddrinfo", dnssd_service_getaddrinfo, 5);
 #endif
-  rb_define_private_method(sDNSSDService, "_query_record", dnssd_service_query_record, 5);
-  rb_define_private_method(sDNSSDService, "_register", dnssd_service_register, 8);
-  rb_define_private_method(sDNSSDService, "_resolve", dnssd_service_resolve, 5);
+  rb_define_private_method(sDNSSDService, "_query_record", dnssd_service_query_record, 6);
+  rb_define_private_method(sDNSSDService, "_register", dnssd_service_register, 9);
+  rb_define_private_method(sDNSSDService, "_resolve", dnssd_service_resolve, 6);
 
 }
@@ -0,0 +1,114 @@
+#include "dnssd.h"
+#include <time.h>
+
+/* Process-wide counters.  They are only updated with the GVL held so plain
+ * integers are enough. */
+dnssd_stats_t dnssd_stats;
+
+/* Nanoseconds on a monotonic clock */
+
+uint64_t
+dnssd_clock_ns(void) {
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_usec * 1000;
+#endif
+}
+
+/* Records a DNSServiceProcessResult call that began at +started+ and returned
+ * +e+ in +stats+, if given, and in the process-wide counters */
+
+void
+dnssd_stats_process(dnssd_process_stats_t *stats, uint64_t started,
+    DNSServiceErrorType e) {
+  dnssd_process_stats_t *all = &dnssd_stats.process;
+  uint64_t elapsed = dnssd_clock_ns() - started;
+
+  all->calls++;
+  all->ns += elapsed;
+  if (elapsed > all->max_ns) all->max_ns = elapsed;
+  if (e == kDNSServiceErr_Unknown) all->unknown_errors++;
+
+  if (!stats)
+    return;
+
+  stats->calls++;
+  stats->ns += elapsed;
+  if (elapsed > stats->max_ns) stats->max_ns = elapsed;
+  if (e == kDNSServiceErr_Unknown) stats->unknown_errors++;
+}
+
+/* Adds the counters in +stats+ to +hash+ */
+
+void
+dnssd_stats_process_hash(VALUE hash, const dnssd_process_stats_t *stats) {
+  rb_hash_aset(hash, ID2SYM(rb_intern("process_calls")),
+      ULL2NUM(stats->calls));
+  rb_hash_aset(hash, ID2SYM(rb_intern("process_time")),
+      DBL2NUM(stats->ns / 1e9));
+  rb_hash_aset(hash, ID2SYM(rb_intern("process_time_max")),
+      DBL2NUM(stats->max_ns / 1e9));
+  rb_hash_aset(hash, ID2SYM(rb_intern("unknown_errors")),
+      ULL2NUM(stats->unknown_errors));
+}
+
+/* call-seq:
+ *   DNSSD.stats # => Hash
+ *
+ * Returns counters for the whole process:
+ *
+ * services_started:: services the daemon accepted
+ * services_live:: started services not yet stopped or collected
+ * replies:: replies queued by every service
+ * dropped:: replies dropped because a service's queue was full
+ * coalesced:: replies that replaced a queued reply because a service's
+ *             queue was full
+ * queue_max:: the most replies any one service had waiting
+ * process_calls:: calls to DNSServiceProcessResult, including those on a
+ *                 DNSSD::Connection
+ * process_time:: seconds spent in DNSServiceProcessResult
+ * process_time_max:: the longest single call in seconds
+ * unknown_errors:: DNSSD::UnknownError results, which DNSSD::Service#each
+ *                  and DNSSD::Connection#process ignore
+ *
+ * The counters only grow except +services_live+.  See also
+ * DNSSD::Service#stats.
+ */
+
+static VALUE
+dnssd_s_stats(VALUE self) {
+  VALUE hash = rb_hash_new();
+
+  rb_hash_aset(hash, ID2SYM(rb_intern("services_started")),
+      ULL2NUM(dnssd_stats.services_started));
+  rb_hash_aset(hash, ID2SYM(rb_intern("services_live")),
+      LL2NUM(dnssd_stats.services_live));
+  rb_hash_aset(hash, ID2SYM(rb_intern("replies")),
+      ULL2NUM(dnssd_stats.replies));
+  rb_hash_aset(hash, ID2SYM(rb_intern("dropped")),
+      ULL2NUM(dnssd_stats.replies_dropped));
+  rb_hash_aset(hash, ID2SYM(rb_intern("coalesced")),
+      ULL2NUM(dnssd_stats.replies_coalesced));
+  rb_hash_aset(hash, ID2SYM(rb_intern("queue_max")),
+      LONG2NUM(dnssd_stats.queue_max));
+
+  dnssd_stats_process_hash(hash, &dnssd_stats.process);
+
+  return hash;
+}
+
+void
+Init_DNSSD_Stats(void) {
+  VALUE mDNSSD = rb_define_module("DNSSD");
+
+  rb_define_singleton_method(mDNSSD, "stats", dnssd_s_stats, 0);
+}
@@ -0,0 +1,175 @@
+#include "dnssd.h"
+
+static VALUE cDNSSDTextRecord;
+
+/* Finds +key+ in the +length+ bytes of TXT record +data+ without copying
+ * anything.  As in TextRecord#decode keys match exactly and a later entry
+ * wins over an earlier one.  Raises ArgumentError for a malformed record.
+ *
+ * Returns DNSSD_TXT_MISSING if there is no entry for +key+,
+ * DNSSD_TXT_NO_VALUE if the entry has no "=", and DNSSD_TXT_VALUE with
+ * +value+ and +value_length+ pointing into +data+ otherwise. */
+
+int
+dnssd_text_record_find(const char *data, long length, const char *key,
+    long key_length, const char **value, long *value_length) {
+  const unsigned char *entry = (const unsigned char *)data;
+  const unsigned char *end   = entry + length;
+  int found = DNSSD_TXT_MISSING;
+
+  while (entry < end) {
+    long size = *entry++;
+    const unsigned char *equals;
+    long name_length;
+
+    if (!size)
+      continue;
+
+    if (end - entry < size)
+      rb_raise(rb_eArgError, "ran out of data in text record");
+
+    if (*entry == '=')
+      rb_raise(rb_eArgError, "key not found");
+
+    equals = memchr(entry, '=', size);
+    name_length = equals ? equals - entry : size;
+
+    if (name_length == key_length && !memcmp(entry, key, key_length)) {
+      if (equals) {
+        found = DNSSD_TXT_VALUE;
+        *value = (const char *)equals + 1;
+        *value_length = size - name_length - 1;
+      } else {
+        found = DNSSD_TXT_NO_VALUE;
+      }
+    }
+
+    entry += size;
+  }
+
+  return found;
+}
+
+/* call-seq:
+ *   _decode(text_record) # => Hash
+ *
+ * Decodes the DNS-SD TXT record data +text_record+ into a Hash of key to
+ * value.  A key without "=" maps to nil.  Raises ArgumentError if an entry
+ * runs past the end of the data or has an empty key.
+ */
+
+static VALUE
+dnssd_text_record_decode(VALUE self, VALUE text_record) {
+  const unsigned char *data, *end;
+  VALUE record = rb_hash_new();
+
+  StringValue(text_record);
+
+  data = (const unsigned char *)RSTRING_PTR(text_record);
+  end  = data + RSTRING_LEN(text_record);
+
+  while (data < end) {
+    long size = *data++;
+    const unsigned char *equals;
+    VALUE key, value = Qnil;
+
+    if (!size)
+      continue;
+
+    if (end - data < size)
+      rb_raise(rb_eArgError, "ran out of data in text record");
+
+    if (*data == '=')
+      rb_raise(rb_eArgError, "key not found");
+
+    equals = memchr(data, '=', size);
+
+    if (equals) {
+      key   = rb_str_new((const char *)data, equals - data);
+      value = rb_str_new((const char *)equals + 1, size - (equals - data) - 1);
+    } else {
+      key = rb_str_new((const char *)data, size);
+    }
+
+    rb_hash_aset(record, key, value);
+
+    data += size;
+  }
+
+  return record;
+}
+
+/* call-seq:
+ *   _encode(pairs) # => String
+ *
+ * Encodes an Array of [key, value] +pairs+ as DNS-SD TXT record data.  Keys
+ * and values are converted with #to_s, a false or nil value encodes the key
+ * alone.  Raises DNSSD::Error for an empty key, a key containing "=" or a
+ * pair longer than 255 bytes.
+ */
+
+static VALUE
+dnssd_text_record_encode(VALUE self, VALUE pairs) {
+  VALUE encoded;
+  long i;
+
+  Check_Type(pairs, T_ARRAY);
+
+  encoded = rb_str_buf_new(0);
+
+  for (i = 0; i < RARRAY_LEN(pairs); i++) {
+    VALUE pair = rb_check_array_type(RARRAY_AREF(pairs, i));
+    VALUE key, value;
+    long length;
+    char size;
+
+    if (NIL_P(pair) || RARRAY_LEN(pair) < 2)
+      rb_raise(rb_eTypeError, "expected [key, value] pair");
+
+    key   = rb_obj_as_string(RARRAY_AREF(pair, 0));
+    value = RARRAY_AREF(pair, 1);
+
+    if (!RSTRING_LEN(key))
+      rb_raise(eDNSSDError, "empty key");
+
+    if (memchr(RSTRING_PTR(key), '=', RSTRING_LEN(key)))
+      rb_raise(eDNSSDError, "key '%"PRIsVALUE"' contains =", key);
+
+    length = RSTRING_LEN(key);
+
+    if (RTEST(value)) {
+      value   = rb_obj_as_string(value);
+      length += 1 + RSTRING_LEN(value);
+    }
+
+    if (length > 255)
+      rb_raise(eDNSSDError,
+          "key value pair at '%"PRIsVALUE"' too large to encode", key);
+
+    size = (char)length;
+
+    rb_str_cat(encoded, &size, 1);
+    rb_str_cat(encoded, RSTRING_PTR(key), RSTRING_LEN(key));
+
+    if (RTEST(value)) {
+      rb_str_cat(encoded, "=", 1);
+      rb_str_cat(encoded, RSTRING_PTR(value), RSTRING_LEN(value));
+    }
+  }
+
+  return encoded;
+}
+
+/* Document-class: DNSSD::TextRecord
+ *
+ * The TXT record codec.  See lib/dnssd/text_record.rb
+ */
+
+void
+Init_DNSSD_TextRecord(void) {
+  cDNSSDTextRecord = rb_path2class("DNSSD::TextRecord");
+
+  rb_define_private_method(cDNSSDTextRecord, "_decode", dnssd_text_record_decode, 1);
+  rb_define_private_method(cDNSSDTextRecord, "_encode", dnssd_text_record_encode, 1);
+  rb_define_private_method(rb_singleton_class(cDNSSDTextRecord), "_decode", dnssd_text_record_decode, 1);
+}
@@ -0,0 +1,328 @@
+#include "dnssd.h"
+#include <errno.h>
+#include <stdio.h>
+
+/* A trace is a file holding the arguments of every reply callback made while
+ * recording, so a reply stream can be replayed later without a daemon.
+ *
+ * The file starts with DNSSD_TRACE_MAGIC followed by one frame per callback.
+ * All integers are little-endian:
+ *
+ *   u32 size         bytes in the frame after this field
+ *   u64 time         nanoseconds since recording started
+ *   u32 service      id of the service the reply was for, from 1
+ *   u8  kind         DNSSD_TRACE_BROWSE etc.
+ *   u32 flags
+ *   u32 interface
+ *   u8  ifname       length of the interface name, then its bytes
+ *   u8  nfields      then for each field: u16 length, bytes
+ *   u8  nnumbers     then for each number: u32
+ *
+ * Ruby reads size, time and service to split the file into frames and
+ * schedule them, see lib/dnssd/trace.rb.  Everything from kind on is decoded
+ * by dnssd_trace_decode.
+ *
+ * Interface indexes differ between hosts and boots, so the name is recorded
+ * too and replay maps it to the local index. */
+
+#define DNSSD_TRACE_MAGIC "DNSSDTR2"
+#define DNSSD_TRACE_HEADER 13 /* time, service and kind */
+
+static VALUE cDNSSDTrace;
+
+static FILE *dnssd_trace_file = NULL;
+static uint64_t dnssd_trace_started;
+static uint32_t dnssd_trace_ids;
+
+/* the first write error, raised when recording stops */
+static int dnssd_trace_errno = 0;
+
+/* Is +interface+ a real interface and not kDNSServiceInterfaceIndexAny,
+ * LocalOnly and the like? */
+
+static int
+dnssd_trace_real_interface(uint32_t interface) {
+  return (int32_t)interface > 0;
+}
+
+static char *
+dnssd_trace_put(char *out, uint64_t value, int bytes) {
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    *out++ = (char)((value >> (8 * i)) & 0xff);
+
+  return out;
+}
+
+static uint64_t
+dnssd_trace_get(const unsigned char *in, int bytes) {
+  uint64_t value = 0;
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    value |= (uint64_t)in[i] << (8 * i);
+
+  return value;
+}
+
+/* Is a trace being recorded? */
+
+int
+dnssd_trace_recording(void) {
+  return dnssd_trace_file != NULL;
+}
+
+/* Returns a new id for a service that appears in the trace */
+
+uint32_t
+dnssd_trace_next_id(void) {
+  return ++dnssd_trace_ids;
+}
+
+/* Appends a frame for one callback to the trace being recorded */
+
+void
+dnssd_trace_write(uint32_t service, int kind, DNSServiceFlags flags,
+    uint32_t interface, int nfields, const char **fields,
+    const long *lengths, int nnumbers, const uint32_t *numbers) {
+  char stack[1024], *buffer = stack, *out;
+  long size = 4 + DNSSD_TRACE_HEADER + 4 + 4 + 1 + 1 + 1;
+  const char *ifname = "";
+  long ifname_length = 0;
+  int i;
+
+  if (!dnssd_trace_file)
+    return;
+
+  if (dnssd_trace_real_interface(interface)) {
+    VALUE name = dnssd_interface_name(interface);
+
+    if (!NIL_P(name)) {
+      ifname        = RSTRING_PTR(name);
+      ifname_length = RSTRING_LEN(name);
+    }
+  }
+
+  size += ifname_length;
+
+  for (i = 0; i < nfields; i++)
+    size += 2 + lengths[i];
+
+  size += 4 * nnumbers;
+
+  if (size > (long)sizeof(stack))
+    buffer = xmalloc(size);
+
+  out = buffer;
+  out = dnssd_trace_put(out, size - 4, 4);
+  out = dnssd_trace_put(out, dnssd_clock_ns() - dnssd_trace_started, 8);
+  out = dnssd_trace_put(out, service, 4);
+  out = dnssd_trace_put(out, kind, 1);
+  out = dnssd_trace_put(out, flags, 4);
+  out = dnssd_trace_put(out, interface, 4);
+
+  out = dnssd_trace_put(out, ifname_length, 1);
+  memcpy(out, ifname, ifname_length);
+  out += ifname_length;
+
+  out = dnssd_trace_put(out, nfields, 1);
+
+  for (i = 0; i < nfields; i++) {
+    out = dnssd_trace_put(out, lengths[i], 2);
+    memcpy(out, fields[i], lengths[i]);
+    out += lengths[i];
+  }
+
+  out = dnssd_trace_put(out, nnumbers, 1);
+
+  for (i = 0; i < nnumbers; i++)
+    out = dnssd_trace_put(out, numbers[i], 4);
+
+  if (fwrite(buffer, 1, size, dnssd_trace_file) != (size_t)size &&
+      !dnssd_trace_errno)
+    dnssd_trace_errno = errno ? errno : EIO;
+
+  if (buffer != stack)
+    xfree(buffer);
+}
+
+/* Decodes +frame+, a whole frame including its size, into +record+.  Fields
+ * are copied to +buffer+, which must hold RSTRING_LEN(frame) bytes, and NUL
+ * terminated so names can be passed to the callbacks as C strings.  A real
+ * interface is replaced by the local index of its recorded name, or
+ * kDNSServiceInterfaceIndexAny if this host has no such interface.  Raises
+ * ArgumentError if +frame+ is malformed. */
+
+void
+dnssd_trace_decode(VALUE frame, dnssd_trace_record_t *record, char *buffer) {
+  const unsigned char *in, *end;
+  long ifname_length;
+  char *out;
+  int i;
+
+  StringValue(frame);
+
+  in  = (const unsigned char *)RSTRING_PTR(frame);
+  end = in + RSTRING_LEN(frame);
+
+  if (end - in < 4 + DNSSD_TRACE_HEADER + 4 + 4 + 1 + 1 ||
+      dnssd_trace_get(in, 4) != (uint64_t)(end - in - 4))
+    goto malformed;
+
+  in += 4 + 12;
+
+  record->kind      = (int)dnssd_trace_get(in, 1);      in += 1;
+  record->flags     = (DNSServiceFlags)dnssd_trace_get(in, 4); in += 4;
+  record->interface = (uint32_t)dnssd_trace_get(in, 4); in += 4;
+  ifname_length     = (long)dnssd_trace_get(in, 1);     in += 1;
+
+  if (end - in < ifname_length + 1)
+    goto malformed;
+
+  /* the name and fields fit in the frame, with room to spare for their
+   * NULs */
+  out = buffer;
+
+  if (dnssd_trace_real_interface(record->interface)) {
+    record->interface = ifname_length ?
+      dnssd_interface_index(rb_str_new((const char *)in, ifname_length)) :
+      kDNSServiceInterfaceIndexAny;
+  }
+
+  in += ifname_length;
+
+  record->nfields = (int)dnssd_trace_get(in, 1); in += 1;
+
+  if (record->nfields > DNSSD_REPLY_FIELDS)
+    goto malformed;
+
+  for (i = 0; i < record->nfields; i++) {
+    long length;
+
+    if (end - in < 2)
+      goto malformed;
+
+    length = (long)dnssd_trace_get(in, 2); in += 2;
+
+    if (end - in < length)
+      goto malformed;
+
+    memcpy(out, in, length);
+    out[length] = '\0';
+
+    record->fields[i]  = out;
+    record->lengths[i] = length;
+
+    in  += length;
+    out += length + 1;
+  }
+
+  if (end - in < 1)
+    goto malformed;
+
+  record->nnumbers = (int)dnssd_trace_get(in, 1); in += 1;
+
+  if (record->nnumbers > DNSSD_REPLY_NUMBERS ||
+      end - in != 4 * record->nnumbers)
+    goto malformed;
+
+  for (i = 0; i < record->nnumbers; i++, in += 4)
+    record->numbers[i] = (uint32_t)dnssd_trace_get(in, 4);
+
+  return;
+
+malformed:
+  rb_raise(rb_eArgError, "malformed trace frame");
+}
+
+/* call-seq:
+ *   DNSSD::Trace._start(path)
+ *
+ * Starts recording every reply callback to a new trace file at +path+
+ */
+
+static VALUE
+dnssd_trace_s_start(VALUE klass, VALUE path) {
+  FILE *file;
+
+  if (dnssd_trace_file)
+    rb_raise(eDNSSDError, "a trace is already being recorded");
+
+  FilePathValue(path);
+
+  file = fopen(StringValueCStr(path), "wb");
+
+  if (!file)
+    rb_sys_fail_str(path);
+
+  if (fwrite(DNSSD_TRACE_MAGIC, 1, sizeof(DNSSD_TRACE_MAGIC) - 1, file) !=
+      sizeof(DNSSD_TRACE_MAGIC) - 1) {
+    int e = errno;
+
+    fclose(file);
+    errno = e;
+    rb_sys_fail_str(path);
+  }
+
+  dnssd_trace_file    = file;
+  dnssd_trace_started = dnssd_clock_ns();
+  dnssd_trace_errno   = 0;
+
+  return Qnil;
+}
+
+/* call-seq:
+ *   DNSSD::Trace._stop
+ *
+ * Stops recording and closes the trace file.  Returns false if no trace was
+ * being recorded.  Raises SystemCallError if writing any part of the trace
+ * failed, as the trace is then incomplete.
+ */
+
+static VALUE
+dnssd_trace_s_stop(VALUE klass) {
+  FILE *file = dnssd_trace_file;
+  int e;
+
+  if (!file)
+    return Qfalse;
+
+  dnssd_trace_file = NULL;
+
+  if (fclose(file) && !dnssd_trace_errno)
+    dnssd_trace_errno = errno;
+
+  if ((e = dnssd_trace_errno)) {
+    dnssd_trace_errno = 0;
+    errno = e;
+    rb_sys_fail("writing trace");
+  }
+
+  return Qtrue;
+}
+
+static VALUE
+dnssd_trace_s_recording_p(VALUE klass) {
+  return dnssd_trace_recording() ? Qtrue : Qfalse;
+}
+
+/* Document-class: DNSSD::Trace
+ *
+ * Records reply callbacks to a file and replays them.  See
+ * lib/dnssd/trace.rb
+ */
+
+void
+Init_DNSSD_Trace(void) {
+  VALUE mDNSSD = rb_define_module("DNSSD");
+
+  cDNSSDTrace = rb_define_class_under(mDNSSD, "Trace", rb_cObject);
+
+  /* The bytes a trace file starts with */
+  rb_define_const(cDNSSDTrace, "MAGIC", rb_str_new_cstr(DNSSD_TRACE_MAGIC));
+
+  rb_define_private_method(rb_singleton_class(cDNSSDTrace), "_start", dnssd_trace_s_start, 1);
+  rb_define_private_method(rb_singleton_class(cDNSSDTrace), "_stop", dnssd_trace_s_stop, 0);
+  rb_define_singleton_method(cDNSSDTrace, "recording?", dnssd_trace_s_recording_p, 0);
+}
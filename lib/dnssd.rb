@@ -7,6 +7,10 @@
 # The methods DNSSD.enumerate_domains, DNSSD.browse, DNSSD.register, and
 # DNSSD.resolve provide the basic API for making your applications DNS \Service
 # Discovery aware.
+#
+# The synchronous variants such as DNSSD.browse! and DNSSD.resolve! wait through
+# the Fiber scheduler when called from a non-blocking Fiber, so many lookups
+# can run as fibers on one thread.
 
 module DNSSD
 
@@ -146,6 +150,16 @@ module DNSSD
   ensure
     service.stop if service
   end
+
+  if defined? Process::CLOCK_MONOTONIC then
+    def self.clock_time # :nodoc:
+      Process.clock_gettime Process::CLOCK_MONOTONIC
+    end
+  else
+    def self.clock_time # :nodoc:
+      Time.now
+    end
+  end
 end
 
 require 'socket'
@@ -176,6 +190,15 @@ module DNSSD
 end
 
 require 'dnssd/flags'
+require 'dnssd/coalescer'
 require 'dnssd/service'
+require 'dnssd/address_cache'
+require 'dnssd/connection'
+require 'dnssd/directory'
+require 'dnssd/happy_eyeballs'
+require 'dnssd/reactor'
+require 'dnssd/resolver'
 require 'dnssd/record'
+require 'dnssd/record_set'
+require 'dnssd/trace'
 
@@ -0,0 +1,241 @@
+require 'thread'
+
+##
+# DNSSD::AddressCache caches the replies of DNSSD::Service.getaddrinfo for
+# their TTL so connecting to the same host again doesn't wait on the daemon.
+# Entries are keyed by host, protocol and interface.
+#
+# When several threads look up the same missing host at once only one asks
+# the daemon and the rest wait for its answer.  An entry used after
+# #refresh_ahead of its TTL has passed is looked up again on a background
+# thread while the cached answer keeps being served, so a host in steady use
+# never misses.
+#
+#   cache = DNSSD::AddressCache.instance
+#   cache.addresses 'example.local.' # => ["192.0.2.7"]
+#   cache.stats # => { hits: 0, misses: 1, coalesced: 0, refreshes: 0, size: 1 }
+#
+# DNSSD::Reply::Resolve#connect uses the shared cache.
+
+class DNSSD::AddressCache
+
+  @instance      = nil
+  @instance_lock = Mutex.new
+
+  ##
+  # The cache shared by the whole process.  A new cache is created after
+  # fork since refresh threads do not survive it.
+
+  def self.instance
+    @instance_lock.synchronize do
+      @instance = new if @instance.nil? or @instance.pid != Process.pid
+      @instance
+    end
+  end
+
+  ##
+  # The process the cache was created in
+
+  attr_reader :pid # :nodoc:
+
+  ##
+  # Seconds to wait for the second address family once the first has
+  # arrived, when both are looked up
+
+  attr_reader :grace
+
+  ##
+  # The fraction of an entry's TTL left when it is refreshed
+
+  attr_reader :refresh_ahead
+
+  ##
+  # Seconds to wait for the daemon to answer a lookup
+
+  attr_reader :timeout
+
+  ##
+  # Creates a cache that waits +timeout+ seconds for lookups, +grace+
+  # seconds for the second address family and refreshes entries used in the
+  # last +refresh_ahead+ of their TTL
+
+  def initialize timeout = 5, refresh_ahead = 0.2, grace = 0.1
+    @pid           = Process.pid
+    @timeout       = timeout
+    @refresh_ahead = refresh_ahead
+    @grace         = grace
+    @lock          = Mutex.new
+    @looked_up     = ConditionVariable.new
+    @entries       = {} # key => [replies, expires, refresh_at]
+    @pending       = {} # key => true while a lookup runs
+    @hits          = 0
+    @misses        = 0
+    @coalesced     = 0
+    @refreshes     = 0
+  end
+
+  ##
+  # The addresses of +host+, see #fetch
+
+  def addresses host, protocol = 0, interface = DNSSD::InterfaceAny
+    fetch(host, protocol, interface).map { |addrinfo| addrinfo.address }
+  end
+
+  ##
+  # Removes every entry
+
+  def clear
+    @lock.synchronize { @entries.clear }
+    self
+  end
+
+  ##
+  # Returns a frozen Array of the DNSSD::Reply::AddrInfo replies for +host+
+  # on +protocol+ (see DNSSD::Service.getaddrinfo) and +interface+.  The
+  # cached replies are returned until the shortest of their TTLs passes.
+  # Returns an empty Array if the daemon found no address in #timeout
+  # seconds.
+
+  def fetch host, protocol = 0, interface = DNSSD::InterfaceAny
+    key    = [host, protocol, interface]
+    waited = false
+
+    @lock.synchronize do
+      loop do
+        replies, expires, refresh_at = @entries[key]
+        now = DNSSD.clock_time
+
+        if replies and expires > now then
+          @hits += 1 unless waited
+          refresh key if refresh_at <= now and not @pending.key? key
+          return replies
+        end
+
+        @entries.delete key if replies
+
+        break unless @pending.key? key
+
+        @coalesced += 1 unless waited
+        waited = true
+        @looked_up.wait @lock
+      end
+
+      @misses += 1 unless waited
+      @pending[key] = true
+    end
+
+    begin
+      replies = lookup(*key)
+
+      @lock.synchronize { store key, replies }
+    ensure
+      @lock.synchronize do
+        @pending.delete key
+        @looked_up.broadcast
+      end
+    end
+
+    replies
+  end
+
+  ##
+  # Removes the entry for +host+ on +protocol+ and +interface+ so the next
+  # #fetch asks the daemon, for when its cached addresses turned out to be
+  # stale.  Returns true if there was an entry.
+
+  def invalidate host, protocol = 0, interface = DNSSD::InterfaceAny
+    @lock.synchronize { !@entries.delete([host, protocol, interface]).nil? }
+  end
+
+  ##
+  # Returns a Hash of counters: cache +hits+, +misses+ that asked the
+  # daemon, misses +coalesced+ into another thread's lookup, background
+  # +refreshes+ started and the number of entries (+size+)
+
+  def stats
+    @lock.synchronize do
+      {
+        hits:      @hits,
+        misses:    @misses,
+        coalesced: @coalesced,
+        refreshes: @refreshes,
+        size:      @entries.length,
+      }
+    end
+  end
+
+  private
+
+  ##
+  # Asks the daemon for the addresses of +host+ and returns the replies.
+  # When both families are asked for each arrives in its own burst, so a
+  # first burst of one family waits up to #grace seconds for the other
+  # instead of caching half of the answer.
+
+  def lookup host, protocol, interface
+    service = DNSSD::Service.getaddrinfo host, protocol, 0, interface
+
+    return service.to_a.freeze if Array === service
+
+    replies = []
+
+    read_burst service, @timeout, replies
+
+    families = replies.map { |addrinfo| addrinfo.addrinfo.afamily }.uniq
+
+    read_burst service, @grace, replies if
+      protocol.zero? and families.length == 1
+
+    replies.freeze
+  ensure
+    service.stop if DNSSD::Service === service and service.started?
+  end
+
+  ##
+  # Adds the addresses in the next burst of replies from +service+ to
+  # +replies+, waiting up to +timeout+ seconds for it
+
+  def read_burst service, timeout, replies
+    service.each timeout do |addrinfo|
+      replies << addrinfo if addrinfo.flags.add?
+      break unless addrinfo.flags.more_coming?
+    end
+  end
+
+  ##
+  # Looks +key+ up again on a background thread.  Called with the lock held.
+
+  def refresh key
+    @pending[key] = true
+    @refreshes += 1
+
+    Thread.new do
+      begin
+        replies = lookup(*key)
+
+        @lock.synchronize { store key, replies }
+      rescue StandardError # the old entry expires as usual
+      ensure
+        @lock.synchronize do
+          @pending.delete key
+          @looked_up.broadcast
+        end
+      end
+    end
+  end
+
+  ##
+  # Caches +replies+ for +key+ for the shortest of their TTLs.  Called with
+  # the lock held.
+
+  def store key, replies
+    ttl = replies.map { |addrinfo| addrinfo.ttl.to_i }.min
+
+    return unless ttl and ttl > 0
+
+    now = DNSSD.clock_time
+
+    @entries[key] = [replies, now + ttl, now + ttl * (1 - @refresh_ahead)]
+  end
+
+end
@@ -0,0 +1,155 @@
+require 'thread'
+
+##
+# Merges updates that arrive faster than #interval.  The first update is sent
+# at once, later ones within #interval of the last send replace each other
+# and only the newest is sent once the interval has passed.  Used by
+# DNSSD::Record#update_interval= and
+# DNSSD::Service::Register#text_record_update_interval= so publishing a
+# frequently changing value doesn't flood the network.
+
+class DNSSD::Coalescer
+
+  ##
+  # Seconds between sends
+
+  attr_reader :interval
+
+  ##
+  # Updates replaced by a newer one before they were sent
+
+  attr_reader :merged
+
+  ##
+  # Updates sent
+
+  attr_reader :sent
+
+  ##
+  # Creates a coalescer that calls +sender+ with an update at most once per
+  # +interval+ seconds
+
+  def initialize interval, &sender
+    raise ArgumentError, 'sender block required' unless sender
+
+    @interval  = interval
+    @sender    = sender
+    @lock      = Mutex.new
+    @pending   = nil
+    @scheduled = false
+    @due       = nil
+    @last_sent = nil
+    @thread    = nil
+    @merged    = 0
+    @sent      = 0
+  end
+
+  ##
+  # Drops the update waiting to be sent, if any
+
+  def cancel
+    thread = @lock.synchronize do
+      @pending   = nil
+      @scheduled = false
+      @thread
+    end
+
+    thread.wakeup if thread and thread != Thread.current and thread.alive?
+  rescue ThreadError # the thread already finished
+  end
+
+  ##
+  # Sends the update waiting to be sent now.  Returns true if there was one.
+
+  def flush
+    update = @lock.synchronize do
+      next unless @scheduled
+
+      @scheduled = false
+      @last_sent = DNSSD.clock_time
+      update, @pending = @pending, nil
+      update
+    end
+
+    return false unless update
+
+    send_update update
+
+    true
+  end
+
+  ##
+  # Is an update waiting to be sent?
+
+  def pending?
+    @lock.synchronize { @scheduled }
+  end
+
+  ##
+  # Sends +update+ now if #interval has passed since the last send, otherwise
+  # keeps it to send when it has, replacing any update already waiting.
+
+  def push update
+    now = DNSSD.clock_time
+
+    send_now = @lock.synchronize do
+      if @scheduled then
+        @merged += 1
+        @pending = update
+        next false
+      end
+
+      if @last_sent.nil? or now - @last_sent >= @interval then
+        @last_sent = now
+        next true
+      end
+
+      @pending   = update
+      @scheduled = true
+      schedule @last_sent + @interval
+      false
+    end
+
+    send_update update if send_now
+
+    self
+  end
+
+  private
+
+  ##
+  # Flushes at +due+ on a background thread.  Called with the lock held.
+
+  def schedule due
+    @due = due
+
+    @thread ||= Thread.new do
+      loop do
+        remaining = @lock.synchronize do
+          next @thread = nil unless @scheduled
+
+          @due - DNSSD.clock_time
+        end
+
+        break unless remaining
+
+        if remaining > 0 then
+          sleep remaining
+          next
+        end
+
+        begin
+          flush
+        rescue DNSSD::Error # the record or service went away
+          cancel
+        end
+      end
+    end
+  end
+
+  def send_update update
+    @sender.call update
+    @lock.synchronize { @sent += 1 }
+  end
+
+end
@@ -0,0 +1,327 @@
+require 'thread'
+
+##
+# A DNSSD::Connection is a single connection to the DNS-SD daemon that many
+# services can share.  Services started on a connection are subordinates of
+# its socket, so thousands of browses and resolves cost one file descriptor
+# and one processing loop instead of one of each per service.
+#
+# Replies are delivered to the block given when each service was started while
+# #process (or #async_process) is running:
+#
+#   connection = DNSSD::Connection.new
+#
+#   connection.browse '_http._tcp' do |browse|
+#     next unless browse.flags.add?
+#
+#     connection.resolve browse do |resolve|
+#       puts "#{resolve.name} at #{resolve.target}:#{resolve.port}"
+#       resolve.service.stop
+#     end
+#   end
+#
+#   connection.process 10
+#   connection.close
+#
+# A service started on a connection can't be iterated with
+# DNSSD::Service#each, stop it with DNSSD::Service#stop when you no longer
+# need its replies.
+
+class DNSSD::Connection
+
+  ##
+  # Opens a new connection to the daemon
+
+  def initialize
+    @continue = true
+    @reactor  = nil
+    @io       = nil
+    @lock       = Mutex.new
+    @services   = {}
+    @ready      = []
+    @records    = {}
+    @registered = []
+
+    _create
+  end
+
+  ##
+  # Browses for +type+ on this connection, see DNSSD::Service.browse
+
+  def browse type, domain = nil, flags = 0, interface = DNSSD::InterfaceAny,
+             &block
+    start block do
+      DNSSD::Service.browse type, domain, flags, interface, self
+    end
+  end
+
+  ##
+  # Enumerates domains on this connection, see
+  # DNSSD::Service.enumerate_domains
+
+  def enumerate_domains flags = DNSSD::Flags::BrowseDomains,
+                        interface = DNSSD::InterfaceAny, &block
+    start block do
+      DNSSD::Service.enumerate_domains flags, interface, self
+    end
+  end
+
+  ##
+  # Looks up the addresses of +host+ on this connection, see
+  # DNSSD::Service.getaddrinfo
+
+  def getaddrinfo host, protocol = 0, flags = 0,
+                  interface = DNSSD::InterfaceAny, &block
+    start block do
+      DNSSD::Service.getaddrinfo host, protocol, flags, interface, self
+    end
+  end
+
+  ##
+  # Queries for a DNS record on this connection, see
+  # DNSSD::Service.query_record
+
+  def query_record fullname, record_type, record_class = DNSSD::Record::IN,
+                   flags = 0, interface = DNSSD::InterfaceAny, &block
+    start block do
+      DNSSD::Service.query_record fullname, record_type, record_class, flags,
+                                  interface, self
+    end
+  end
+
+  ##
+  # Registers a service on this connection, see DNSSD::Service.register
+
+  def register name, type, domain, port, host = nil, text_record = nil,
+               flags = 0, interface = DNSSD::InterfaceAny, &block
+    start block do
+      DNSSD::Service.register name, type, domain, port, host, text_record,
+                              flags, interface, self
+    end
+  end
+
+  ##
+  # Registers a single resource record on this connection.  Unlike
+  # DNSSD::Service::Register#add_record the record doesn't belong to a
+  # registered service, so many records cost one daemon socket.
+  #
+  # +fullname+ is the full domain name of the record and +data+ its rdata,
+  # see DNSSD::Record.to_data.  +flags+ must include DNSSD::Flags::Shared or
+  # DNSSD::Flags::Unique.
+  #
+  # The request is sent without waiting for the daemon.  Its answer is
+  # yielded to the block as the record and nil, or the record and a
+  # DNSSD::Error, while the connection is processed.  Requests made back to
+  # back are pipelined.  A record the daemon refused is forgotten once its
+  # error has been yielded.
+  #
+  # Returns the DNSSD::Record, which stays registered until #remove_record or
+  # #close.
+
+  def register_record fullname, type, data, ttl = 0,
+                      flags = DNSSD::Flags::Shared,
+                      interface = DNSSD::InterfaceAny,
+                      record_class = DNSSD::Record::IN, &block
+    interface = DNSSD.interface_index interface unless Integer === interface
+
+    @lock.synchronize do
+      record = _register_record flags.to_i, interface, fullname, type,
+                                record_class, data, ttl
+      @records[record] = block
+      record
+    end
+  end
+
+  ##
+  # Deregisters +record+ from #register_record, see DNSSD::Record#remove.
+  # Returns false if it was already removed.
+
+  def remove_record record
+    record.remove
+  end
+
+  ##
+  # Called by DNSSD::Record#remove
+
+  def record_removed record # :nodoc:
+    @lock.synchronize { @records.delete record }
+  end
+
+  ##
+  # Resolves a service on this connection, see DNSSD::Service.resolve
+
+  def resolve name, type = name.type, domain = name.domain, flags = 0,
+              interface = DNSSD::InterfaceAny, &block
+    start block do
+      DNSSD::Service.resolve name, type, domain, flags, interface, self
+    end
+  end
+
+  ##
+  # Reads replies from the daemon and delivers them to the block of the
+  # service they belong to until +timeout+ seconds pass or the connection is
+  # closed.  Like DNSSD::Service#each, waiting goes through the Fiber
+  # scheduler when there is one.
+
+  def process timeout = :never
+    raise DNSSD::Error, 'connection is closed' unless @continue
+
+    deadline = DNSSD.clock_time + timeout unless timeout == :never
+
+    while @continue
+      remaining = deadline - DNSSD.clock_time if deadline
+      break if remaining and remaining <= 0
+
+      read_replies remaining
+    end
+
+    self
+  end
+
+  ##
+  # Processes replies on the process-wide DNSSD::Reactor thread until the
+  # connection is closed or +timeout+ seconds have passed.  Returns
+  # immediately.
+
+  def async_process timeout = :never
+    raise DNSSD::Error, 'connection is closed' unless @continue
+
+    @reactor = DNSSD::Reactor.instance
+    @reactor.add self, timeout
+
+    self
+  end
+
+  ##
+  # The daemon socket of this connection as an IO, see DNSSD::Service#to_io
+
+  def to_io
+    @io ||= IO.for_fd ref_sock_fd, autoclose: false
+  end
+
+  ##
+  # Returns true if the connection has not been closed.
+
+  def open?
+    @continue
+  end
+
+  ##
+  # Stops every service started on this connection, drops the records it
+  # registered and closes the daemon socket.
+
+  def close
+    raise DNSSD::Error, 'connection is already closed' unless open?
+    @continue = false
+    @reactor.remove self if @reactor
+
+    services = @lock.synchronize do
+      @records.clear
+      @services.keys
+    end
+    services.each { |service| service.stop if service.started? }
+
+    _close
+    self
+  end
+
+  ##
+  # Called by the daemon's answer to #register_record
+
+  def record_registered record, error # :nodoc:
+    @lock.synchronize { @registered << [record, error] }
+  end
+
+  ##
+  # Called by a DNSSD::Service when its first pending reply arrives
+
+  def ready service # :nodoc:
+    @lock.synchronize { @ready << service }
+  end
+
+  ##
+  # Waits up to +timeout+ seconds for the daemon, then delivers the replies it
+  # sent.  Returns false if nothing arrived or was delivered.
+
+  def read_replies timeout # :nodoc:
+    # replies the last dispatch left waiting are delivered without waiting
+    waiting = replies_waiting?
+    timeout = 0 if waiting
+
+    begin
+      read = process_result timeout
+    rescue DNSSD::UnknownError
+      read = true
+    end
+
+    return false unless read or waiting
+
+    dispatch
+
+    true
+  end
+
+  ##
+  # True if a service has replies waiting to be delivered
+
+  def replies_waiting? # :nodoc:
+    @lock.synchronize { not @ready.empty? }
+  end
+
+  ##
+  # Called by DNSSD::Service#stop
+
+  def remove service # :nodoc:
+    @lock.synchronize { @services.delete service }
+  end
+
+  private
+
+  ##
+  # Delivers the replies of every service that received some in the last
+  # process_result.  Replies read while delivering, see
+  # DNSSD::Service#limit_replies, are left for the next call so a busy
+  # daemon can't keep #process from checking its deadline.
+
+  def dispatch
+    ready, registered = @lock.synchronize do
+      ready,      @ready      = @ready,      []
+      registered, @registered = @registered, []
+      [ready, registered]
+    end
+
+    ready.each do |service|
+      block = @lock.synchronize { @services[service] }
+
+      service.drain_replies(&block)
+    end
+
+    registered.each do |record, error|
+      block = @lock.synchronize do
+        error ? @records.delete(record) : @records[record]
+      end
+
+      block.call record, error if block
+    end
+
+    left = ready.select { |service| service.replies_waiting? }
+
+    @lock.synchronize { @ready |= left } unless left.empty?
+  end
+
+  ##
+  # Starts the service returned by the given block and registers +callback+
+  # for its replies.  The lock is held so #dispatch can't see the service's
+  # first replies before +callback+ is known.
+
+  def start callback
+    raise ArgumentError, 'block required' unless callback
+
+    @lock.synchronize do
+      service = yield
+      @services[service] = callback
+      service
+    end
+  end
+
+end
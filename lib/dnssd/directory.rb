@@ -0,0 +1,382 @@
+require 'thread'
+
+##
+# A DNSSD::Directory is a live index of the services found by browsing one or
+# more service types.  Each instance is resolved and its target's addresses
+# are looked up as soon as it is found, and the results are kept up to date
+# as the daemon reports changes, so looking a service up never waits on the
+# daemon:
+#
+#   directory = DNSSD::Directory.new
+#   directory.watch '_http._tcp'
+#   directory.start
+#
+#   # later, on the request path
+#   entry = directory['_http._tcp', 'My Web Server']
+#   entry.addresses # => ["192.0.2.7"] once resolved
+#
+# All browses, resolves and address lookups share one DNSSD::Connection.
+# #start processes it on the DNSSD::Reactor thread, or call #process to do it
+# yourself.  Lookups may be made from any thread.  They return frozen
+# entries, so look a service up again to see later changes.
+
+class DNSSD::Directory
+  include Enumerable
+
+  ##
+  # A service instance on one interface.  The browse result is available
+  # immediately, #target, #port and #text_record once it resolves and
+  # #addresses once the target's addresses arrive.
+  #
+  # An entry is frozen.  Each change replaces it in the directory with an
+  # updated copy, so a target is never seen with another target's port or
+  # addresses.
+
+  class Entry
+
+    ##
+    # The service domain
+
+    attr_reader :domain
+
+    ##
+    # The full service domain name, see DNSSD::Reply#fullname
+
+    attr_reader :fullname
+
+    ##
+    # The interface the service was found on
+
+    attr_reader :interface
+
+    ##
+    # The service name
+
+    attr_reader :name
+
+    ##
+    # The port of the service, nil until resolved
+
+    attr_reader :port
+
+    ##
+    # The host providing the service, nil until resolved
+
+    attr_reader :target
+
+    ##
+    # The DNSSD::TextRecord of the service, nil until resolved
+
+    attr_reader :text_record
+
+    ##
+    # The service type
+
+    attr_reader :type
+
+    def initialize browse # :nodoc:
+      @domain      = browse.domain
+      @fullname    = browse.fullname
+      @interface   = browse.interface || DNSSD::InterfaceAny
+      @name        = browse.name
+      @type        = browse.type
+      @port        = nil
+      @target      = nil
+      @text_record = nil
+      @addresses   = {}.freeze
+
+      freeze
+    end
+
+    ##
+    # The addresses of #target whose TTL has not expired
+
+    def addresses
+      now = DNSSD.clock_time
+
+      @addresses.select { |_, expires| expires > now }.keys
+    end
+
+    ##
+    # Has this entry been resolved?
+
+    def resolved?
+      !@target.nil?
+    end
+
+    def inspect # :nodoc:
+      "#<%s:0x%x %p %s:%p interface: %s addresses: %p>" % [
+        self.class, object_id, fullname, target, port, interface, addresses
+      ]
+    end
+
+    ##
+    # Returns a copy of this entry with the result of resolve +reply+.  The
+    # addresses are dropped if the target changed.
+
+    def resolved reply # :nodoc:
+      addresses = @target == reply.target ? @addresses : {}.freeze
+
+      dup.update reply.target, reply.port, reply.text_record, addresses
+    end
+
+    ##
+    # Returns a copy of this entry with the address in +reply+ added or
+    # removed
+
+    def address reply # :nodoc:
+      if reply.flags.add? then
+        expires   = DNSSD.clock_time + reply.ttl
+        addresses = @addresses.merge(reply.address => expires)
+      else
+        addresses = @addresses.dup
+        addresses.delete reply.address
+      end
+
+      dup.update @target, @port, @text_record, addresses.freeze
+    end
+
+    protected
+
+    ##
+    # Sets the resolved fields of a copy and freezes it
+
+    def update target, port, text_record, addresses # :nodoc:
+      @target      = target
+      @port        = port
+      @text_record = text_record
+      @addresses   = addresses
+
+      freeze
+    end
+
+  end
+
+  ##
+  # The DNSSD::Connection used for browsing and resolving
+
+  attr_reader :connection
+
+  ##
+  # Creates a directory that talks to the daemon over +connection+
+
+  def initialize connection = DNSSD::Connection.new
+    @connection = connection
+    @lock       = Mutex.new
+    @entries    = {} # [fullname, interface] => Entry
+    @index      = Hash.new { |h, type| h[type] = {} } # type => name => Entries
+    @lookups    = {} # [fullname, interface] => [resolve, getaddrinfo]
+  end
+
+  ##
+  # Returns an entry for service +name+ of +type+ or nil if there is none.
+  # A resolved entry is returned in preference to one still resolving.
+
+  def [] type, name
+    entries = lookup type, name
+
+    entries.find { |entry| entry.resolved? } || entries.first
+  end
+
+  ##
+  # Stops every browse, resolve and address lookup and closes the connection
+
+  def close
+    @connection.close
+    self
+  end
+
+  ##
+  # Yields each entry
+
+  def each
+    entries = @lock.synchronize { @entries.values }
+
+    entries.each { |entry| yield entry }
+  end
+
+  ##
+  # Returns every entry of +type+
+
+  def instances type
+    type = normalize_type type
+
+    @lock.synchronize do
+      services = @index.fetch type, {}
+      services.values.flatten
+    end
+  end
+
+  ##
+  # Returns the entries for service +name+ of +type+, one per interface and
+  # domain it was found on
+
+  def lookup type, name
+    type = normalize_type type
+
+    @lock.synchronize do
+      services = @index.fetch type, nil
+      entries  = services[name] if services
+      entries ? entries.dup : []
+    end
+  end
+
+  ##
+  # Processes replies from the daemon for +timeout+ seconds, see
+  # DNSSD::Connection#process
+
+  def process timeout = :never
+    @connection.process timeout
+    self
+  end
+
+  ##
+  # Processes replies from the daemon on the DNSSD::Reactor thread, see
+  # DNSSD::Connection#async_process
+
+  def start timeout = :never
+    @connection.async_process timeout
+    self
+  end
+
+  ##
+  # Browses for services of +type+ in +domain+ on +interface+ and adds them
+  # to the directory
+
+  def watch type, domain = nil, interface = DNSSD::InterfaceAny
+    @connection.browse type, domain, 0, interface do |reply|
+      browsed reply
+    end
+
+    self
+  end
+
+  private
+
+  ##
+  # Adds or removes the service in browse +reply+.  Added services are
+  # resolved.
+
+  def browsed reply
+    key = [reply.fullname, reply.interface]
+
+    if reply.flags.add? then
+      entry = @lock.synchronize do
+        next if @entries.key? key
+
+        entry = Entry.new reply
+        @entries[key] = entry
+        (@index[entry.type][entry.name] ||= []) << entry
+        entry
+      end
+
+      resolve key, entry, reply if entry
+    else
+      removed = @lock.synchronize do
+        entry = @entries.delete key
+        next unless entry
+
+        entries = @index[entry.type][entry.name]
+        entries.delete entry
+        @index[entry.type].delete entry.name if entries.empty?
+        true
+      end
+
+      stop_lookups key if removed
+    end
+  end
+
+  ##
+  # Adds or removes the address in +reply+ to the entry for +key+
+
+  def address key, reply
+    @lock.synchronize do
+      entry = @entries[key]
+      publish key, entry, entry.address(reply) if entry
+    end
+  end
+
+  ##
+  # Replaces +old+, the entry for +key+, with its updated copy +entry+.  Call
+  # with the lock held.
+
+  def publish key, old, entry
+    @entries[key] = entry
+
+    entries = @index[entry.type][entry.name]
+    entries[entries.index { |e| e.equal? old }] = entry
+  end
+
+  ##
+  # Attaches resolve +reply+ to the entry for +key+ and looks up the
+  # addresses of its target
+
+  def resolved key, reply
+    entry, changed = @lock.synchronize do
+      old = @entries[key]
+      next unless old and @lookups.key? key
+
+      entry = old.resolved reply
+      publish key, old, entry
+
+      [entry, old.target != entry.target]
+    end
+
+    return unless changed
+
+    lookups = @lock.synchronize { @lookups[key] }
+    lookups[1].stop if lookups and lookups[1] and lookups[1].started?
+
+    getaddrinfo = @connection.getaddrinfo reply.target, 0, 0,
+                                          entry.interface do |addrinfo|
+      address key, addrinfo
+    end
+
+    @lock.synchronize do
+      if @lookups.key? key then
+        @lookups[key][1] = getaddrinfo
+      else
+        getaddrinfo.stop
+      end
+    end
+  end
+
+  ##
+  # Removes the trailing "." the daemon may leave on +type+
+
+  def normalize_type type
+    type.end_with?('.') ? type.chomp('.') : type
+  end
+
+  ##
+  # Starts resolving +entry+ for +key+ found in browse +reply+
+
+  def resolve key, entry, reply
+    @lock.synchronize { @lookups[key] = [] }
+
+    resolve = @connection.resolve reply.name, reply.type, reply.domain, 0,
+                                  entry.interface do |r|
+      resolved key, r
+    end
+
+    @lock.synchronize do
+      if @lookups.key? key then
+        @lookups[key][0] = resolve
+      else
+        resolve.stop
+      end
+    end
+  end
+
+  ##
+  # Stops resolving and looking up addresses for the entry for +key+
+
+  def stop_lookups key
+    lookups = @lock.synchronize { @lookups.delete key }
+
+    lookups.each do |service|
+      service.stop if service and service.started?
+    end if lookups
+  end
+
+end
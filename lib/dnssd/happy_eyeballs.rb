@@ -0,0 +1,267 @@
+require 'socket'
+
+##
+# Connects to the first of many addresses that answers, following Happy
+# Eyeballs (RFC 8305).  Connection attempts are non-blocking and started
+# #attempt_delay seconds apart, alternating between IPv6 and IPv4 addresses
+# and starting with IPv6, so one address that doesn't answer delays the
+# connection by #attempt_delay instead of the operating system's connect
+# timeout.  The first attempt to succeed wins and the others are closed.
+#
+# Addresses may be given up front or read from a DNSSD::Service started by
+# DNSSD::Service.getaddrinfo as they arrive.  The service is read until a
+# connection is made, so addresses arriving after earlier ones are still
+# tried.  If an IPv4 address arrives first the connection waits up to
+# #resolution_delay for an IPv6 address.
+#
+#   happy = DNSSD::HappyEyeballs.new 80
+#   socket = happy.connect %w[2001:db8::7 192.0.2.7]
+#
+# See also DNSSD::Reply::Resolve#connect
+
+class DNSSD::HappyEyeballs
+
+  ##
+  # Seconds between starting connection attempts
+
+  attr_reader :attempt_delay
+
+  ##
+  # The port to connect to
+
+  attr_reader :port
+
+  ##
+  # Seconds to wait for an IPv6 address after an IPv4 address arrives
+
+  attr_reader :resolution_delay
+
+  ##
+  # Creates a connector for +port+.  The RFC recommends 0.25 seconds for
+  # +attempt_delay+ and 0.05 seconds for +resolution_delay+.
+
+  def initialize port, attempt_delay = 0.25, resolution_delay = 0.05
+    @port             = port
+    @attempt_delay    = attempt_delay
+    @resolution_delay = resolution_delay
+  end
+
+  ##
+  # Connects to one of the addresses from +source+ and returns the connected
+  # TCPSocket.  +source+ is an Array of IP address Strings or Addrinfo, or a
+  # started DNSSD::Service.getaddrinfo service, which is stopped when the
+  # connection is made.
+  #
+  # Raises the error of the last attempt if every attempt fails, or
+  # Errno::ETIMEDOUT if no attempt succeeds within +timeout+ seconds.  With a
+  # service and a +timeout+, running out of addresses waits for more until
+  # +timeout+ passes.  Without a +timeout+ it gives up once the service has
+  # sent a complete burst of replies.
+
+  def connect source, timeout = nil
+    if Array === source then
+      state = Attempts.new false
+      source.each { |address| state.add address }
+      state.resolved = true
+    else
+      state = Attempts.new true
+      service = source
+    end
+
+    deadline = DNSSD.clock_time + timeout if timeout
+
+    loop do
+      now = DNSSD.clock_time
+
+      if deadline and now >= deadline then
+        raise state.error if state.error and state.idle?
+        raise Errno::ETIMEDOUT, "connect to port #{@port}"
+      end
+
+      if state.startable? now, @resolution_delay and
+         state.next_attempt <= now then
+        state.next_attempt = now + @attempt_delay
+        start_attempt state
+      end
+
+      if state.exhausted? and not (service and deadline) then
+        raise state.error if state.error
+        raise SocketError, 'no addresses to connect to'
+      end
+
+      readers = []
+      readers << service.to_io if service and service.started?
+
+      wait = [
+        (state.next_attempt if state.startable? now, @resolution_delay),
+        (state.first_ipv4 + @resolution_delay if state.waiting_for_ipv6?),
+        deadline,
+      ].compact.min
+      wait = [wait - now, 0].max if wait
+
+      readable, writable, = IO.select readers, state.sockets, nil, wait
+
+      read_addresses service, state if readable and not readable.empty?
+
+      (writable || []).each do |socket|
+        next unless finish_attempt state, socket
+
+        state.sockets.delete socket
+        service.stop if service and service.started?
+        return to_tcp_socket socket
+      end
+    end
+  ensure
+    state.close_all if state
+  end
+
+  ##
+  # The progress of a #connect
+
+  class Attempts # :nodoc:
+    attr_accessor :error, :first_ipv4, :next_attempt, :resolved
+    attr_reader :sockets
+
+    ##
+    # +streaming+ is true when addresses arrive from a service, so more IPv6
+    # addresses may follow the first IPv4 address.
+
+    def initialize streaming = false
+      @error        = nil
+      @first_ipv4   = nil
+      @ipv4         = []
+      @ipv6         = []
+      @last_family  = nil
+      @next_attempt = 0
+      @resolved     = false
+      @sockets      = []
+      @streaming    = streaming
+    end
+
+    def add address
+      addrinfo = Addrinfo === address ? address : Addrinfo.ip(address)
+
+      if addrinfo.ipv6? then
+        @ipv6 << addrinfo
+      else
+        @first_ipv4 ||= DNSSD.clock_time
+        @ipv4 << addrinfo
+      end
+    end
+
+    def close_all
+      @sockets.each { |socket| socket.close unless socket.closed? }
+      @sockets.clear
+    end
+
+    ##
+    # Nothing is left to try
+
+    def exhausted?
+      @resolved and idle?
+    end
+
+    ##
+    # No address is waiting and no attempt is in progress
+
+    def idle?
+      @ipv4.empty? and @ipv6.empty? and @sockets.empty?
+    end
+
+    ##
+    # The next address, alternating between families starting with IPv6
+
+    def shift
+      family = if @ipv6.empty? then :ipv4
+               elsif @ipv4.empty? then :ipv6
+               elsif @last_family == :ipv6 then :ipv4
+               else :ipv6
+               end
+
+      @last_family = family
+
+      family == :ipv6 ? @ipv6.shift : @ipv4.shift
+    end
+
+    ##
+    # Is there an address to try that isn't held back by the resolution
+    # delay?
+
+    def startable? now, resolution_delay
+      return false if @ipv4.empty? and @ipv6.empty?
+      return false if waiting_for_ipv6? and now < @first_ipv4 + resolution_delay
+
+      true
+    end
+
+    ##
+    # Only IPv4 addresses have arrived from a service and no attempt has
+    # started.  A complete burst of IPv4 replies may still be followed by
+    # IPv6 replies, so this doesn't depend on #resolved.
+
+    def waiting_for_ipv6?
+      @streaming and @ipv6.empty? and @last_family.nil? and @first_ipv4
+    end
+  end
+
+  private
+
+  ##
+  # Adds the addresses +service+ has received to +state+
+
+  def read_addresses service, state
+    service.read_replies 0 do |addrinfo|
+      state.add addrinfo.addrinfo @port if addrinfo.flags.add?
+      state.resolved = true unless addrinfo.flags.more_coming?
+    end
+  end
+
+  ##
+  # Starts a non-blocking connection attempt to the next address.  If it
+  # fails the next attempt may start without waiting for the attempt delay.
+
+  def start_attempt state
+    addrinfo = state.shift
+    sockaddr = if addrinfo.ip_port == @port then
+                 addrinfo
+               else
+                 Addrinfo.tcp addrinfo.ip_address, @port
+               end
+    socket   = Socket.new sockaddr.afamily, Socket::SOCK_STREAM
+
+    # a connection made at once is finished by the next select
+    socket.connect_nonblock sockaddr, exception: false
+    state.sockets << socket
+  rescue SystemCallError => e
+    socket.close if socket
+    state.error = e
+    state.next_attempt = 0
+  end
+
+  ##
+  # Checks the attempt on writable +socket+.  Returns true if it connected,
+  # otherwise closes it.
+
+  def finish_attempt state, socket
+    error = socket.getsockopt(Socket::SOL_SOCKET, Socket::SO_ERROR).int
+
+    return true if error.zero?
+
+    state.sockets.delete socket
+    socket.close
+    state.error = SystemCallError.new "connect to port #{@port}", error
+    state.next_attempt = 0
+
+    false
+  end
+
+  ##
+  # Converts +socket+ to a TCPSocket as returned by TCPSocket.new
+
+  def to_tcp_socket socket
+    tcp = TCPSocket.for_fd socket.fileno
+    socket.autoclose = false
+    tcp
+  end
+
+end
@@ -0,0 +1,236 @@
+require 'thread'
+
+##
+# DNSSD::Reactor delivers the replies of every asynchronous service in the
+# process from a single thread.  DNSSD::Service#async_each and
+# DNSSD::Connection#async_process add themselves to the reactor instead of
+# starting a thread each, so watching thousands of service types costs one
+# thread and one epoll set.
+#
+# Blocks run on the reactor thread one after another, so a block that takes a
+# long time delays the replies of every other service.  An exception raised by
+# a block removes its service from the reactor and is reported like an
+# exception that ends a Thread.
+#
+# Removing a target from another thread waits until the reactor has finished
+# delivering its replies, so once DNSSD::Service#stop returns its block is no
+# longer running.
+
+class DNSSD::Reactor
+
+  @instance      = nil
+  @instance_lock = Mutex.new
+
+  ##
+  # The reactor shared by the whole process.  A new reactor is created after
+  # fork since the reactor thread does not survive it.
+
+  def self.instance
+    @instance_lock.synchronize do
+      @instance = new if @instance.nil? or @instance.pid != Process.pid
+      @instance
+    end
+  end
+
+  ##
+  # The process the reactor was created in
+
+  attr_reader :pid # :nodoc:
+
+  def initialize # :nodoc:
+    @pid        = Process.pid
+    @lock       = Mutex.new
+    @targets    = {}
+    @deadlines  = {}
+    @thread     = nil
+    @idle       = ConditionVariable.new
+    @delivering = nil
+  end
+
+  ##
+  # Delivers replies for +target+ (a DNSSD::Service or DNSSD::Connection) on
+  # the reactor thread by calling its +reader+ method with +block+.  +target+
+  # is removed after +timeout+ seconds unless +timeout+ is <tt>:never</tt>.
+  # A service is also stopped then since it can't be iterated again, a
+  # connection is left open for the caller to process again or close.
+
+  def add target, timeout = :never, reader = :read_replies, &block
+    fd = target.to_io.fileno
+
+    @lock.synchronize do
+      @targets[fd] = [target, reader, block]
+
+      if timeout == :never then
+        @deadlines.delete fd
+      else
+        @deadlines[fd] = DNSSD.clock_time + timeout
+      end
+
+      _add fd
+      start
+    end
+
+    wakeup unless timeout == :never
+
+    self
+  end
+
+  ##
+  # Returns true if +target+ is receiving replies from this reactor
+
+  def include? target
+    fd = target.to_io.fileno
+
+    @lock.synchronize { added? fd, target }
+  end
+
+  ##
+  # Waits up to +timeout+ seconds (forever if nil) until +target+ is removed
+  # and its replies are no longer being delivered.  Returns nil if +timeout+
+  # passed first, like Thread#join.
+
+  def join target, timeout = nil
+    raise ThreadError, 'joining from the reactor thread would deadlock' if
+      Thread.current.equal? @thread
+
+    fd       = target.to_io.fileno
+    deadline = DNSSD.clock_time + timeout if timeout
+
+    @lock.synchronize do
+      while added? fd, target or @delivering.equal? target
+        if deadline then
+          remaining = deadline - DNSSD.clock_time
+          return if remaining <= 0
+        end
+
+        @idle.wait @lock, remaining
+      end
+    end
+
+    self
+  end
+
+  ##
+  # Stops delivering replies for +target+.  If the reactor thread is
+  # delivering them right now this waits until it is done, unless called
+  # from a block on the reactor thread.  Returns nil if +target+ was not
+  # receiving replies.
+
+  def remove target
+    fd = target.to_io.fileno
+
+    @lock.synchronize do
+      return unless added? fd, target
+
+      @targets.delete fd
+      @deadlines.delete fd
+      _remove fd
+      @idle.broadcast
+
+      @idle.wait @lock while
+        @delivering.equal? target and not Thread.current.equal? @thread
+    end
+
+    self
+  end
+
+  private
+
+  ##
+  # Is +target+ receiving replies for +fd+?  Call with the lock held.
+
+  def added? fd, target
+    entry = @targets[fd]
+    entry and entry.first.equal? target
+  end
+
+  ##
+  # Calls the reader of the target for +fd+.  Returns true if it left
+  # replies waiting, which are delivered on the next pass without waiting
+  # for the socket.
+
+  def deliver fd
+    target, reader, block = @lock.synchronize do
+      entry = @targets[fd]
+      @delivering = entry.first if entry
+      entry
+    end
+
+    return false unless target
+
+    target.send reader, 0, &block
+
+    target.replies_waiting?
+  rescue Exception => e
+    # a target stopped from another thread while its socket was ready
+    report e if remove target
+    false
+  ensure
+    @lock.synchronize do
+      @delivering = nil
+      @idle.broadcast
+    end if target
+  end
+
+  ##
+  # Removes targets whose timeout has passed, stopping services, and returns
+  # the time until the next one expires
+
+  def expire
+    return if @deadlines.empty?
+
+    now = DNSSD.clock_time
+
+    expired = @lock.synchronize do
+      @deadlines.select { |_, deadline| deadline <= now }.map do |fd, _|
+        @targets[fd].first
+      end
+    end
+
+    expired.each do |target|
+      next unless remove target
+
+      begin
+        target.stop if DNSSD::Service === target and target.started?
+      rescue DNSSD::Error # stopped by another thread meanwhile
+      end
+    end
+
+    @lock.synchronize do
+      next_deadline = @deadlines.values.min
+      next_deadline - now if next_deadline
+    end
+  end
+
+  ##
+  # Reports an exception raised by a reply block the way an exception ending
+  # an async_each thread used to be reported
+
+  def report e
+    if Thread.abort_on_exception then
+      Thread.main.raise e
+    elsif !Thread.respond_to?(:report_on_exception) or
+          Thread.report_on_exception then
+      warn "#{self.class} block terminated with exception: #{e.message} (#{e.class})"
+    end
+  end
+
+  def run
+    waiting = []
+
+    loop do
+      timeout = expire
+      timeout = 0 unless waiting.empty?
+
+      waiting = (_wait(timeout) | waiting).select { |fd| deliver fd }
+    end
+  end
+
+  def start
+    return if @thread
+
+    @thread = Thread.new { run }
+    @thread.name = 'dnssd reactor' if @thread.respond_to? :name=
+  end
+
+end
@@ -1,8 +1,14 @@
 require 'ipaddr'
 
 ##
-# Created when adding a DNS record using DNSSD::Service#add_record.  Provides
-# convenience methods for creating the DNS record.
+# Created when adding a DNS record using DNSSD::Service#add_record or
+# DNSSD::Connection#register_record.  Provides convenience methods for
+# creating the DNS record.
+#
+# A record can be changed in place with #update, which doesn't make clients
+# see it disappear and come back as stopping and registering again does, and
+# deregistered with #remove.  A record is only valid while the service it was
+# added to is running, or the connection it was registered on is open.
 #
 # See also {RFC 1035}[http://www.rfc-editor.org/rfc/rfc1035.txt]
 
@@ -93,5 +99,52 @@ class DNSSD::Record
     data
   end
 
+  ##
+  # Seconds updates are coalesced for, see #update_interval=
+
+  def update_interval
+    @coalescer.interval if @coalescer
+  end
+
+  ##
+  # Merges calls to #update made within +interval+ seconds of the last one
+  # sent so only the newest data reaches the daemon, see DNSSD::Coalescer.
+  # Use nil to send every update at once.
+
+  def update_interval= interval
+    @coalescer.flush if @coalescer
+
+    @coalescer = if interval then
+                   DNSSD::Coalescer.new(interval) do |data, ttl|
+                     _update 0, data, ttl
+                   end
+                 end
+  end
+
+  ##
+  # Deregisters this record.  Returns false if it was already removed.
+
+  def remove
+    @coalescer.cancel if @coalescer
+    @connection.record_removed self if @connection
+    @service.record_removed self if @service
+
+    _remove
+  end
+
+  ##
+  # Replaces the data of this record with +data+, see ::to_data.  +ttl+ is in
+  # seconds, use 0 for the default value.
+
+  def update data, ttl = 0
+    if @coalescer then
+      @coalescer.push [data, ttl]
+    else
+      _update 0, data, ttl
+    end
+
+    self
+  end
+
 end
 
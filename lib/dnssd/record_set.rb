@@ -0,0 +1,201 @@
+##
+# A DNSSD::RecordSet registers and deregisters many resource records over one
+# DNSSD::Connection.  DNSSD::Service.register costs a daemon socket per
+# service, so advertising thousands of instances that way means thousands of
+# sockets.  A record set sends every request back to back on a single socket
+# and collects the daemon's answers as they arrive:
+#
+#   records = DNSSD::RecordSet.new
+#
+#   tenants.each do |tenant|
+#     records.add_service tenant.name, '_http._tcp', 'local.',
+#                         'sidecar.local.', tenant.port
+#   end
+#
+#   result = records.register
+#   result.failed.each do |failure|
+#     warn "#{failure.fullname}: #{failure.error.message}"
+#   end
+#
+#   # later
+#   records.deregister
+#
+# The address records of the target host are not registered, use #add for
+# them if the daemon doesn't already publish them.
+
+class DNSSD::RecordSet
+
+  ##
+  # A record that could not be registered and why
+
+  Failure = Struct.new :fullname, :type, :error
+
+  ##
+  # The outcome of #register.  +registered+ holds the DNSSD::Record of each
+  # record the daemon accepted and +failed+ a Failure for the rest.
+
+  Result = Struct.new :registered, :failed do
+
+    ##
+    # Were all records registered?
+
+    def success?
+      failed.empty?
+    end
+
+  end
+
+  ##
+  # The DNSSD::Connection the records are registered on
+
+  attr_reader :connection
+
+  ##
+  # Creates a record set that registers over +connection+.  #register
+  # processes the connection itself, so it must not be processed by
+  # DNSSD::Connection#async_process.
+
+  def initialize connection = DNSSD::Connection.new
+    @connection = connection
+    @pending    = []
+    @records    = {} # DNSSD::Record => [fullname, type]
+  end
+
+  ##
+  # Adds a record to be registered by the next #register, see
+  # DNSSD::Connection#register_record for the arguments
+
+  def add fullname, type, data, ttl = 120, flags = DNSSD::Flags::Shared,
+          interface = DNSSD::InterfaceAny
+    @pending << [fullname, type, data, ttl, flags, interface]
+    self
+  end
+
+  ##
+  # Adds the PTR, SRV and TXT records that advertise service instance +name+
+  # of +type+ in +domain+ at +target+ and +port+.  +text_record+ may be a
+  # DNSSD::TextRecord, a Hash or an already encoded String.
+
+  def add_service name, type, domain, target, port, text_record = nil,
+                  ttl = 120, interface = DNSSD::InterfaceAny
+    domain = 'local.' if domain.nil? or domain.empty?
+    type   = type.chomp '.'
+    domain = "#{domain}." unless domain.end_with? '.'
+
+    label = name.b
+    raise ArgumentError, "#{name.inspect} is too long (63 bytes max)" if
+      label.bytesize > 63
+
+    instance = DNSSD::Service.fullname name, type, domain
+    instance_data = [label.bytesize, label].pack('Ca*') <<
+      DNSSD::Record.string_to_domain_name("#{type}.#{domain}")
+
+    text_record = DNSSD::TextRecord.new text_record if Hash === text_record
+    text_record = text_record.encode if DNSSD::TextRecord === text_record
+    text_record = "\0" if text_record.nil? or text_record.empty?
+
+    srv = DNSSD::Record.to_data DNSSD::Record::SRV, 0, 0, port, target
+
+    add "#{type}.#{domain}", DNSSD::Record::PTR, instance_data, ttl,
+        DNSSD::Flags::Shared, interface
+    add instance, DNSSD::Record::SRV, srv, ttl, DNSSD::Flags::Unique,
+        interface
+    add instance, DNSSD::Record::TXT, text_record, ttl, DNSSD::Flags::Unique,
+        interface
+  end
+
+  ##
+  # Closes the connection, which drops every registered record
+
+  def close
+    @connection.close
+    @records.clear
+    self
+  end
+
+  ##
+  # Deregisters every registered record.  Returns the number deregistered.
+
+  def deregister
+    records = @records.keys
+    @records.clear
+
+    records.count { |record| @connection.remove_record record }
+  end
+
+  ##
+  # The number of registered records
+
+  def length
+    @records.length
+  end
+
+  alias size length
+
+  ##
+  # Records added since the last #register
+
+  def pending
+    @pending.length
+  end
+
+  ##
+  # Sends a registration for every added record, then processes the
+  # connection until the daemon has answered them all or +timeout+ seconds
+  # have passed.  Each answer is yielded as it arrives, as the DNSSD::Record
+  # and nil, or nil and a Failure.  Records not answered in time are removed
+  # and fail with Errno::ETIMEDOUT.
+  #
+  # Returns a Result.
+
+  def register timeout = 5
+    requests, @pending = @pending, []
+    outstanding = {}
+    result      = Result.new [], []
+    deadline    = DNSSD.clock_time + timeout
+
+    requests.each do |fullname, type, data, ttl, flags, interface|
+      begin
+        record = @connection.register_record fullname, type, data, ttl, flags,
+                                             interface do |r, error|
+          next unless request = outstanding.delete(r)
+
+          if error then
+            failure = Failure.new(*request, error)
+            result.failed << failure
+            yield nil, failure if block_given?
+          else
+            @records[r] = request
+            result.registered << r
+            yield r, nil if block_given?
+          end
+        end
+
+        outstanding[record] = [fullname, type]
+      rescue DNSSD::Error, ArgumentError, TypeError => e
+        failure = Failure.new fullname, type, e
+        result.failed << failure
+        yield nil, failure if block_given?
+      end
+    end
+
+    until outstanding.empty? do
+      remaining = deadline - DNSSD.clock_time
+      break if remaining <= 0
+
+      @connection.read_replies remaining
+    end
+
+    outstanding.each do |record, request|
+      @connection.remove_record record
+
+      failure = Failure.new(*request,
+                            Errno::ETIMEDOUT.new("register #{request[0]}"))
+      result.failed << failure
+      yield nil, failure if block_given?
+    end
+
+    result
+  end
+
+end
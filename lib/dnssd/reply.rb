@@ -1,22 +1,46 @@
 ##
 # DNSSD::Reply is used to return information
+#
+# Replies created by the daemon keep its raw data in C.  Each reader builds
+# its Ruby object (a String, DNSSD::Flags, DNSSD::TextRecord, ...) the first
+# time it is called and caches it in the instance variable of the same name,
+# so replies nobody looks at cost little more than an allocation.
 
 class DNSSD::Reply
 
   ##
+  # Defines a reader for +name+ that sets <tt>@name</tt> from +value+, a ruby
+  # expression, the first time it is called.  Replies created in ruby set
+  # their instance variables in initialize so +value+ is never evaluated.
+
+  def self.lazy_reader name, value # :nodoc:
+    class_eval <<-READER, __FILE__, __LINE__ + 1
+      def #{name}
+        @#{name} = #{value} unless defined? @#{name}
+        @#{name}
+      end
+    READER
+  end
+
+  private_class_method :lazy_reader
+
+  ##
+  # :attr_reader: flags
   # Flags for this reply, see DNSSD::Flags
 
-  attr_reader :flags
+  lazy_reader :flags, 'DNSSD::Flags.new _flags'
 
   ##
+  # :attr_reader: interface
   # The interface name for this reply
 
-  attr_reader :interface
+  lazy_reader :interface, 'interface_from _interface'
 
   ##
+  # :attr_reader: service
   # The DNSSD::Service that created this reply
 
-  attr_reader :service
+  lazy_reader :service, '_service'
 
   ##
   # Creates a new reply attached to +service+ with +flags+ on interface index
@@ -25,23 +49,28 @@ class DNSSD::Reply
   def initialize(service, flags, interface)
     @service = service
     @flags = DNSSD::Flags.new flags
-    @interface = if interface then
-                   interface > 0 ? DNSSD.interface_name(interface) : interface
-                 end
+    @interface = interface_from interface
   end
 
   ##
-  # The full service domain name, see DNSS::Service#fullname
+  # The full service domain name, see DNSS::Service#fullname.  It is built
+  # the first time it is needed and cached until #set_fullname or #set_names
+  # changes the names.  The cached String is frozen, dup it to modify it.
 
   def fullname
+    return @fullname if defined? @fullname
+
+    load_names :@name unless defined? @name
+
     fullname = DNSSD::Service.fullname @name.gsub("\032", ' '), @type, @domain
-    fullname << '.' unless fullname =~ /\.$/
-    fullname
+    fullname << '.' unless fullname.end_with? '.'
+
+    @fullname = fullname.freeze
   end
 
   def inspect # :nodoc:
     "#<%s:0x%x interface: %s flags: %p>" % [
-      self.class, object_id, interface_name, @flags
+      self.class, object_id, interface_name, flags
     ]
   end
 
@@ -49,12 +78,12 @@ class DNSSD::Reply
   # Expands the name of the interface including constants
 
   def interface_name
-    case @interface
+    case interface
     when nil                       then 'nil'
     when DNSSD::InterfaceAny       then 'any'
     when DNSSD::InterfaceLocalOnly then 'local'
     when DNSSD::InterfaceUnicast   then 'unicast'
-    else @interface
+    else interface
     end
   end
 
@@ -62,6 +91,8 @@ class DNSSD::Reply
   # Protocol of this service
 
   def protocol
+    load_names :@type unless defined? @type
+
     raise TypeError, 'no type on this reply' unless
       instance_variable_defined? :@type
 
@@ -72,6 +103,8 @@ class DNSSD::Reply
   # Service name as in Socket.getservbyname
 
   def service_name
+    load_names :@type unless defined? @type
+
     raise TypeError, 'no type on this reply' unless
       instance_variable_defined? :@type
 
@@ -79,17 +112,13 @@ class DNSSD::Reply
   end
 
   ##
-  # Sets #name, #type and #domain from +fullname+
+  # Sets #name, #type and #domain from +fullname+.  The name is unescaped,
+  # the first two labels after it are the type and the rest is the domain.
 
   def set_fullname(fullname)
-    fullname = fullname.gsub(/\\([0-9]{1,3})/) do $1.to_i.chr end
-    fullname = fullname.scan(/(?:[^\\.]|\\\.)+/).map do |part|
-      part.gsub "\\.", '.'
-    end
+    @name, @type, @domain = _split_fullname fullname
 
-    @name   = fullname[0]
-    @type   = fullname[1, 2].join '.'
-    @domain = fullname[3..-1].map { |part| part.sub '.', '\\.' }.join('.') + '.'
+    remove_instance_variable :@fullname if defined? @fullname
   end
 
   ##
@@ -99,5 +128,36 @@ class DNSSD::Reply
     set_fullname [name, type, domain].join('.')
   end
 
+  private
+
+  ##
+  # Converts interface index +interface+ to a name, leaving the special
+  # indexes alone
+
+  def interface_from interface
+    if interface then
+      interface > 0 ? DNSSD.interface_name(interface) : interface
+    end
+  end
+
+  ##
+  # Sets #name, #type and #domain from the daemon's reply and returns the
+  # instance variable +ivar+.  Replies without names return nil.
+
+  def load_names ivar
+    fullname = raw_fullname
+
+    return unless fullname
+
+    set_fullname fullname
+    instance_variable_get ivar
+  end
+
+  ##
+  # The fullname the daemon sent, nil for replies without names
+
+  def raw_fullname
+  end
+
 end
 
@@ -4,24 +4,35 @@
 class DNSSD::Reply::AddrInfo < DNSSD::Reply
 
   ##
+  # :attr_reader: address
   # IP address of host
 
-  attr_reader :address
+  lazy_reader :address, 'load_sockaddr :@address'
 
   ##
+  # :attr_reader: hostname
   # Host name
 
-  attr_reader :hostname
+  lazy_reader :hostname, '_field 0'
 
   ##
+  # :attr_reader: port
   # Port name
 
-  attr_reader :port
+  lazy_reader :port, 'load_sockaddr :@port'
 
   ##
+  # :attr_reader: sockaddr
+  # The packed IPv4 or IPv6 sockaddr of #address as a binary String.  Its
+  # port is 0.
+
+  lazy_reader :sockaddr, '_sockaddr'
+
+  ##
+  # :attr_reader: ttl
   # Time to live see #expired?
 
-  attr_reader :ttl
+  lazy_reader :ttl, '_number 0'
 
   ##
   # Creates a new AddrInfo, called internally by DNSSD::Service#getaddrinfo
@@ -30,18 +41,41 @@ class DNSSD::Reply::AddrInfo < DNSSD::Reply
     super service, flags, interface
 
     @hostname = hostname
-    @port, @address = Socket.unpack_sockaddr_in sockaddr
+    @sockaddr = sockaddr.b.freeze
+    @port, @address = _unpack_sockaddr @sockaddr
 
     @created = Time.now
     @ttl = ttl
   end
 
+  ##
+  # Returns an Addrinfo for #address and +port+ which may be passed to
+  # Socket#connect_nonblock and friends without formatting and parsing the
+  # address.
+
+  def addrinfo port = 0
+    _addrinfo sockaddr, port
+  end
+
   ##
   # Has this AddrInfo passed its TTL?
 
   def expired?
+    @created = _created unless defined? @created
+
     Time.now > @created + ttl
   end
 
+  private
+
+  ##
+  # Sets #port and #address from the daemon's sockaddr and returns the
+  # instance variable +ivar+
+
+  def load_sockaddr ivar
+    @port, @address = _unpack_sockaddr sockaddr
+    instance_variable_get ivar
+  end
+
 end
 
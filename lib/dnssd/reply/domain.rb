@@ -4,9 +4,10 @@
 class DNSSD::Reply::Domain < DNSSD::Reply
 
   ##
+  # :attr_reader: domain
   # A domain for registration or browsing
 
-  attr_reader :domain
+  lazy_reader :domain, '_field 0'
 
   ##
   # Creates a new Browse, called internally by
@@ -6,39 +6,46 @@ require 'ipaddr'
 class DNSSD::Reply::QueryRecord < DNSSD::Reply
 
   ##
+  # :attr_reader: domain
   # A domain for registration or browsing
 
-  attr_reader :domain
+  lazy_reader :domain, 'load_names :@domain'
 
   ##
+  # :attr_reader: name
   # The service name
 
-  attr_reader :name
+  lazy_reader :name, 'load_names :@name'
 
   ##
+  # :attr_reader: record
   # DNS Record data
 
-  attr_reader :record
+  lazy_reader :record, '_field 1'
 
   ##
+  # :attr_reader: record_class
   # DNS Record class (only IN is supported)
 
-  attr_reader :record_class
+  lazy_reader :record_class, '_number 1'
 
   ##
+  # :attr_reader: record_type
   # DNS Record type
 
-  attr_reader :record_type
+  lazy_reader :record_type, '_number 0'
 
   ##
+  # :attr_reader: ttl
   # Time-to-live for this record.  See #expired?
 
-  attr_reader :ttl
+  lazy_reader :ttl, '_number 2'
 
   ##
+  # :attr_reader: type
   # The service type
 
-  attr_reader :type
+  lazy_reader :type, 'load_names :@type'
 
   ##
   # Creates a new QueryRecord, called internally by
@@ -68,7 +75,7 @@ class DNSSD::Reply::QueryRecord < DNSSD::Reply
 
     if string.length != length then
       raise TypeError,
-        "invalid character string, expected #{length} got #{string.length} in #{@record.inspect}"
+        "invalid character string, expected #{length} got #{string.length} in #{record.inspect}"
     end
 
     string
@@ -97,6 +104,8 @@ class DNSSD::Reply::QueryRecord < DNSSD::Reply
   # Has this QueryRecord passed its TTL?
 
   def expired?
+    @created = _created unless defined? @created
+
     Time.now > @created + ttl
   end
 
@@ -104,7 +113,7 @@ class DNSSD::Reply::QueryRecord < DNSSD::Reply
     "#<%s:0x%x %s %s %s %p interface: %s flags: %p>" % [
       self.class, object_id,
       fullname, record_class_name, record_type_name, record,
-      interface_name, @flags
+      interface_name, flags
     ]
   end
 
@@ -112,52 +121,39 @@ class DNSSD::Reply::QueryRecord < DNSSD::Reply
   # Name of this record's record_class
 
   def record_class_name
-    return "unknown #{@record_class}" unless @record_class == DNSSD::Record::IN
+    return "unknown #{record_class}" unless record_class == DNSSD::Record::IN
     'IN' # Only IN is supported
   end
 
   ##
   # Decodes output for #record, returning the raw record if it can't be
-  # decoded.  Handles:
+  # decoded.  A and AAAA records decode to an IPAddr, other records to a
+  # frozen String, Integer or Array of them in the order of the fields in
+  # the record, for example [priority, weight, port, target] for SRV.
+  # Handles:
+  #
+  # A AAAA AFSDB CERT CNAME DHCID DNAME DNSKEY DS HINFO ISDN KEY KX LOC MB MD
+  # MF MG MINFO MR MX NAPTR NS NSEC PTR PX RP RRSIG RT SIG SOA SRV SSHFP TXT
+  # X25
   #
-  # A AAAA CNAME MX NS PTR SOA SRV TXT
+  # Binary fields such as DNSKEY keys and DS digests are left undecoded.
+  # NSEC type bitmaps decode to an Array of record types.  LOC decodes to
+  # [version, size, horizontal precision, vertical precision, latitude,
+  # longitude, altitude] with sizes and altitude in centimeters and latitude
+  # and longitude in thousandths of an arc second north and east.
 
   def record_data
-    return @record unless @record_class == DNSSD::Record::IN
+    record = self.record
+
+    return record unless record_class == DNSSD::Record::IN
 
-    case @record_type
+    case record_type
     when DNSSD::Record::A,
          DNSSD::Record::AAAA then
-      IPAddr.new_ntoh @record
-    when DNSSD::Record::CNAME,
-         DNSSD::Record::NS,
-         DNSSD::Record::PTR then
-      domain_name_to_string @record
-    when DNSSD::Record::MX then
-      mx = @record.unpack 'nZ*'
-      mx[-1] = domain_name_to_string mx.last
-      mx
-    when DNSSD::Record::SOA then
-      soa = @record.unpack 'Z*Z*NNNNN'
-      soa[0] = domain_name_to_string soa[0]
-      soa[1] = domain_name_to_string soa[1]
-      soa
-    when DNSSD::Record::SRV then
-      srv = @record.unpack 'nnnZ*'
-      srv[-1] = domain_name_to_string srv.last
-      srv
-    when DNSSD::Record::TXT then
-      record = @record.dup
-      txt = []
-
-      until record.empty? do
-        txt << character_string_to_string(record)
-        record.slice! 0, txt.last.length + 1
-      end
-
-      txt
+      IPAddr.new_ntoh record
     else
-      @record
+      data = _decode_rdata record_type, record
+      data.nil? ? record : data
     end
   end
 
@@ -165,9 +161,9 @@ class DNSSD::Reply::QueryRecord < DNSSD::Reply
   # Name of this record's record_type
 
   def record_type_name
-    return "unknown #{@record_type} for record class (#{@record_class})" unless
-      @record_class == DNSSD::Record::IN
-    DNSSD::Record::VALUE_TO_NAME[@record_type]
+    return "unknown #{record_type} for record class (#{record_class})" unless
+      record_class == DNSSD::Record::IN
+    DNSSD::Record::VALUE_TO_NAME[record_type]
   end
 
   ##
@@ -178,4 +174,10 @@ class DNSSD::Reply::QueryRecord < DNSSD::Reply
       fullname, ttl, record_class_name, record_type_name, record_data
     ]
   end
+
+  private
+
+  def raw_fullname
+    _field 0
+  end
 end
@@ -4,19 +4,22 @@
 class DNSSD::Reply::Register < DNSSD::Reply
 
   ##
+  # :attr_reader: domain
   # A domain for registration or browsing
 
-  attr_reader :domain
+  lazy_reader :domain, 'load_names :@domain'
 
   ##
+  # :attr_reader: name
   # The service name
 
-  attr_reader :name
+  lazy_reader :name, 'load_names :@name'
 
   ##
+  # :attr_reader: type
   # The service type
 
-  attr_reader :type
+  lazy_reader :type, 'load_names :@type'
 
   ##
   # Creates a Register, called internally by DNSSD::Service#register
@@ -34,9 +37,17 @@ class DNSSD::Reply::Register < DNSSD::Reply
 
   def inspect # :nodoc:
     "#<%s:0x%x %p flags: %p>" % [
-      self.class, object_id, fullname, @flags
+      self.class, object_id, fullname, flags
     ]
   end
 
+  private
+
+  def raw_fullname
+    name = _field 0
+
+    [name, _field(1), _field(2)].join '.' if name
+  end
+
 end
 
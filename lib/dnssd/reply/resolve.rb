@@ -4,34 +4,40 @@
 class DNSSD::Reply::Resolve < DNSSD::Reply
 
   ##
+  # :attr_reader: domain
   # A domain for registration or browsing
 
-  attr_reader :domain
+  lazy_reader :domain, 'load_names :@domain'
 
   ##
+  # :attr_reader: name
   # The service name
 
-  attr_reader :name
+  lazy_reader :name, 'load_names :@name'
 
   ##
+  # :attr_reader: port
   # The port for this service
 
-  attr_reader :port
+  lazy_reader :port, '_number 0'
 
   ##
+  # :attr_reader: target
   # The hostname of the host provide the service
 
-  attr_reader :target
+  lazy_reader :target, '_field 1'
 
   ##
+  # :attr_reader: text_record
   # The service's primary text record
 
-  attr_reader :text_record
+  lazy_reader :text_record, 'DNSSD::TextRecord.new _field 2'
 
   ##
+  # :attr_reader: type
   # The service type
 
-  attr_reader :type
+  lazy_reader :type, 'load_names :@type'
 
   ##
   # Creates a new Resolve, called internally by DNSSD::Service#resolve
@@ -47,6 +53,32 @@ class DNSSD::Reply::Resolve < DNSSD::Reply
     @text_record = DNSSD::TextRecord.new text_record
   end
 
+  ##
+  # Returns true if the text record has an entry for +key+.  Like #txt_value
+  # this doesn't build the #text_record Hash.
+
+  def txt_key? key
+    key = key.to_s
+
+    return text_record.key? key if defined? @text_record
+
+    _txt_key? 2, key
+  end
+
+  ##
+  # The value of +key+ in the text record, or nil if it is missing or has no
+  # value.  Same as <tt>text_record[key]</tt>, but the raw record from the
+  # daemon is searched in place, so reading a key or two doesn't build the
+  # whole #text_record Hash.
+
+  def txt_value key
+    key = key.to_s
+
+    return text_record[key] if defined? @text_record
+
+    _txt_value 2, key
+  end
+
   ##
   # Connects to this Reply.  If #target and #port are missing, DNSSD.resolve
   # is automatically called.
@@ -54,8 +86,22 @@ class DNSSD::Reply::Resolve < DNSSD::Reply
   # +family+ can be used to select a particular address family (IPv6 vs IPv4).
   #
   # +addrinfo_flags+ are passed to DNSSD::Service#getaddrinfo as flags.
+  # Without flags the addresses come from DNSSD::AddressCache.instance, so
+  # connecting to a target again within its TTL doesn't wait on the daemon.
+  # If the cache has no addresses, or none of the cached addresses accepts
+  # the connection, the daemon is asked again and its replies are used as
+  # they arrive.
+  #
+  # With the default +mode+ of :serial each address is tried in turn and
+  # the next is only tried once connecting to the previous one fails.  With
+  # :happy_eyeballs TCP connections are attempted with staggered starts as
+  # addresses arrive and the first to connect is returned, see
+  # DNSSD::HappyEyeballs.
+
+  def connect(family = Socket::AF_UNSPEC, addrinfo_flags = 0, mode = :serial)
+    raise ArgumentError, "invalid mode #{mode.inspect}" unless
+      [:serial, :happy_eyeballs].include? mode
 
-  def connect(family = Socket::AF_UNSPEC, addrinfo_flags = 0)
     addrinfo_protocol = case family
                         when Socket::AF_INET   then DNSSD::Service::IPv4
                         when Socket::AF_INET6  then DNSSD::Service::IPv6
@@ -63,22 +109,40 @@ class DNSSD::Reply::Resolve < DNSSD::Reply
                         else raise ArgumentError, "invalid family #{family}"
                         end
 
+    if addrinfo_flags.to_i.zero? then
+      cache   = DNSSD::AddressCache.instance
+      replies = cache.fetch target, addrinfo_protocol, interface
+
+      unless replies.empty? then
+        begin
+          return connect_cached replies, mode
+        rescue
+          # the target may have moved, forget it and ask the daemon again
+          cache.invalidate target, addrinfo_protocol, interface
+        end
+      end
+    end
+
     service = DNSSD::Service.getaddrinfo target, addrinfo_protocol,
-      addrinfo_flags, @interface
+      addrinfo_flags, interface
 
-    service.each do |addrinfo|
-      address = addrinfo.address
+    if mode == :happy_eyeballs and protocol == 'tcp' then
+      source = if Array === service then
+                 service.map { |addrinfo| addrinfo.addrinfo port }
+               else
+                 service
+               end
 
       begin
-        socket = nil
-
-        case protocol
-        when 'tcp' then
-          socket = TCPSocket.new address, port
-        when 'udp' then
-          socket = UDPSocket.new
-          socket.connect address, port
-        end
+        return DNSSD::HappyEyeballs.new(port).connect source
+      ensure
+        service.stop if DNSSD::Service === service and service.started?
+      end
+    end
+
+    service.each do |addrinfo|
+      begin
+        socket = connect_to addrinfo.addrinfo port
 
         service.stop
         return socket
@@ -92,9 +156,49 @@ class DNSSD::Reply::Resolve < DNSSD::Reply
   def inspect # :nodoc:
     "#<%s:0x%x %s at %s:%d text_record: %p interface: %s flags: %p>" % [
       self.class, object_id,
-      fullname, @target, @port, @text_record, interface_name, @flags
+      fullname, target, port, text_record, interface_name, flags
     ]
   end
 
+  private
+
+  ##
+  # Connects to one of the DNSSD::Reply::AddrInfo +replies+ from
+  # DNSSD::AddressCache, raising the last error if none accepts
+
+  def connect_cached replies, mode
+    addresses = replies.map { |addrinfo| addrinfo.addrinfo port }
+
+    if mode == :happy_eyeballs and protocol == 'tcp' then
+      return DNSSD::HappyEyeballs.new(port).connect addresses
+    end
+
+    addresses.each_with_index do |address, i|
+      begin
+        return connect_to address
+      rescue
+        raise if i == addresses.length - 1
+      end
+    end
+  end
+
+  ##
+  # Opens a TCP or UDP socket connected to Addrinfo +address+
+
+  def connect_to address
+    case protocol
+    when 'tcp' then
+      TCPSocket.new address.ip_address, port
+    when 'udp' then
+      socket = UDPSocket.new address.afamily
+      socket.connect address.ip_address, port
+      socket
+    end
+  end
+
+  def raw_fullname
+    _field 0
+  end
+
 end
 
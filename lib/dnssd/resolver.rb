@@ -0,0 +1,205 @@
+##
+# A DNSSD::Resolver resolves many browse results at once.  Resolving an
+# instance and looking up the addresses of its target are two round trips to
+# the daemon.  DNSSD::Reply::Browse#resolve makes them one instance after
+# another, so resolving hundreds of instances takes hundreds of round trips.
+# The resolver keeps up to +window+ instances in flight over one
+# DNSSD::Connection and yields each endpoint as soon as its addresses
+# arrive:
+#
+#   browses = []
+#   DNSSD.browse! '_http._tcp' do |reply|
+#     browses << reply if reply.flags.add?
+#     break unless reply.flags.more_coming?
+#   end
+#
+#   resolver = DNSSD::Resolver.new 32
+#   resolver.resolve browses do |endpoint|
+#     puts "#{endpoint.name} at #{endpoint.addresses.join ', '}:#{endpoint.port}"
+#   end
+#   resolver.close
+
+class DNSSD::Resolver
+
+  ##
+  # A fully resolved service instance
+
+  Endpoint = Struct.new :name, :type, :domain, :interface, :target, :port,
+                        :text_record, :addresses
+
+  ##
+  # An instance being resolved
+
+  class Lookup # :nodoc:
+    attr_reader :browse, :deadline, :endpoint, :services
+    attr_accessor :bursts, :done, :settle
+
+    def initialize browse, deadline
+      @browse   = browse
+      @bursts   = 0
+      @deadline = deadline
+      @done     = false
+      @settle   = nil
+      @endpoint = Endpoint.new browse.name, browse.type, browse.domain,
+                               browse.interface || DNSSD::InterfaceAny
+      @endpoint.addresses = []
+      @services = []
+    end
+
+    def stop
+      @services.each { |service| service.stop if service.started? }
+    end
+  end
+
+  ##
+  # The DNSSD::Connection used for resolving
+
+  attr_reader :connection
+
+  ##
+  # When addresses of either family are looked up, how many seconds to wait
+  # for the second family after the first one arrives.  An endpoint is
+  # yielded with only the first family's addresses if the second doesn't
+  # arrive in time.  Defaults to 0.1.
+
+  attr_accessor :grace
+
+  ##
+  # The most instances resolved at once
+
+  attr_reader :window
+
+  ##
+  # Creates a resolver that keeps up to +window+ instances in flight on
+  # +connection+
+
+  def initialize window = 16, connection = DNSSD::Connection.new
+    raise ArgumentError, 'window must be at least 1' if window < 1
+
+    @window     = window
+    @connection = connection
+    @grace      = 0.1
+  end
+
+  ##
+  # Closes the connection
+
+  def close
+    @connection.close
+  end
+
+  ##
+  # Resolves each DNSSD::Reply::Browse in +browses+ and yields an Endpoint
+  # for each as it finishes, in no particular order.  An instance that hasn't
+  # resolved +timeout+ seconds after it was started is given up on.
+  # +protocol+ limits addresses to DNSSD::Service::IPv4 or
+  # DNSSD::Service::IPv6.  With the default of both, an endpoint is yielded
+  # once both families have arrived or #grace seconds after the first.
+  #
+  # Returns the browse replies that timed out.
+
+  def resolve browses, timeout = 5, protocol = 0, &block
+    return enum_for __method__, browses, timeout, protocol unless block
+
+    pending   = browses.to_a.dup
+    in_flight = []
+    finished  = []
+    failed    = []
+
+    until pending.empty? and in_flight.empty? do
+      while in_flight.length < @window and browse = pending.shift do
+        in_flight << start(browse, timeout, protocol, finished)
+      end
+
+      remaining = in_flight.map do |lookup|
+        lookup.settle || lookup.deadline
+      end.min - DNSSD.clock_time
+
+      @connection.read_replies remaining if remaining > 0
+
+      now = DNSSD.clock_time
+
+      in_flight.each do |lookup|
+        finish lookup, finished if lookup.settle and lookup.settle <= now
+      end
+
+      done = finished.dup
+      finished.clear
+      in_flight -= done
+
+      in_flight.delete_if do |lookup|
+        next false if lookup.deadline > now
+
+        lookup.stop
+        failed << lookup.browse
+      end
+
+      done.each { |lookup| yield lookup.endpoint }
+    end
+
+    failed
+  ensure
+    in_flight.each { |lookup| lookup.stop } if in_flight
+  end
+
+  private
+
+  ##
+  # Stops +lookup+ and adds it to +finished+
+
+  def finish lookup, finished
+    return if lookup.done
+
+    lookup.done = true
+    lookup.stop
+    finished << lookup
+  end
+
+  ##
+  # Starts resolving +browse+.  The Lookup is added to +finished+ once the
+  # addresses of its target arrive.  A burst of replies that leaves the
+  # endpoint without addresses doesn't finish it.
+
+  def start browse, timeout, protocol, finished
+    lookup = Lookup.new browse, DNSSD.clock_time + timeout
+    endpoint = lookup.endpoint
+
+    lookup.services << @connection.resolve(browse.name, browse.type,
+                                           browse.domain, 0,
+                                           endpoint.interface) do |reply|
+      next if endpoint.target
+      lookup.stop
+
+      endpoint.target      = reply.target
+      endpoint.port        = reply.port
+      endpoint.text_record = reply.text_record
+
+      lookup.services << @connection.getaddrinfo(reply.target, protocol, 0,
+                                                 endpoint.interface) do |addr|
+        if addr.flags.add? then
+          endpoint.addresses << addr.address
+        else
+          endpoint.addresses.delete addr.address
+        end
+
+        next if addr.flags.more_coming? or lookup.done
+
+        if endpoint.addresses.empty? then
+          lookup.settle = nil
+          next
+        end
+
+        lookup.bursts += 1
+
+        if protocol.zero? and lookup.bursts < 2 then
+          lookup.settle ||= [DNSSD.clock_time + @grace, lookup.deadline].min
+        else
+          finish lookup, finished
+        end
+      end
+    end
+
+    lookup
+  end
+
+end
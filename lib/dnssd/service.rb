@@ -21,10 +21,11 @@ class DNSSD::Service
   # Creates a new DNSSD::Service
 
   def initialize
-    @replies  = []
-    @continue = true
-    @thread   = nil
-    @lock     = Mutex.new
+    @continue   = true
+    @reactor    = nil
+    @lock       = Mutex.new
+    @connection = nil
+    @io         = nil
   end
 
   class Register < ::DNSSD::Service
@@ -42,7 +43,70 @@ class DNSSD::Service
     # Returns the added DNSSD::Record
 
     def add_record type, data, ttl = 0, flags = 0
-      @records << _add_record(flags.to_i, type, data, ttl)
+      record = _add_record(flags.to_i, type, data, ttl)
+      @records << record
+      record
+    end
+
+    ##
+    # Called by DNSSD::Record#remove
+
+    def record_removed record # :nodoc:
+      @records.delete record
+    end
+
+    ##
+    # Stops the registration.  Updates waiting to be sent are dropped.
+
+    def stop
+      @text_record_updates.cancel if @text_record_updates
+      super
+    end
+
+    ##
+    # Seconds text record updates are coalesced for, see
+    # #text_record_update_interval=
+
+    def text_record_update_interval
+      @text_record_updates.interval if @text_record_updates
+    end
+
+    ##
+    # Merges calls to #update_text_record made within +interval+ seconds of
+    # the last one sent so only the newest text record reaches the daemon,
+    # see DNSSD::Coalescer.  Use this when publishing values that change
+    # often, like load.  Use nil to send every update at once.
+
+    def text_record_update_interval= interval
+      @text_record_updates.flush if @text_record_updates
+
+      @text_record_updates = if interval then
+                               DNSSD::Coalescer.new(interval) do |data, ttl|
+                                 _update_text_record data, ttl
+                               end
+                             end
+    end
+
+    ##
+    # Replaces the TXT record of this registration with +text_record+, a
+    # DNSSD::TextRecord, Hash or encoded String, without stopping it.
+    # Clients see the new text record without the service being removed and
+    # added again.  +ttl+ is in seconds, use 0 for the default value.
+    #
+    # Must be called on a service only after #register.
+
+    def update_text_record text_record, ttl = 0
+      text_record = DNSSD::TextRecord.new text_record if Hash === text_record
+      text_record = text_record.encode if DNSSD::TextRecord === text_record
+      text_record = "\0" if text_record.nil? or text_record.empty?
+
+      if @text_record_updates then
+        @text_record_updates.push [text_record, ttl]
+      else
+        _update_text_record text_record, ttl
+      end
+
+      self
     end
   end
 
@@ -51,6 +115,9 @@ class DNSSD::Service
   #
   # For each service found a DNSSD::Reply object is yielded.
   #
+  # If +connection+ is a DNSSD::Connection the service shares its daemon
+  # socket; use DNSSD::Connection#browse instead of passing it directly.
+  #
   #   service = DNSSD::Service.new
   #   timeout 6 do
   #     service.browse '_http._tcp' do |r|
@@ -59,46 +126,111 @@ class DNSSD::Service
   #   rescue Timeout::Error
   #   end
 
-  def self.browse type, domain = nil, flags = 0, interface = DNSSD::InterfaceAny
+  def self.browse type, domain = nil, flags = 0, interface = DNSSD::InterfaceAny,
+                  connection = nil
     check_domain domain
     interface = DNSSD.interface_index interface unless Integer === interface
 
-    _browse flags.to_i, interface, type, domain
+    _browse flags.to_i, interface, type, domain, connection
   end
 
-  def each timeout = :never
+  ##
+  # Yields each reply as it arrives until the service is stopped or +timeout+
+  # seconds have passed.  Waiting for the daemon does not hold the GVL.
+  #
+  # When called from a non-blocking Fiber the wait goes through the Fiber
+  # scheduler's io_wait hook, so other fibers on the thread keep running.
+  #
+  # #stop from another thread or fiber ends the wait at once.  Without epoll a
+  # fiber waiting through the scheduler only notices #stop when the next reply
+  # arrives or +timeout+ expires.
+
+  def each timeout = :never, &block
     raise DNSSD::Error, 'already stopped' unless @continue
+    check_connection
 
     return enum_for __method__, timeout unless block_given?
 
-    io = IO.new ref_sock_fd
-    rd = [io]
+    read_until timeout, :read_replies, &block
+  end
 
-    start_at = clock_time
+  ##
+  # Like #each, but yields an Array of replies per burst.  The daemon sets
+  # DNSSD::Flags::MoreComing on every reply of a burst but the last, so
+  # replies are collected until a reply without it arrives.  Handling a whole
+  # burst at once means locking and updating your own state once per burst
+  # instead of once per reply.
+  #
+  #   service.each_batch do |replies|
+  #     added, removed = replies.partition { |r| r.flags.add? }
+  #     # ...
+  #   end
 
-    while @continue
-      break unless timeout == :never || clock_time - start_at < timeout
-
-      if IO.select rd, nil, nil, 1
-        begin
-          process_result
-        rescue DNSSD::UnknownError
-        end
-        @replies.each { |r| yield r }
-        @replies.clear
-      end
-    end
+  def each_batch timeout = :never, &block
+    raise DNSSD::Error, 'already stopped' unless @continue
+    check_connection
+
+    return enum_for __method__, timeout unless block_given?
+
+    read_until timeout, :read_batch, &block
   end
 
-  def async_each timeout = :never
-    @lock.synchronize do
-      raise DNSSD::Error, 'already stopped' unless @continue
-      @thread = Thread.new { each(timeout) { |r| yield r } }
+  ##
+  # Yields each reply on the process-wide DNSSD::Reactor thread until the
+  # service is stopped or +timeout+ seconds have passed, when the service is
+  # stopped.  Returns the service immediately, use #join to wait for it.
+
+  def async_each timeout = :never, &block
+    read_async timeout, :read_replies, &block
+  end
+
+  ##
+  # Like #async_each, but yields an Array of replies per burst, see
+  # #each_batch
+
+  def async_each_batch timeout = :never, &block
+    read_async timeout, :read_batch, &block
+  end
+
+  ##
+  # Waits up to +timeout+ seconds for the daemon, then yields the waiting
+  # replies.  Returns false if nothing was read or yielded.
+
+  def read_replies timeout, &block # :nodoc:
+    # replies the last call left waiting are yielded without waiting
+    waiting = replies_waiting?
+    timeout = 0 if waiting
+
+    begin
+      read = process_result timeout
+    rescue DNSSD::UnknownError
+      read = true
     end
+
+    # a full queue under the :block policy is drained without reading
+    drain_replies(&block)
+
+    read or waiting
   end
 
-  def push record
-    @replies << record
+  ##
+  # Like #read_replies, but keeps reading while the daemon says more replies
+  # are coming, then yields them as one Array.
+
+  def read_batch timeout # :nodoc:
+    begin
+      read = process_result timeout
+
+      while read and more_coming? and process_result timeout do end
+    rescue DNSSD::UnknownError
+      read = true
+    end
+
+    replies = shift_replies
+
+    yield replies unless replies.empty?
+
+    read
   end
 
   ##
@@ -126,10 +258,11 @@ class DNSSD::Service
   #   end
 
   def self.enumerate_domains(flags = DNSSD::Flags::BrowseDomains,
-                        interface = DNSSD::InterfaceAny, &block)
+                        interface = DNSSD::InterfaceAny, connection = nil,
+                        &block)
     interface = DNSSD.interface_index interface unless Integer === interface
 
-    _enumerate_domains flags.to_i, interface
+    _enumerate_domains flags.to_i, interface, connection
   end
 
   ##
@@ -146,11 +279,11 @@ class DNSSD::Service
   # http://avahi.org/wiki/AvahiAndUnicastDotLocal for details
 
   def self.getaddrinfo(host, protocol = 0, flags = 0,
-                  interface = DNSSD::InterfaceAny, &block)
+                  interface = DNSSD::InterfaceAny, connection = nil, &block)
     interface = DNSSD.interface_index interface unless Integer === interface
 
     if respond_to? :_getaddrinfo, true then
-      _getaddrinfo flags.to_i, interface, protocol, host
+      _getaddrinfo flags.to_i, interface, protocol, host, connection
     else
       family = case protocol
                when IPv4 then Socket::AF_INET
@@ -184,10 +317,11 @@ class DNSSD::Service
   #   end
 
   def self.query_record(fullname, record_type, record_class = DNSSD::Record::IN,
-                   flags = 0, interface = DNSSD::InterfaceAny)
+                   flags = 0, interface = DNSSD::InterfaceAny, connection = nil)
     interface = DNSSD.interface_index interface unless Integer === interface
 
-    _query_record flags.to_i, interface, fullname, record_type, record_class
+    _query_record flags.to_i, interface, fullname, record_type, record_class,
+                  connection
   end
 
   ##
@@ -199,12 +333,13 @@ class DNSSD::Service
   #   end
 
   def self.register(name, type, domain, port, host = nil, text_record = nil,
-               flags = 0, interface = DNSSD::InterfaceAny)
+               flags = 0, interface = DNSSD::InterfaceAny, connection = nil)
     check_domain domain
     interface = DNSSD.interface_index interface unless Integer === interface
     text_record = text_record.encode if text_record
 
-    _register flags.to_i, interface, name, type, domain, host, port, text_record
+    _register flags.to_i, interface, name, type, domain, host, port, text_record,
+              connection
   end
 
   ##
@@ -224,12 +359,71 @@ class DNSSD::Service
   #   end
 
   def self.resolve(name, type = name.type, domain = name.domain, flags = 0,
-              interface = DNSSD::InterfaceAny)
+              interface = DNSSD::InterfaceAny, connection = nil)
     name = name.name if DNSSD::Reply === name
     check_domain domain
     interface = DNSSD.interface_index interface unless Integer === interface
 
-    _resolve flags.to_i, interface, name, type, domain
+    _resolve flags.to_i, interface, name, type, domain, connection
+  end
+
+  ##
+  # The daemon socket of this service as an IO, for use with IO.select.  The
+  # same IO is returned on every call and it does not close the socket when
+  # it is garbage collected.
+
+  def to_io
+    @io ||= IO.for_fd ref_sock_fd, autoclose: false
+  end
+
+  ##
+  # Caps the replies waiting to be yielded at +limit+, or removes the cap if
+  # +limit+ is 0 (the default).  A capped queue has a fixed size, room for
+  # +limit+ replies is allocated once and, except for :block, the oldest
+  # waiting replies beyond it are dropped.  When a reply arrives to a full
+  # queue +overflow+ decides what happens:
+  #
+  # :block::
+  #   Stop reading from the daemon until replies are taken, so the socket
+  #   pushes back on the daemon.  Not available for a service on a
+  #   DNSSD::Connection as the socket is shared.
+  # :drop_oldest::
+  #   Drop the oldest waiting reply.
+  # :coalesce::
+  #   Replace the waiting reply about the same thing, keeping only the latest
+  #   state.  Replies are about the same thing if they have the same class,
+  #   interface and full name, and for DNSSD::Reply::AddrInfo the same
+  #   address and for DNSSD::Reply::QueryRecord the same record.  If none is
+  #   found the oldest is dropped.
+  #
+  # #each, #async_each and DNSSD::Connection#process read what the daemon
+  # sent while the block ran before yielding the next reply, so a block
+  # slower than the daemon fills the queue and the policy applies.  For
+  # #each_batch and #async_each_batch the limit caps each batch.
+  #
+  # The :block policy never drops a reply.  The replies beyond the limit
+  # from a single read are kept, so the queue briefly grows past +limit+
+  # until it drains.
+  #
+  # Dropped and coalesced replies and skipped reads are counted in #stats.
+  #
+  #   service = DNSSD::Service.browse '_http._tcp'
+  #   service.limit_replies 1000, :coalesce
+
+  def limit_replies limit, overflow = :block
+    _limit_replies limit, overflow
+  end
+
+  ##
+  # Waits up to +timeout+ seconds (forever if nil) until #async_each or
+  # #async_each_batch stops yielding replies, because the service was
+  # stopped, its timeout passed or the block raised an exception.  Returns
+  # nil if +timeout+ passed first, like Thread#join.
+
+  def join timeout = nil
+    return self unless @reactor
+
+    @reactor.join(self, timeout) && self
   end
 
   ##
@@ -239,23 +433,73 @@ class DNSSD::Service
     @continue
   end
 
+  ##
+  # Stops the service.  A block yielding replies on the DNSSD::Reactor thread
+  # has returned once this returns, unless the block stopped the service
+  # itself.
+
   def stop
     raise DNSSD::Error, 'service is already stopped' unless started?
     @continue = false
-    @thread.join if @thread
+    @reactor.remove self if @reactor
+    @connection.remove self if @connection
     _stop
     self
   end
 
   private
 
-  if defined? Process::CLOCK_MONOTONIC
-    def clock_time
-      Process.clock_gettime Process::CLOCK_MONOTONIC
+  ##
+  # Called by #drain_replies after each reply it yields when the queue is
+  # limited to +limit+ replies.  Reads what the daemon sent meanwhile without
+  # waiting.  At most +limit+ reads are made so a busy daemon can't keep the
+  # block from running.
+
+  def read_ahead limit
+    reader = @connection || self
+
+    limit.times do
+      break unless reader.send :process_result, 0
+    end
+  rescue DNSSD::UnknownError
+  end
+
+  ##
+  # Calls +reader+ (#read_replies or #read_batch) until the service is
+  # stopped or +timeout+ seconds have passed
+
+  def read_until timeout, reader, &block
+    deadline = DNSSD.clock_time + timeout unless timeout == :never
+
+    while @continue
+      remaining = deadline - DNSSD.clock_time if deadline
+      break if remaining and remaining <= 0
+
+      send reader, remaining, &block
     end
-  else
-    def clock_time
-      Time.now
+  end
+
+  ##
+  # Adds this service to the DNSSD::Reactor which calls +reader+ when the
+  # daemon sends replies
+
+  def read_async timeout, reader, &block
+    @lock.synchronize do
+      raise DNSSD::Error, 'already stopped' unless @continue
+      check_connection
+      @reactor = DNSSD::Reactor.instance
+      @reactor.add self, timeout, reader, &block
     end
+
+    self
+  end
+
+  ##
+  # Replies for a service started on a DNSSD::Connection are only read by the
+  # connection.
+
+  def check_connection
+    raise DNSSD::Error, 'service shares a connection, use DNSSD::Connection#process' if
+      @connection
   end
 end
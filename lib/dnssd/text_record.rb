@@ -2,32 +2,17 @@ require 'delegate'
 
 ##
 # DNSSD::TextRecord is a Hash delegate that can encode its contents for DNSSD.
+#
+# Encoding and decoding are done in C, see ext/dnssd/text_record.c
 
 class DNSSD::TextRecord < DelegateClass(Hash)
-  def self.decode text_record
-    record = {}
-
-    tr = text_record.unpack 'C*'
-
-    until tr.empty? do
-      size  = tr.shift
-
-      next if size.zero?
-
-      raise ArgumentError, 'ran out of data in text record' if tr.length < size
-
-      entry = tr.shift(size).pack('C*')
-
-      raise ArgumentError, 'key not found' unless entry =~ /^[^=]/
-
-      key, value = entry.split '=', 2
 
-      next unless key
-
-      record[key] = value
-    end
+  ##
+  # Decodes +text_record+ into a new TextRecord.  Raises ArgumentError if the
+  # record is malformed.
 
-    new record
+  def self.decode text_record
+    new _decode text_record
   end
 
   ##
@@ -45,7 +30,7 @@ class DNSSD::TextRecord < DelegateClass(Hash)
           when Hash then
             text_record.dup
           when String then
-            decode(text_record.dup)
+            _decode text_record
           else
             Hash.new
           end
@@ -64,19 +49,7 @@ class DNSSD::TextRecord < DelegateClass(Hash)
   # clients.
 
   def encode
-    sort.map do |key, value|
-      key = key.to_s
-
-      raise DNSSD::Error, "empty key" if key.empty?
-      raise DNSSD::Error, "key '#{key}' contains =" if key =~ /=/
-
-      record = value ? [key, value.to_s].join('=') : key
-
-      raise DNSSD::Error, "key value pair at '#{key}' too large to encode" if
-        record.length > 255
-
-      "#{record.length.chr}#{record}"
-    end.join ''
+    _encode sort
   end
 
 end
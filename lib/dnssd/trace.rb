@@ -0,0 +1,148 @@
+##
+# A DNSSD::Trace is a recording of the reply callbacks the daemon made, with
+# their arguments and timing, in a compact binary file.  Replaying a trace
+# feeds the same arguments through the same callbacks, so a production reply
+# stream can drive a load test offline without a daemon:
+#
+#   DNSSD::Trace.record 'browse.trace' do
+#     DNSSD.browse '_http._tcp' do |reply| ... end
+#     sleep 60
+#   end
+#
+#   trace = DNSSD::Trace.new 'browse.trace'
+#   trace.replay 10 do |reply| # ten times faster than recorded
+#     p reply
+#   end
+#
+# Only replies are recorded, errors the daemon reported are not.  Interfaces
+# are recorded by name as well as index, replies on an interface this host
+# doesn't have are replayed on DNSSD::InterfaceAny.
+
+class DNSSD::Trace
+
+  ##
+  # Records every reply callback to a new trace at +path+.  With a block the
+  # trace is stopped when the block returns.
+
+  def self.record path
+    _start path
+
+    return unless block_given?
+
+    begin
+      yield
+    ensure
+      _stop
+    end
+  end
+
+  ##
+  # Starts recording every reply callback to a new trace at +path+
+
+  def self.start path
+    _start path
+  end
+
+  ##
+  # Stops recording.  Returns false if no trace was being recorded.  Raises
+  # SystemCallError if part of the trace couldn't be written.
+
+  def self.stop
+    _stop
+  end
+
+  ##
+  # Opens the trace at +path+ for replay
+
+  def initialize path
+    @io = File.open path, 'rb'
+
+    magic = @io.read MAGIC.bytesize
+
+    unless magic == MAGIC then
+      @io.close
+      raise ArgumentError, "#{path} is not a DNSSD trace"
+    end
+
+    @start = @io.pos
+  end
+
+  ##
+  # Closes the trace file
+
+  def close
+    @io.close
+  end
+
+  ##
+  # Yields each frame of the trace with the nanoseconds since recording
+  # started and the id of the service it was recorded for
+
+  def each_frame # :nodoc:
+    @io.pos = @start
+
+    while size = @io.read(4) do
+      raise ArgumentError, 'truncated trace frame' unless size.bytesize == 4
+
+      body = @io.read size.unpack1('V')
+
+      raise ArgumentError, 'truncated trace frame' unless
+        body and body.bytesize == size.unpack1('V')
+
+      frame = size << body
+      _, time, service_id = frame.unpack 'VQ<V'
+
+      yield frame, time, service_id
+    end
+  end
+
+  ##
+  # Feeds each recorded reply through the reply callbacks and yields the
+  # resulting replies in recorded order.  Each recorded service is replayed
+  # into a DNSSD::Service of its own.  Replies are yielded once the daemon
+  # said no more were coming, as DNSSD::Service#each would.
+  #
+  # Replies are delivered at +speed+ times the recorded rate, or as fast as
+  # possible if +speed+ is nil.
+  #
+  # Returns the number of recorded replies.
+
+  def replay speed = 1.0, &block
+    raise ArgumentError, 'speed must be positive' if speed and speed <= 0
+
+    services = Hash.new { |h, id| h[id] = DNSSD::Service.send :new }
+    started  = DNSSD.clock_time
+    count    = 0
+
+    each_frame do |frame, time, service_id|
+      if speed then
+        delay = started + time / 1e9 / speed - DNSSD.clock_time
+        sleep delay if delay > 0
+      end
+
+      service = services[service_id]
+      service.send :_replay, frame
+      count += 1
+
+      deliver service, &block unless service.send :more_coming?
+    end
+
+    services.each_value { |service| deliver service, &block }
+
+    count
+  end
+
+  private
+
+  ##
+  # Yields the queued replies of +service+, or discards them without a block
+
+  def deliver service, &block
+    if block then
+      service.drain_replies(&block)
+    else
+      service.shift_replies
+    end
+  end
+
+end
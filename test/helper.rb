@@ -29,6 +29,69 @@ class Latch
   end
 end
 
+##
+# A minimal Fiber scheduler for checking that waits are handed to io_wait.
+# Only the hooks DNSSD uses are implemented.
+
+class TestScheduler
+  attr_reader :io_waits
+
+  def initialize
+    @readable = {}
+    @ready    = []
+    @io_waits = 0
+  end
+
+  def io_wait io, events, timeout
+    @io_waits += 1
+    @readable[io] = [Fiber.current, timeout && DNSSD.clock_time + timeout]
+    Fiber.yield
+  ensure
+    @readable.delete io
+  end
+
+  def kernel_sleep duration = nil
+    @ready << Fiber.current
+    Fiber.yield
+  end
+
+  def block blocker, timeout = nil
+    raise NotImplementedError
+  end
+
+  def unblock blocker, fiber
+  end
+
+  def fiber(&block)
+    fiber = Fiber.new blocking: false, &block
+    fiber.resume
+    fiber
+  end
+
+  def close
+    until @readable.empty? and @ready.empty?
+      ready, @ready = @ready, []
+      ready.each(&:resume)
+
+      next if @readable.empty?
+
+      deadlines = @readable.values.map(&:last).compact
+      timeout   = [deadlines.min - DNSSD.clock_time, 0].max unless
+        deadlines.empty?
+
+      readable, = IO.select @readable.keys, nil, nil, timeout
+
+      @readable.dup.each do |io, (fiber, deadline)|
+        if readable and readable.include? io then
+          fiber.resume true
+        elsif deadline and deadline <= DNSSD.clock_time then
+          fiber.resume false
+        end
+      end
+    end
+  end
+end
+
 module DNSSD
   class Test < Minitest::Test
     if HAS_BLACKJACK
@@ -110,4 +110,48 @@ class TestDNSSD < DNSSD::Test
 
     assert_match %r%^lo0?$%, DNSSD.interface_name(index)
   end
+
+  def test_class_interface_name_cached
+    index = DNSSD.interface_index 'lo0'
+    index = DNSSD.interface_index 'lo' if index.zero?
+
+    name = DNSSD.interface_name index
+
+    assert_predicate name, :frozen?
+    assert_same name, DNSSD.interface_name(index)
+  end
+
+  def test_class_interface_name_invalid
+    assert_raises ArgumentError do
+      DNSSD.interface_name 2**31
+    end
+  end
+
+  def test_class_stats
+    service = DNSSD::Service.send :new
+    before  = DNSSD.stats
+
+    service.send :_synthesize, :browse, 5
+
+    stats = DNSSD.stats
+
+    assert_equal before[:replies] + 5, stats[:replies]
+    assert_operator stats[:queue_max], :>=, 5
+
+    %i[services_started services_live process_calls process_time
+       process_time_max unknown_errors].each do |key|
+      assert stats.key?(key), "missing #{key}"
+    end
+  end
+
+  def test_class_interfaces
+    interfaces = DNSSD.interfaces
+
+    assert_predicate interfaces, :frozen?
+
+    index = DNSSD.interface_index 'lo0'
+    index = DNSSD.interface_index 'lo' if index.zero?
+
+    assert_equal DNSSD.interface_name(index), interfaces[index]
+  end
 end
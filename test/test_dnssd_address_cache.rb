@@ -0,0 +1,213 @@
+require 'helper'
+
+class TestDNSSDAddressCache < DNSSD::Test
+
+  ##
+  # Answers lookups from a table of TTLs instead of asking the daemon
+
+  class FakeCache < DNSSD::AddressCache
+    attr_accessor :delay, :ttl
+    attr_reader :lookups
+
+    def initialize *args
+      super
+      @delay   = 0
+      @lookups = []
+      @ttl     = 120
+    end
+
+    private
+
+    def lookup host, protocol, interface
+      @lookups << [host, protocol, interface]
+      sleep @delay if @delay > 0
+
+      sockaddr = Socket.pack_sockaddr_in 0, '192.0.2.7'
+
+      [
+        DNSSD::Reply::AddrInfo.new(nil, DNSSD::Flags::Add, 0, host, sockaddr,
+                                   @ttl)
+      ].freeze
+    end
+  end
+
+  def setup
+    super
+
+    @cache = FakeCache.new
+  end
+
+  def test_addresses
+    assert_equal %w[192.0.2.7], @cache.addresses('example.local.')
+  end
+
+  def test_clear
+    @cache.fetch 'example.local.'
+    @cache.clear
+
+    assert_equal 0, @cache.stats[:size]
+
+    @cache.fetch 'example.local.'
+
+    assert_equal 2, @cache.lookups.length
+  end
+
+  def test_fetch
+    replies = @cache.fetch 'example.local.'
+
+    assert_equal 1, replies.length
+    assert replies.frozen?
+
+    assert_same replies, @cache.fetch('example.local.')
+
+    assert_equal 1, @cache.lookups.length
+
+    stats = @cache.stats
+
+    assert_equal 1, stats[:hits]
+    assert_equal 1, stats[:misses]
+    assert_equal 1, stats[:size]
+  end
+
+  def test_fetch_coalesced
+    @cache.delay = 0.2
+
+    threads = Array.new 4 do
+      Thread.new { @cache.fetch 'example.local.' }
+    end
+
+    results = threads.map { |thread| thread.value }
+
+    assert_equal 1, @cache.lookups.length
+    assert_equal 1, results.uniq.length
+
+    stats = @cache.stats
+
+    assert_equal 1, stats[:misses]
+    assert_equal 3, stats[:coalesced]
+    assert_equal 0, stats[:hits]
+  end
+
+  def test_fetch_expired
+    @cache.ttl = 1
+
+    @cache.fetch 'example.local.'
+    sleep 1.1
+    @cache.fetch 'example.local.'
+
+    assert_equal 2, @cache.lookups.length
+    assert_equal 2, @cache.stats[:misses]
+  end
+
+  def test_fetch_key
+    @cache.fetch 'example.local.'
+    @cache.fetch 'example.local.', DNSSD::Service::IPv4
+    @cache.fetch 'example.local.', 0, 1
+    @cache.fetch 'other.local.'
+
+    assert_equal 4, @cache.lookups.length
+    assert_equal 4, @cache.stats[:size]
+  end
+
+  def test_fetch_refresh
+    cache = FakeCache.new 5, 1.0 # refresh on every hit
+
+    first = cache.fetch 'example.local.'
+    assert_same first, cache.fetch('example.local.')
+
+    Timeout.timeout 5 do
+      sleep 0.01 until cache.lookups.length >= 2 and
+                       not cache.fetch('example.local.').equal? first
+    end
+
+    stats = cache.stats
+
+    assert_equal 1, stats[:misses]
+    assert_operator stats[:refreshes], :>=, 1
+  end
+
+  def test_fetch_ttl_zero
+    @cache.ttl = 0
+
+    @cache.fetch 'example.local.'
+    @cache.fetch 'example.local.'
+
+    assert_equal 2, @cache.lookups.length
+    assert_equal 0, @cache.stats[:size]
+  end
+
+  def test_invalidate
+    @cache.fetch 'example.local.'
+
+    assert @cache.invalidate('example.local.')
+    refute @cache.invalidate('example.local.')
+    refute @cache.invalidate('other.local.')
+
+    @cache.fetch 'example.local.'
+
+    assert_equal 2, @cache.lookups.length
+  end
+
+  def test_lookup_both_families
+    service = util_service [util_addrinfo('192.0.2.7')],
+                           [util_addrinfo('2001:db8::7')]
+    cache   = DNSSD::AddressCache.new 1, 0.2, 1
+
+    addresses = DNSSD::Service.stub :getaddrinfo, service do
+      cache.addresses 'example.local.'
+    end
+
+    assert_equal %w[192.0.2.7 2001:db8::7], addresses
+  end
+
+  def test_lookup_one_family
+    service = util_service [util_addrinfo('192.0.2.7')]
+    cache   = DNSSD::AddressCache.new 1, 0.2, 0.01
+
+    addresses = DNSSD::Service.stub :getaddrinfo, service do
+      cache.addresses 'example.local.'
+    end
+
+    assert_equal %w[192.0.2.7], addresses
+  end
+
+  def test_lookup_ipv4
+    service = util_service [util_addrinfo('192.0.2.7')],
+                           [util_addrinfo('2001:db8::7')]
+    cache   = DNSSD::AddressCache.new 1, 0.2, 1
+
+    addresses = DNSSD::Service.stub :getaddrinfo, service do
+      cache.addresses 'example.local.', DNSSD::Service::IPv4
+    end
+
+    assert_equal %w[192.0.2.7], addresses
+  end
+
+  def test_class_instance
+    instance = DNSSD::AddressCache.instance
+
+    assert_kind_of DNSSD::AddressCache, instance
+    assert_same instance, DNSSD::AddressCache.instance
+  end
+
+  def util_addrinfo address
+    sockaddr = Socket.sockaddr_in 0, address
+
+    DNSSD::Reply::AddrInfo.new nil, DNSSD::Flags::Add, 0, 'example.local.',
+                               sockaddr, 120
+  end
+
+  ##
+  # A stand-in for a getaddrinfo service that yields one of +bursts+ per
+  # call to #each, or nothing once they run out
+
+  def util_service *bursts
+    service = Object.new
+    service.define_singleton_method :each do |timeout, &block|
+      bursts.shift.to_a.each { |addrinfo| block.call addrinfo }
+    end
+
+    service
+  end
+
+end
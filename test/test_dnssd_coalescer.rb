@@ -0,0 +1,83 @@
+require 'helper'
+
+class TestDNSSDCoalescer < DNSSD::Test
+
+  def setup
+    super
+
+    @sent      = Queue.new
+    @coalescer = DNSSD::Coalescer.new(0.1) { |update| @sent << update }
+  end
+
+  def test_cancel
+    @coalescer.push 1
+    @coalescer.push 2
+
+    @coalescer.cancel
+
+    refute @coalescer.pending?
+
+    sleep 0.2
+
+    assert_equal 1, @sent.size
+  end
+
+  def test_flush
+    @coalescer.push 1
+    @coalescer.push 2
+
+    assert @coalescer.flush
+    refute @coalescer.flush
+
+    assert_equal [1, 2], Array.new(2) { @sent.pop }
+  end
+
+  def test_push
+    @coalescer.push 1
+
+    assert_equal 1, @sent.pop
+    refute @coalescer.pending?
+    assert_equal 1, @coalescer.sent
+  end
+
+  def test_push_coalesced
+    5.times { |i| @coalescer.push i }
+
+    assert @coalescer.pending?
+    assert_equal 3, @coalescer.merged
+
+    Timeout.timeout 5 do
+      assert_equal [0, 4], Array.new(2) { @sent.pop }
+    end
+
+    refute @coalescer.pending?
+    assert_equal 2, @coalescer.sent
+  end
+
+  def test_push_after_interval
+    @coalescer.push 1
+    sleep 0.15
+    @coalescer.push 2
+
+    assert_equal [1, 2], Array.new(2) { @sent.pop }
+    assert_equal 0, @coalescer.merged
+  end
+
+  def test_push_error
+    coalescer = DNSSD::Coalescer.new 0.05 do |update|
+      raise DNSSD::Error, 'service is stopped' if update == 2
+    end
+
+    coalescer.push 1
+    coalescer.push 2
+
+    Timeout.timeout 5 do
+      sleep 0.01 while coalescer.pending?
+    end
+
+    coalescer.push 3 # still usable
+
+    assert_equal 1, coalescer.sent
+  end
+
+end
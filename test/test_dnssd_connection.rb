@@ -0,0 +1,150 @@
+require 'helper'
+
+class TestDNSSDConnection < DNSSD::Test
+
+  def setup
+    @connection = DNSSD::Connection.new
+  end
+
+  def teardown
+    @connection.close if @connection.open?
+  end
+
+  def test_browse_requires_block
+    assert_raises ArgumentError do
+      @connection.browse '_http._tcp'
+    end
+  end
+
+  def test_register_browse
+    found = nil
+    name  = SecureRandom.hex
+
+    @connection.register name, '_http._tcp', nil, 8080 do |reply|
+      @connection.browse '_http._tcp' do |r|
+        found = r if r.name == name && r.domain == 'local.'
+      end if reply.domain == 'local.'
+    end
+
+    @connection.async_process
+
+    Timeout.timeout 5 do
+      Thread.pass until found
+    end
+
+    assert_equal '_http._tcp', found.type
+    assert_same @connection, found.service.instance_variable_get(:@connection)
+  ensure
+    @connection.close
+  end
+
+  def test_register_record
+    answer = nil
+    name   = "#{SecureRandom.hex}.local."
+    data   = DNSSD::Record.to_data DNSSD::Record::A, '192.0.2.7'
+
+    record = @connection.register_record name, DNSSD::Record::A, data, 120,
+                                         DNSSD::Flags::Unique do |r, error|
+      answer = [r, error]
+    end
+
+    Timeout.timeout 5 do
+      @connection.read_replies 1 until answer
+    end
+
+    assert_same record, answer[0]
+    assert_nil answer[1]
+
+    assert @connection.remove_record(record)
+    refute @connection.remove_record(record)
+  end
+
+  def test_register_record_error
+    answers = []
+    name    = "#{SecureRandom.hex}.local."
+    data    = DNSSD::Record.to_data DNSSD::Record::A, '192.0.2.7'
+
+    record = @connection.register_record name, DNSSD::Record::A, data, 120,
+                                         DNSSD::Flags::Unique do |r, error|
+      answers << [r, error]
+    end
+
+    error = DNSSD::NameConflictError.new
+
+    # the daemon's answer as the callback reports it
+    @connection.record_registered record, error
+    @connection.send :dispatch
+
+    assert_equal [[record, error]], answers
+    refute @connection.instance_variable_get(:@records).key?(record)
+  end
+
+  def test_service_each
+    service = @connection.browse('_http._tcp') { }
+
+    assert_raises DNSSD::Error do
+      service.each { }
+    end
+  end
+
+  def test_close
+    service = @connection.browse('_http._tcp') { }
+
+    @connection.close
+
+    refute_predicate @connection, :open?
+    refute_predicate service, :started?
+
+    assert_raises DNSSD::Error do
+      @connection.browse('_http._tcp') { }
+    end
+  end
+
+  def test_close_async_process
+    @connection.async_process
+
+    assert DNSSD::Reactor.instance.include? @connection
+
+    @connection.close
+
+    refute DNSSD::Reactor.instance.include? @connection
+  end
+
+  def test_close_twice
+    @connection.close
+
+    assert_raises DNSSD::Error do
+      @connection.close
+    end
+  end
+
+  def test_close_process
+    @connection.browse("_#{SecureRandom.hex 4}._tcp") { }
+    waiter = Thread.new { @connection.process }
+
+    Thread.pass until waiter.status == 'sleep'
+
+    @connection.close
+
+    assert waiter.join(0.5), 'process did not notice close'
+  end
+
+  def test_limit_replies_block
+    service = @connection.browse("_#{SecureRandom.hex 4}._tcp") { }
+
+    assert_raises ArgumentError do
+      service.limit_replies 10, :block
+    end
+
+    service.limit_replies 10, :drop_oldest
+  end
+
+  def test_stop
+    service = @connection.browse('_http._tcp') { }
+    service.stop
+
+    refute_predicate service, :started?
+    assert_predicate @connection, :open?
+  end
+
+end
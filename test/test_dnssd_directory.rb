@@ -0,0 +1,191 @@
+require 'helper'
+
+class TestDNSSDDirectory < DNSSD::Test
+
+  ##
+  # Records the services a directory starts instead of talking to the daemon
+
+  class FakeConnection
+    class Service
+      attr_reader :args, :block
+
+      def initialize args, block
+        @args    = args
+        @block   = block
+        @started = true
+      end
+
+      def started?
+        @started
+      end
+
+      def stop
+        @started = false
+      end
+    end
+
+    attr_reader :services
+
+    def initialize
+      @services = []
+    end
+
+    %w[browse getaddrinfo resolve].each do |method|
+      define_method method do |*args, &block|
+        service = Service.new [method.intern, *args], block
+        @services << service
+        service
+      end
+    end
+  end
+
+  def setup
+    @connection = FakeConnection.new
+    @directory  = DNSSD::Directory.new @connection
+
+    @directory.watch '_http._tcp'
+
+    @browse = @connection.services.first
+  end
+
+  def test_browse_add
+    @browse.block.call util_browse
+
+    entry = @directory['_http._tcp', 'Eric Hodel']
+
+    assert_equal 'Eric\032Hodel._http._tcp.local.', entry.fullname
+    assert_equal 'lo',                               entry.interface
+    refute_predicate entry, :resolved?
+
+    resolve = @connection.services.last
+
+    assert_equal [:resolve, 'Eric Hodel', '_http._tcp', 'local.', 0, 'lo'],
+                 resolve.args
+  end
+
+  def test_browse_add_twice
+    @browse.block.call util_browse
+    @browse.block.call util_browse
+
+    assert_equal 1, @directory.lookup('_http._tcp', 'Eric Hodel').length
+    assert_equal 2, @connection.services.length
+  end
+
+  def test_browse_interfaces
+    @browse.block.call util_browse
+    @browse.block.call util_browse(DNSSD::Flags::Add, 'eth0')
+
+    entries = @directory.lookup '_http._tcp.', 'Eric Hodel'
+
+    assert_equal %w[lo eth0], entries.map { |entry| entry.interface }
+    assert_equal 2, @directory.instances('_http._tcp').length
+    assert_equal 2, @directory.count
+  end
+
+  def test_browse_remove
+    @browse.block.call util_browse
+    resolve = @connection.services.last
+
+    @browse.block.call util_browse(0)
+
+    assert_nil @directory['_http._tcp', 'Eric Hodel']
+    assert_empty @directory.instances('_http._tcp')
+    refute_predicate resolve, :started?
+  end
+
+  def test_lookup_missing
+    assert_nil @directory['_http._tcp', 'nobody']
+    assert_empty @directory.lookup('_ipp._tcp', 'nobody')
+  end
+
+  def test_resolve
+    @browse.block.call util_browse
+    resolve = @connection.services.last
+
+    resolve.block.call util_resolve('example.local.')
+
+    entry = @directory['_http._tcp', 'Eric Hodel']
+
+    assert_predicate entry, :resolved?
+    assert_equal 'example.local.', entry.target
+    assert_equal 8080,             entry.port
+    assert_equal 'v',              entry.text_record['k']
+
+    getaddrinfo = @connection.services.last
+
+    assert_equal [:getaddrinfo, 'example.local.', 0, 0, 'lo'],
+                 getaddrinfo.args
+
+    getaddrinfo.block.call util_addrinfo('192.0.2.1')
+    getaddrinfo.block.call util_addrinfo('192.0.2.2')
+    getaddrinfo.block.call util_addrinfo('192.0.2.1', 0)
+
+    assert_empty entry.addresses
+
+    entry = @directory['_http._tcp', 'Eric Hodel']
+
+    assert_equal %w[192.0.2.2], entry.addresses
+    assert_equal 8080,          entry.port
+  end
+
+  def test_resolve_snapshot
+    @browse.block.call util_browse
+    browsed = @directory['_http._tcp', 'Eric Hodel']
+
+    @connection.services.last.block.call util_resolve('example.local.')
+    resolved = @directory['_http._tcp', 'Eric Hodel']
+
+    assert_predicate browsed,  :frozen?
+    assert_predicate resolved, :frozen?
+    refute_predicate browsed,  :resolved?
+    assert_equal 'example.local.', resolved.target
+
+    assert_equal [resolved], @directory.lookup('_http._tcp', 'Eric Hodel')
+    assert_equal [resolved], @directory.to_a
+  end
+
+  def test_resolve_expired
+    @browse.block.call util_browse
+    @connection.services.last.block.call util_resolve('example.local.')
+
+    getaddrinfo = @connection.services.last
+    getaddrinfo.block.call util_addrinfo('192.0.2.1', DNSSD::Flags::Add, 0)
+
+    assert_empty @directory['_http._tcp', 'Eric Hodel'].addresses
+  end
+
+  def test_resolve_target_changed
+    @browse.block.call util_browse
+    resolve = @connection.services.last
+
+    resolve.block.call util_resolve('example.local.')
+    first = @connection.services.last
+    first.block.call util_addrinfo('192.0.2.1')
+
+    resolve.block.call util_resolve('other.local.')
+    second = @connection.services.last
+
+    refute_predicate first, :started?
+    assert_equal 'other.local.', second.args[1]
+    assert_empty @directory['_http._tcp', 'Eric Hodel'].addresses
+  end
+
+  def util_addrinfo address, flags = DNSSD::Flags::Add, ttl = 120
+    sockaddr = Socket.pack_sockaddr_in 0, address
+
+    DNSSD::Reply::AddrInfo.new nil, flags, 0, 'example.local.', sockaddr, ttl
+  end
+
+  def util_browse flags = DNSSD::Flags::Add, interface = 'lo'
+    reply = DNSSD::Reply::Browse.new nil, flags, 0, 'Eric Hodel',
+                                     '_http._tcp', 'local.'
+    reply.instance_variable_set :@interface, interface
+    reply
+  end
+
+  def util_resolve target
+    DNSSD::Reply::Resolve.new nil, 0, 0, 'Eric\032Hodel._http._tcp.local.',
+                              target, 8080, "\003k=v"
+  end
+
+end
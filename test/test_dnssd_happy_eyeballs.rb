@@ -0,0 +1,217 @@
+require 'helper'
+
+class TestDNSSDHappyEyeballs < DNSSD::Test
+
+  ##
+  # Stands in for a DNSSD::Service.getaddrinfo service.  Each #reply makes
+  # the service readable and the next #read_replies yields the addresses as
+  # one burst.
+
+  class FakeService
+    def initialize
+      @bursts          = Queue.new
+      @reader, @writer = IO.pipe
+    end
+
+    def read_replies timeout
+      @reader.read_nonblock 1
+
+      addresses = @bursts.pop
+
+      addresses.each_with_index do |address, i|
+        flags = DNSSD::Flags::Add
+        flags |= DNSSD::Flags::MoreComing if i < addresses.length - 1
+
+        yield DNSSD::Reply::AddrInfo.new(nil, flags, 0, 'localhost',
+                                         Socket.sockaddr_in(0, address), 120)
+      end
+
+      true
+    end
+
+    def reply *addresses
+      @bursts << addresses
+      @writer.write 'x'
+    end
+
+    def started?
+      not @reader.closed?
+    end
+
+    def stop
+      @reader.close
+      @writer.close
+    end
+
+    def to_io
+      @reader
+    end
+  end
+
+  def setup
+    @server = TCPServer.new '127.0.0.1', 0
+    @port   = @server.addr[1]
+    @happy  = DNSSD::HappyEyeballs.new @port, 0.05, 0.01
+  end
+
+  def teardown
+    @server.close unless @server.closed?
+  end
+
+  def test_connect
+    socket = @happy.connect %w[127.0.0.1]
+
+    assert_instance_of TCPSocket, socket
+    assert_equal @port, socket.peeraddr[1]
+  ensure
+    socket.close if socket
+  end
+
+  def test_connect_addrinfo
+    reply = DNSSD::Reply::AddrInfo.new nil, DNSSD::Flags::Add, 0, 'localhost',
+                                       Socket.pack_sockaddr_in(0, '127.0.0.1'),
+                                       120
+
+    socket = @happy.connect [reply.addrinfo(@port), Addrinfo.ip('127.0.0.1')]
+
+    assert_equal @port, socket.peeraddr[1]
+  ensure
+    socket.close if socket
+  end
+
+  def test_connect_all_fail
+    @server.close
+
+    assert_raises Errno::ECONNREFUSED do
+      @happy.connect %w[127.0.0.1]
+    end
+  end
+
+  def test_connect_no_addresses
+    assert_raises SocketError do
+      @happy.connect []
+    end
+  end
+
+  def test_connect_refused
+    # nothing listens on ::1 and the port, or there is no IPv6 at all
+    socket = @happy.connect %w[::1 127.0.0.1]
+
+    assert_equal '127.0.0.1', socket.remote_address.ip_address
+  ensure
+    socket.close if socket
+  end
+
+  def test_connect_stalled
+    stalled = util_stalled_listener
+
+    start  = DNSSD.clock_time
+    socket = @happy.connect %w[127.0.0.2 127.0.0.1], 5
+
+    assert_equal '127.0.0.1', socket.remote_address.ip_address
+    assert_operator DNSSD.clock_time - start, :<, 1
+  ensure
+    socket.close if socket
+    stalled.each { |s| s.close } if stalled
+  end
+
+  def test_connect_timeout
+    stalled = util_stalled_listener
+    happy   = DNSSD::HappyEyeballs.new @port, 1
+
+    assert_raises Errno::ETIMEDOUT do
+      happy.connect %w[127.0.0.2], 0.05
+    end
+  ensure
+    stalled.each { |s| s.close } if stalled
+  end
+
+  def test_connect_service_late_ipv6
+    server6 = util_server6
+    service = FakeService.new
+
+    # nothing listens on 127.0.0.2, so the only IPv4 attempt fails before the
+    # IPv6 burst arrives
+    service.reply '127.0.0.2'
+
+    Thread.new do
+      sleep 0.1
+      service.reply '::1'
+    end
+
+    socket = @happy.connect service, 5
+
+    assert_equal '::1', socket.remote_address.ip_address
+    refute service.started?
+  ensure
+    socket.close if socket
+    server6.close if server6
+  end
+
+  def test_connect_service_resolution_delay
+    server6 = util_server6
+    service = FakeService.new
+    happy   = DNSSD::HappyEyeballs.new @port, 0.05, 1
+
+    service.reply '127.0.0.1'
+
+    Thread.new do
+      sleep 0.05
+      service.reply '::1'
+    end
+
+    socket = happy.connect service, 5
+
+    assert_equal '::1', socket.remote_address.ip_address
+  ensure
+    socket.close if socket
+    server6.close if server6
+  end
+
+  def test_attempts_shift
+    attempts = DNSSD::HappyEyeballs::Attempts.new
+
+    %w[192.0.2.1 192.0.2.2 2001:db8::1 2001:db8::2 192.0.2.3].each do |a|
+      attempts.add a
+    end
+
+    order = Array.new(5) { attempts.shift.ip_address }
+
+    assert_equal %w[2001:db8::1 192.0.2.1 2001:db8::2 192.0.2.2 192.0.2.3],
+                 order
+  end
+
+  ##
+  # Listens on ::1 and the test port
+
+  def util_server6
+    TCPServer.new '::1', @port
+  rescue SystemCallError
+    skip 'IPv6 is not available'
+  end
+
+  ##
+  # Listens on 127.0.0.2 and the test port with a full accept queue, so new
+  # connections stall.  Returns the sockets to close.
+
+  def util_stalled_listener
+    listener = Socket.new :INET, :STREAM
+    listener.bind Addrinfo.tcp('127.0.0.2', @port)
+    listener.listen 0
+
+    sockets = [listener]
+
+    4.times do
+      client = Socket.new :INET, :STREAM
+      client.connect_nonblock listener.local_address, exception: false
+      sockets << client
+    end
+
+    sleep 0.05
+
+    sockets
+  rescue Errno::EADDRNOTAVAIL
+    skip '127.0.0.2 is not available'
+  end
+
+end
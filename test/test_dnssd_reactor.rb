@@ -0,0 +1,69 @@
+require 'helper'
+
+class TestDNSSDReactor < DNSSD::Test
+
+  def setup
+    @reactor = DNSSD::Reactor.instance
+  end
+
+  def test_class_instance
+    assert_same @reactor, DNSSD::Reactor.instance
+  end
+
+  def test_add_remove
+    service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+
+    @reactor.add(service) { }
+    assert @reactor.include? service
+
+    @reactor.remove service
+    refute @reactor.include? service
+  ensure
+    service.stop
+  end
+
+  def test_add_timeout
+    service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+
+    @reactor.add(service, 0.1) { }
+
+    assert_same @reactor, @reactor.join(service, 2)
+    refute @reactor.include? service
+    refute service.started?
+  ensure
+    service.stop if service.started?
+  end
+
+  def test_async_each_shares_thread
+    threads = Thread.list
+
+    services = Array.new 3 do
+      service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+      service.async_each { }
+    end
+
+    services.each { |service| assert @reactor.include? service }
+    assert_operator Thread.list.length - threads.length, :<=, 1
+  ensure
+    services.each { |service| service.stop } if services
+  end
+
+  def test_join_timeout
+    service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+
+    @reactor.add(service) { }
+
+    assert_nil @reactor.join(service, 0.1)
+  ensure
+    service.stop
+  end
+
+  def test_remove_missing
+    service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+
+    assert_nil @reactor.remove service
+  ensure
+    service.stop
+  end
+
+end
@@ -0,0 +1,164 @@
+require 'helper'
+
+class TestDNSSDRecordSet < DNSSD::Test
+
+  ##
+  # Answers every registered record the next time replies are read.  Records
+  # named conflict.* fail, silent.* are never answered.
+
+  class FakeConnection
+    class Record
+      attr_reader :args
+
+      def initialize args
+        @args = args
+      end
+    end
+
+    attr_reader :records, :removed
+
+    def initialize
+      @records = []
+      @removed = []
+      @waiting = []
+    end
+
+    def read_replies timeout
+      waiting, @waiting = @waiting, []
+
+      waiting.each do |record, block|
+        error = DNSSD::NameConflictError.new if
+          record.args[0].start_with? 'conflict'
+
+        block.call record, error
+      end
+
+      true
+    end
+
+    def register_record fullname, type, data, ttl, flags, interface, &block
+      raise DNSSD::BadFlagsError if flags.zero?
+
+      record = Record.new [fullname, type, data, ttl, flags, interface]
+      @records << record
+      @waiting << [record, block] unless fullname.start_with? 'silent'
+      record
+    end
+
+    def remove_record record
+      @removed << record
+      true
+    end
+  end
+
+  def setup
+    super
+
+    @connection = FakeConnection.new
+    @records    = DNSSD::RecordSet.new @connection
+  end
+
+  def test_add_service
+    @records.add_service 'Eric Hodel', '_http._tcp', nil, 'host.local.', 8080,
+                         'k' => 'v'
+
+    @records.register
+
+    ptr, srv, txt = @connection.records.map { |record| record.args }
+
+    assert_equal '_http._tcp.local.', ptr[0]
+    assert_equal DNSSD::Record::PTR, ptr[1]
+    assert_equal "\012Eric Hodel\005_http\004_tcp\005local\000".b, ptr[2]
+    assert_equal DNSSD::Flags::Shared, ptr[4]
+
+    assert_equal 'Eric\032Hodel._http._tcp.local.', srv[0]
+    assert_equal DNSSD::Record::SRV, srv[1]
+    assert_equal DNSSD::Record.to_data(DNSSD::Record::SRV, 0, 0, 8080,
+                                       'host.local.'), srv[2]
+    assert_equal DNSSD::Flags::Unique, srv[4]
+
+    assert_equal srv[0], txt[0]
+    assert_equal DNSSD::Record::TXT, txt[1]
+    assert_equal "\003k=v", txt[2]
+  end
+
+  def test_add_service_empty_text_record
+    @records.add_service 'name', '_http._tcp.', 'local', 'host.local.', 80
+
+    @records.register
+
+    txt = @connection.records.last.args
+
+    assert_equal 'name._http._tcp.local.', txt[0]
+    assert_equal "\0", txt[2]
+  end
+
+  def test_add_service_long_name
+    assert_raises ArgumentError do
+      @records.add_service 'x' * 64, '_http._tcp', nil, 'host.local.', 80
+    end
+  end
+
+  def test_deregister
+    @records.add 'a.local.', DNSSD::Record::A, "\300\000\002\007"
+    @records.add 'b.local.', DNSSD::Record::A, "\300\000\002\010"
+    @records.register
+
+    assert_equal 2, @records.deregister
+    assert_equal 0, @records.length
+    assert_equal @connection.records, @connection.removed
+  end
+
+  def test_register
+    @records.add 'a.local.', DNSSD::Record::A, "\300\000\002\007"
+    @records.add 'b.local.', DNSSD::Record::A, "\300\000\002\010"
+
+    assert_equal 2, @records.pending
+
+    answers = []
+    result = @records.register do |record, failure|
+      answers << [record, failure]
+    end
+
+    assert result.success?
+    assert_equal @connection.records, result.registered
+    assert_equal result.registered.map { |r| [r, nil] }, answers
+    assert_equal 2, @records.length
+    assert_equal 0, @records.pending
+  end
+
+  def test_register_failed
+    @records.add 'a.local.', DNSSD::Record::A, "\300\000\002\007"
+    @records.add 'conflict.local.', DNSSD::Record::A, "\300\000\002\010"
+    @records.add 'bad.local.', DNSSD::Record::A, "\300\000\002\011", 120, 0
+
+    result = @records.register
+
+    refute result.success?
+    assert_equal 1, result.registered.length
+
+    failed = result.failed.map { |f| [f.fullname, f.error.class] }
+
+    assert_equal [
+      ['bad.local.',      DNSSD::BadFlagsError],
+      ['conflict.local.', DNSSD::NameConflictError],
+    ], failed
+
+    assert_equal 1, @records.length
+    assert_empty @connection.removed
+  end
+
+  def test_register_timeout
+    @records.add 'silent.local.', DNSSD::Record::A, "\300\000\002\007"
+
+    result = @records.register 0.1
+
+    failure = result.failed.first
+
+    assert_equal 'silent.local.', failure.fullname
+    assert_kind_of Errno::ETIMEDOUT, failure.error
+    assert_equal @connection.records, @connection.removed
+    assert_equal 0, @records.length
+  end
+
+end
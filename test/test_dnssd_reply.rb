@@ -12,11 +12,43 @@ class TestDNSSDReply < DNSSD::Test
 
     assert_equal "Eric\\032Hodel._http._tcp.local.", @reply.fullname
 
-    @reply.instance_variable_set :@name, 'Dr. Pepper'
+    @reply.set_fullname "Dr\\.\\032Pepper._http._tcp.local."
 
     assert_equal "Dr\\.\\032Pepper._http._tcp.local.", @reply.fullname
   end
 
+  def test_fullname_cached
+    @reply.set_fullname @fullname
+
+    assert_same @reply.fullname, @reply.fullname
+    assert_predicate @reply.fullname, :frozen?
+  end
+
+  def test_dup
+    reply = DNSSD::Reply::Browse.new nil, 0, 0, 'Eric Hodel', '_http._tcp',
+                                     'local.'
+
+    copy = reply.dup
+
+    assert_equal 'Eric Hodel', copy.name
+    assert_equal '_http._tcp', copy.type
+    assert_equal reply.flags,  copy.flags
+  end
+
+  def test_initialize
+    reply = DNSSD::Reply::Resolve.new nil, DNSSD::Flags::MoreComing, 0,
+                                      "Eric\\032Hodel._http._tcp.local.",
+                                      'example.local.', 80, "\003a=b"
+
+    assert_equal 'Eric Hodel',         reply.name
+    assert_equal 'example.local.',     reply.target
+    assert_equal 80,                   reply.port
+    assert_equal 'b',                  reply.text_record['a']
+    assert_predicate reply.flags,      :more_coming?
+    assert_equal DNSSD::InterfaceAny,  reply.interface
+    assert_nil reply.service
+  end
+
   def test_inspect
     flags = DNSSD::Flags.new DNSSD::Flags::MoreComing
     @reply.instance_variable_set :@interface, 'lo0'
@@ -55,6 +87,22 @@ class TestDNSSDReply < DNSSD::Test
     assert_equal "Dr. Pepper #2", @reply.instance_variable_get(:@name)
   end
 
+  def test_set_fullname_escapes
+    @reply.set_fullname "Caf\\195\\169\\\\\\0462._http._tcp.my\\.example.local."
+
+    assert_equal "Caf\u00e9\\.2",        @reply.instance_variable_get(:@name)
+    assert_equal Encoding::UTF_8,     @reply.instance_variable_get(:@name).encoding
+    assert_equal 'my\\.example.local.', @reply.instance_variable_get(:@domain)
+  end
+
+  def test_set_fullname_short
+    @reply.set_fullname 'host.local.'
+
+    assert_equal 'host',  @reply.instance_variable_get(:@name)
+    assert_equal 'local', @reply.instance_variable_get(:@type)
+    assert_equal '.',     @reply.instance_variable_get(:@domain)
+  end
+
   def test_set_names
     @reply.set_names "Dr\\.\032Pepper", '_http._tcp', 'local.'
 
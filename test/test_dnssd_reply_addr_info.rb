@@ -0,0 +1,63 @@
+require 'helper'
+
+class TestDNSSDReplyAddrInfo < DNSSD::Test
+
+  def util_reply address
+    sockaddr = Socket.pack_sockaddr_in 0, address
+
+    DNSSD::Reply::AddrInfo.new nil, DNSSD::Flags::Add, 0, 'example.local.',
+                               sockaddr, 120
+  end
+
+  def test_addrinfo
+    addrinfo = util_reply('192.0.2.7').addrinfo 80
+
+    assert addrinfo.ipv4?
+    assert_equal '192.0.2.7', addrinfo.ip_address
+    assert_equal 80, addrinfo.ip_port
+  end
+
+  def test_addrinfo_ipv6
+    addrinfo = util_reply('2001:db8::7').addrinfo 443
+
+    assert addrinfo.ipv6?
+    assert_equal '2001:db8::7', addrinfo.ip_address
+    assert_equal 443, addrinfo.ip_port
+    assert_equal Socket.pack_sockaddr_in(443, '2001:db8::7'),
+                 addrinfo.to_sockaddr
+  end
+
+  def test_addrinfo_invalid
+    reply = util_reply '192.0.2.7'
+
+    assert_raises TypeError do
+      reply.send :_addrinfo, 'x' * 20, 80
+    end
+
+    ipv6 = Socket.pack_sockaddr_in 0, '::1'
+
+    assert_raises TypeError do
+      reply.send :_addrinfo, ipv6[0, 20], 80
+    end
+  end
+
+  def test_address
+    reply = util_reply '192.0.2.7'
+
+    assert_equal '192.0.2.7', reply.address
+    assert_equal 0, reply.port
+  end
+
+  def test_address_ipv6
+    assert_equal '2001:db8::7', util_reply('2001:db8::7').address
+  end
+
+  def test_sockaddr
+    sockaddr = util_reply('2001:db8::7').sockaddr
+
+    assert_equal Encoding::BINARY, sockaddr.encoding
+    assert sockaddr.frozen?
+    assert_equal Socket.pack_sockaddr_in(0, '2001:db8::7'), sockaddr
+  end
+
+end
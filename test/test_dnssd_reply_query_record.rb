@@ -28,24 +28,97 @@ class TestDNSSDReplyQueryRecord < DNSSD::Test
     assert_equal 'nowhere.example.', qr.record_data
   end
 
+  def test_record_data_compressed
+    qr = util_qr DNSSD::Record::PTR, "\300\014"
+
+    e = assert_raises TypeError do
+      qr.record_data
+    end
+
+    assert_match %r%compressed domain name%, e.message
+  end
+
+  def test_record_data_DS
+    data = [60485, 5, 1].pack('nCC') + "\x2b" * 20
+
+    qr = util_qr DNSSD::Record::DS, data
+
+    assert_equal [60485, 5, 1, "\x2b" * 20], qr.record_data
+  end
+
+  def test_record_data_frozen
+    qr = util_qr DNSSD::Record::SRV, "#{[0, 0, 80].pack 'nnn'}#{@nowhere}"
+
+    data = qr.record_data
+
+    assert data.frozen?
+    assert data.last.frozen?
+  end
+
+  def test_record_data_HINFO
+    qr = util_qr DNSSD::Record::HINFO, "\003x86\005Linux"
+
+    assert_equal %w[x86 Linux], qr.record_data
+  end
+
+  def test_record_data_LOC
+    data = [0, 0x12, 0x16, 0x13, 2**31 + 1000, 2**31 - 1000, 10000000 + 500]
+    data = data.pack 'CCCCNNN'
+
+    qr = util_qr DNSSD::Record::LOC, data
+
+    assert_equal [0, 100, 1000000, 1000, 1000, -1000, 500], qr.record_data
+  end
+
   def test_record_data_MX
     qr = util_qr DNSSD::Record::MX, "\000\010#{@nowhere}"
 
     assert_equal [8, 'nowhere.example.'], qr.record_data
   end
 
+  def test_record_data_NAPTR
+    data = "#{[100, 10].pack 'nn'}\001U\007E2U+sip\000#{@nowhere}"
+
+    qr = util_qr DNSSD::Record::NAPTR, data
+
+    assert_equal [100, 10, 'U', 'E2U+sip', '', 'nowhere.example.'],
+                 qr.record_data
+  end
+
   def test_record_data_NS
     qr = util_qr DNSSD::Record::NS, @nowhere
 
     assert_equal 'nowhere.example.', qr.record_data
   end
 
+  def test_record_data_NSEC
+    data = "#{@nowhere}\000\006\100\000\000\000\000\003"
+
+    qr = util_qr DNSSD::Record::NSEC, data
+
+    expected = ['nowhere.example.', [
+      DNSSD::Record::A, DNSSD::Record::RRSIG, DNSSD::Record::NSEC
+    ]]
+
+    assert_equal expected, qr.record_data
+  end
+
   def test_record_data_PTR
     qr = util_qr DNSSD::Record::PTR, @nowhere
 
     assert_equal 'nowhere.example.', qr.record_data
   end
 
+  def test_record_data_short
+    qr = util_qr DNSSD::Record::TXT, "\005Hello\006World"
+
+    e = assert_raises TypeError do
+      qr.record_data
+    end
+
+    assert_match %r%expected 6 got 5%, e.message
+  end
+
   def test_record_data_SOA
     serial = 1
     refresh = 86400
@@ -77,12 +150,24 @@ class TestDNSSDReplyQueryRecord < DNSSD::Test
     assert_equal [1, 5, 1025, 'nowhere.example.'], qr.record_data
   end
 
+  def test_record_data_SSHFP
+    qr = util_qr DNSSD::Record::SSHFP, "\001\002fingerprint"
+
+    assert_equal [1, 2, 'fingerprint'], qr.record_data
+  end
+
   def test_record_data_TXT
     qr = util_qr DNSSD::Record::TXT, "\005Hello\006World!"
 
     assert_equal %w[Hello World!], qr.record_data
   end
 
+  def test_record_data_unknown
+    qr = util_qr DNSSD::Record::NULL, "\001\002"
+
+    assert_equal "\001\002", qr.record_data
+  end
+
   def util_qr(rtype, rdata)
     DNSSD::Reply::QueryRecord.new nil, 0, 0, @fullname, rtype, @IN, rdata, 120
   end
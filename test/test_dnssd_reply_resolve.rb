@@ -10,6 +10,24 @@ class TestDNSSDReplyResolve < DNSSD::Test
     super
   end
 
+  def test_txt_key_eh
+    reply = util_resolve "\003a=b\001c"
+
+    assert reply.txt_key?('a')
+    assert reply.txt_key?(:c)
+    refute reply.txt_key?('d')
+  end
+
+  def test_txt_value
+    reply = util_resolve "\003a=b\001c\002d="
+
+    assert_equal 'b', reply.txt_value('a')
+    assert_equal 'b', reply.txt_value(:a)
+    assert_nil        reply.txt_value('c')
+    assert_equal '',  reply.txt_value('d')
+    assert_nil        reply.txt_value('e')
+  end
+
   def test_connect_tcp
     fullname = "blackjack\\032no\\032port._blackjack._tcp.local."
     reply = DNSSD::Reply::Resolve.new nil, 0, @interface, fullname,
@@ -32,6 +50,59 @@ class TestDNSSDReplyResolve < DNSSD::Test
     server.close if server
   end
 
+  def test_connect_stale_cache
+    fullname = "blackjack\\032no\\032port._blackjack._tcp.local."
+    reply = DNSSD::Reply::Resolve.new nil, 0, @interface, fullname,
+                                      'localhost', @port, nil
+
+    server = TCPServer.new '127.0.0.1', @port
+
+    stale = util_addrinfo '::1'
+    fresh = [util_addrinfo('127.0.0.1')]
+    def fresh.stop; end
+
+    cache = DNSSD::AddressCache.new
+    cache.define_singleton_method(:lookup) { |*| [stale].freeze }
+
+    socket = DNSSD::AddressCache.stub :instance, cache do
+      DNSSD::Service.stub :getaddrinfo, fresh do
+        reply.connect
+      end
+    end
+
+    assert_equal '127.0.0.1', socket.remote_address.ip_address
+    refute cache.invalidate('localhost', 0, reply.interface),
+           'stale addresses still cached'
+  ensure
+    socket.close if socket
+    server.close if server
+  end
+
+  def test_connect_empty_cache
+    fullname = "blackjack\\032no\\032port._blackjack._tcp.local."
+    reply = DNSSD::Reply::Resolve.new nil, 0, @interface, fullname,
+                                      'localhost', @port, nil
+
+    server = TCPServer.new '127.0.0.1', @port
+
+    live = [util_addrinfo('127.0.0.1')]
+    def live.stop; end
+
+    cache = DNSSD::AddressCache.new
+    cache.define_singleton_method(:lookup) { |*| [].freeze }
+
+    socket = DNSSD::AddressCache.stub :instance, cache do
+      DNSSD::Service.stub :getaddrinfo, live do
+        reply.connect
+      end
+    end
+
+    assert_equal '127.0.0.1', socket.remote_address.ip_address
+  ensure
+    socket.close if socket
+    server.close if server
+  end
+
   def test_connect_udp
     fullname = "blackjack\\032no\\032port._blackjack._udp.local."
     reply = DNSSD::Reply::Resolve.new nil, 0, @interface, fullname,
@@ -55,5 +126,18 @@ class TestDNSSDReplyResolve < DNSSD::Test
     server.close if server
   end
 
-end
+  def util_resolve text_record
+    fullname = "blackjack\\032no\\032port._blackjack._tcp.local."
+
+    DNSSD::Reply::Resolve.new nil, 0, @interface, fullname, 'localhost',
+                              @port, text_record
+  end
+
+  def util_addrinfo address
+    sockaddr = Socket.pack_sockaddr_in 0, address
 
+    DNSSD::Reply::AddrInfo.new nil, DNSSD::Flags::Add, 0, 'localhost',
+                               sockaddr, 120
+  end
+
+end
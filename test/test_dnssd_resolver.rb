@@ -0,0 +1,210 @@
+require 'helper'
+
+class TestDNSSDResolver < DNSSD::Test
+
+  ##
+  # Answers every resolve started on it the next time replies are read,
+  # except resolves for services named "slow".  Each getaddrinfo is answered
+  # with the next burst of +addrinfo+ each time replies are read.
+
+  class FakeConnection
+    class Service
+      attr_reader :args, :block
+      attr_accessor :replied
+
+      def initialize args, block
+        @args    = args
+        @block   = block
+        @replied = 0
+        @started = true
+      end
+
+      def started?
+        @started
+      end
+
+      def stop
+        @started = false
+      end
+    end
+
+    attr_accessor :addrinfo
+    attr_reader :max_in_flight, :services
+
+    def initialize
+      add            = DNSSD::Flags::Add
+      @addrinfo      = [[['192.0.2.1', add | DNSSD::Flags::MoreComing],
+                         ['192.0.2.2', add]]]
+      @max_in_flight = 0
+      @services      = []
+    end
+
+    %w[getaddrinfo resolve].each do |method|
+      define_method method do |*args, &block|
+        service = Service.new [method.intern, *args], block
+        @services << service
+        service
+      end
+    end
+
+    def read_replies timeout
+      started = @services.select { |service| service.started? }
+
+      @max_in_flight = [@max_in_flight, started.length].max
+
+      replied = false
+
+      started.each do |service|
+        method, *args = service.args
+
+        case method
+        when :resolve then
+          next if service.replied > 0 or args.first == 'slow'
+
+          service.block.call resolve_reply(args.first)
+        when :getaddrinfo then
+          burst = @addrinfo[service.replied] or next
+
+          burst.each do |address, flags|
+            service.block.call addrinfo_reply(address, flags)
+          end
+        end
+
+        service.replied += 1
+        replied = true
+      end
+
+      sleep [timeout, 0.01].min unless replied
+
+      true
+    end
+
+    def addrinfo_reply address, flags
+      sockaddr = Socket.sockaddr_in 0, address
+      DNSSD::Reply::AddrInfo.new nil, flags, 0, 'example.local.', sockaddr,
+                                 120
+    end
+
+    def resolve_reply name
+      DNSSD::Reply::Resolve.new nil, 0, 0, "#{name}._http._tcp.local.",
+                                "#{name}.local.", 80, "\003k=v"
+    end
+  end
+
+  def setup
+    @connection = FakeConnection.new
+  end
+
+  def test_initialize_window
+    assert_raises ArgumentError do
+      DNSSD::Resolver.new 0, @connection
+    end
+  end
+
+  def test_resolve
+    resolver = DNSSD::Resolver.new 4, @connection
+    browses  = (1..10).map { |i| util_browse "host#{i}" }
+
+    endpoints = []
+    failed = resolver.resolve browses do |endpoint|
+      endpoints << endpoint
+    end
+
+    assert_empty failed
+    assert_equal 10, endpoints.length
+    assert_operator @connection.max_in_flight, :<=, 4
+    refute @connection.services.any? { |service| service.started? }
+
+    endpoint = endpoints.find { |e| e.name == 'host3' }
+
+    assert_equal 'host3.local.',            endpoint.target
+    assert_equal 80,                        endpoint.port
+    assert_equal 'v',                       endpoint.text_record['k']
+    assert_equal %w[192.0.2.1 192.0.2.2],   endpoint.addresses
+    assert_equal '_http._tcp',              endpoint.type
+  end
+
+  def test_resolve_enum
+    resolver = DNSSD::Resolver.new 2, @connection
+
+    names = resolver.resolve([util_browse('a'), util_browse('b')]).map do |e|
+      e.name
+    end
+
+    assert_equal %w[a b], names.sort
+  end
+
+  def test_resolve_timeout
+    resolver = DNSSD::Resolver.new 2, @connection
+    slow = util_browse 'slow'
+
+    endpoints = []
+    failed = resolver.resolve [slow, util_browse('fast')], 0.05 do |endpoint|
+      endpoints << endpoint
+    end
+
+    assert_equal [slow], failed
+    assert_equal %w[fast], endpoints.map { |e| e.name }
+    refute @connection.services.any? { |service| service.started? }
+  end
+
+  def test_resolve_both_families
+    @connection.addrinfo = [
+      [['192.0.2.1', DNSSD::Flags::Add]],
+      [['2001:db8::1', DNSSD::Flags::Add]],
+    ]
+
+    resolver = DNSSD::Resolver.new 1, @connection
+    resolver.grace = 10
+
+    endpoints = resolver.resolve([util_browse('a')], 1).to_a
+
+    assert_equal 1, endpoints.length
+    assert_equal %w[192.0.2.1 2001:db8::1], endpoints.first.addresses
+  end
+
+  def test_resolve_grace
+    @connection.addrinfo = [[['192.0.2.1', DNSSD::Flags::Add]]]
+
+    resolver = DNSSD::Resolver.new 1, @connection
+    resolver.grace = 0.05
+
+    endpoints = resolver.resolve([util_browse('a')], 1).to_a
+
+    assert_equal %w[192.0.2.1], endpoints.first.addresses
+  end
+
+  def test_resolve_grace_ipv4
+    @connection.addrinfo = [
+      [['192.0.2.1', DNSSD::Flags::Add]],
+      [['2001:db8::1', DNSSD::Flags::Add]],
+    ]
+
+    resolver = DNSSD::Resolver.new 1, @connection
+
+    endpoints = resolver.resolve([util_browse('a')], 1,
+                                 DNSSD::Service::IPv4).to_a
+
+    assert_equal %w[192.0.2.1], endpoints.first.addresses
+  end
+
+  def test_resolve_remove_first
+    @connection.addrinfo = [
+      [['192.0.2.9', 0]],
+      [['192.0.2.1', DNSSD::Flags::Add]],
+    ]
+
+    resolver = DNSSD::Resolver.new 1, @connection
+    resolver.grace = 0
+
+    endpoints = resolver.resolve([util_browse('a')], 1).to_a
+
+    assert_equal %w[192.0.2.1], endpoints.first.addresses
+  end
+
+  def util_browse name
+    DNSSD::Reply::Browse.new nil, DNSSD::Flags::Add, 0, name, '_http._tcp',
+                             'local.'
+  end
+
+end
@@ -1,4 +1,5 @@
 require 'helper'
+require 'objspace'
 
 class TestDNSSDService < DNSSD::Test
 
@@ -47,10 +48,7 @@ class TestDNSSDService < DNSSD::Test
 
     register = DNSSD::Service.register name, "_http._tcp", nil, 8080
     register.async_each do |reply|
-      if reply.domain == "local."
-        registered.release
-        found.await
-      end
+      registered.release if reply.domain == "local."
     end
 
     registered.await
@@ -64,6 +62,8 @@ class TestDNSSDService < DNSSD::Test
       end
     end
 
+    found.await
+
     register.stop
     browse.stop
   end
@@ -179,6 +179,309 @@ class TestDNSSDService < DNSSD::Test
     broadcast.join
   end
 
+  def test_record_remove
+    skip "not supported" if RbConfig::CONFIG['target_os'] =~ /linux/
+    service = DNSSD::Service.register name, "_http._tcp", nil, 8080
+    record = service.add_record(DNSSD::Record::TXT, "\003a=b")
+
+    record.update "\003a=c"
+
+    assert record.remove
+    refute record.remove
+
+    assert_raises DNSSD::Error do
+      record.update "\003a=d"
+    end
+  ensure
+    service.stop if service and service.started?
+  end
+
+  def test_record_update_stopped
+    skip "not supported" if RbConfig::CONFIG['target_os'] =~ /linux/
+    service = DNSSD::Service.register name, "_http._tcp", nil, 8080
+    record = service.add_record(DNSSD::Record::TXT, "\003a=b")
+    service.stop
+
+    e = assert_raises DNSSD::Error do
+      record.update "\003a=c"
+    end
+
+    assert_equal 'service is stopped', e.message
+  end
+
+  def test_limit_replies_block
+    service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+    service.limit_replies 1
+
+    service.send :_synthesize, :browse, 1
+
+    assert service.send :reply_queue_full?
+    refute service.send :process_result, nil
+    assert_equal 1, service.stats[:blocked]
+
+    replies = []
+    service.each(0.1) { |reply| replies << reply }
+
+    assert_equal 1, replies.length
+    refute service.send :reply_queue_full?
+  ensure
+    service.stop
+  end
+
+  def test_limit_replies_block_burst
+    service = DNSSD::Service.send :new
+    service.limit_replies 2
+
+    fixed = DNSSD::Service.send :new
+    fixed.limit_replies 2
+
+    service.send :_synthesize, :browse, 5
+
+    stats = service.stats
+
+    assert_equal 5, stats[:queued]
+    assert_equal 0, stats[:dropped]
+    assert_equal 5, stats[:queue_max]
+    assert service.send :reply_queue_full?
+
+    assert_equal 5, service.shift_replies.length
+
+    service.send :_synthesize, :browse, 1
+
+    assert_equal ObjectSpace.memsize_of(fixed), ObjectSpace.memsize_of(service)
+  end
+
+  def test_limit_replies_block_keeps_waiting
+    service = DNSSD::Service.send :new
+
+    service.send :_synthesize, :browse, 5
+    service.limit_replies 2
+
+    assert_equal 5, service.stats[:queued]
+    assert_equal 0, service.stats[:dropped]
+  end
+
+  def test_limit_replies_fixed_capacity
+    service = DNSSD::Service.send :new
+
+    service.send :_synthesize, :browse, 5
+    service.limit_replies 3, :drop_oldest
+
+    stats = service.stats
+
+    assert_equal 3, stats[:queued]
+    assert_equal 2, stats[:dropped]
+
+    memsize = ObjectSpace.memsize_of service
+
+    service.send :_synthesize, :browse, 100
+
+    assert_equal memsize, ObjectSpace.memsize_of(service)
+  end
+
+  def test_limit_replies_each
+    type      = "_#{SecureRandom.hex 4}._tcp"
+    registers = [DNSSD::Service.register(SecureRandom.hex, type, nil, 8080)]
+
+    browse = DNSSD::Service.browse type
+    browse.limit_replies 2, :drop_oldest
+
+    Timeout.timeout 10 do
+      browse.each do |reply|
+        # a slow block, the daemon sends four more replies meanwhile
+        if registers.length == 1 then
+          4.times do
+            registers << DNSSD::Service.register(SecureRandom.hex, type, nil,
+                                                 8080)
+          end
+
+          sleep 3
+          next
+        end
+
+        break if browse.stats[:queued].zero? and
+                 not browse.send(:more_coming?)
+      end
+    end
+
+    stats = browse.stats
+
+    assert_operator stats[:dropped],   :>,  0
+    assert_operator stats[:queue_max], :<=, 2
+  ensure
+    browse.stop if browse
+    registers.each { |r| r.stop } if registers
+  end
+
+  def test_limit_replies_each_batch
+    type      = "_#{SecureRandom.hex 4}._tcp"
+    names     = Array.new(5) { SecureRandom.hex }
+    registers = names.map do |name|
+      DNSSD::Service.register name, type, nil, 8080
+    end
+
+    browse = DNSSD::Service.browse type
+    browse.limit_replies 2
+
+    batches = []
+
+    Timeout.timeout 5 do
+      browse.each_batch do |replies|
+        batches << replies
+        found = batches.flatten.map { |r| r.name }
+        break if (names - found).empty? or
+                 found.length + browse.stats[:dropped] >= names.length
+      end
+    end
+
+    assert_operator batches.map { |replies| replies.length }.max, :<=, 2
+    assert_operator browse.stats[:queue_max], :<=, 2
+  ensure
+    browse.stop if browse
+    registers.each { |r| r.stop } if registers
+  end
+
+  def test_limit_replies_coalesce
+    service = DNSSD::Service.send :new
+    service.limit_replies 2, :coalesce
+
+    service.send :_synthesize, :browse, 5
+
+    stats = service.stats
+
+    assert_equal 2, stats[:queued]
+    assert_equal 3, stats[:coalesced]
+    assert_equal 0, stats[:dropped]
+
+    service.send :_synthesize, :resolve, 1
+
+    stats = service.stats
+
+    assert_equal 2, stats[:queued]
+    assert_equal 1, stats[:dropped]
+
+    replies = service.shift_replies
+
+    assert_kind_of DNSSD::Reply::Browse,  replies.first
+    assert_kind_of DNSSD::Reply::Resolve, replies.last
+    refute replies.last.flags.more_coming?
+  end
+
+  def test_limit_replies_drop_oldest
+    service = DNSSD::Service.send :new
+    service.limit_replies 3, :drop_oldest
+
+    before = DNSSD.stats[:dropped]
+
+    service.send :_synthesize, :browse, 5
+
+    stats = service.stats
+
+    assert_equal 3, stats[:queued]
+    assert_equal 2, stats[:dropped]
+    assert_equal 3, stats[:queue_max]
+    assert_equal before + 2, DNSSD.stats[:dropped]
+
+    refute service.shift_replies.last.flags.more_coming?
+  end
+
+  def test_limit_replies_invalid
+    service = DNSSD::Service.send :new
+
+    assert_raises ArgumentError do
+      service.limit_replies 10, :unknown
+    end
+
+    assert_raises ArgumentError do
+      service.limit_replies(-1)
+    end
+  end
+
+  def test_stats
+    service = DNSSD::Service.send :new
+
+    service.send :_synthesize, :browse, 3
+    service.shift_replies
+    service.send :_synthesize, :browse, 2
+
+    stats = service.stats
+
+    assert_equal 5, stats[:replies]
+    assert_equal 2, stats[:queued]
+    assert_equal 3, stats[:queue_max]
+    assert_equal 0, stats[:process_calls]
+    assert_equal 0.0, stats[:process_time]
+    assert_equal 0, stats[:unknown_errors]
+  end
+
+  def test_drain_replies_bounded
+    service = DNSSD::Service.send :new
+
+    service.send :_synthesize, :browse, 2
+
+    yielded = 0
+
+    service.drain_replies do |reply|
+      yielded += 1
+      service.push reply
+    end
+
+    assert_equal 2, yielded
+    assert service.replies_waiting?
+  end
+
+  def test_synthesize
+    service = DNSSD::Service.send :new
+
+    service.send :_synthesize, :resolve, 3
+
+    replies = service.shift_replies
+
+    assert_equal 3, replies.length
+    assert replies.first.flags.more_coming?
+    refute replies.last.flags.more_coming?
+
+    reply = replies.last
+
+    assert_equal 'Synthetic Service', reply.name
+    assert_equal 'example.local.',    reply.target
+    assert_equal 8080,                reply.port
+    assert_equal '/index.html',       reply.text_record['path']
+
+    assert_raises ArgumentError do
+      service.send :_synthesize, :unknown, 1
+    end
+  end
+
+  def test_update_text_record
+    done = Latch.new
+    registered = Latch.new
+    broadcast = Thread.new do
+      txt = DNSSD::TextRecord.new 'bar' => 'baz'
+      service = DNSSD::Service.register name, "_http._tcp", nil, 8080, nil,
+                                        txt
+      service.update_text_record 'bar' => 'quux'
+      registered.release
+      done.await
+      service.stop
+    end
+
+    registered.await
+    service = DNSSD::Service.browse '_http._tcp'
+    reply = service.each.find { |r|
+      r.name == name && r.domain == "local."
+    }
+
+    query = DNSSD::Service.query_record reply.fullname, DNSSD::Record::TXT
+    r = query.each.find do |response|
+      !response.flags.more_coming?
+    end
+    record = DNSSD::TextRecord.decode r.record
+    done.release
+    assert_equal 'quux', record['bar']
+    broadcast.join
+  end
+
   def test_stop
     service = DNSSD::Service.browse '_http._tcp'
     assert_predicate service, :started?
@@ -193,4 +496,178 @@ class TestDNSSDService < DNSSD::Test
     service.stop
     assert_raises(DNSSD::Error) { service.stop }
   end
+
+  def test_each_timeout
+    service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+
+    start = DNSSD.clock_time
+    service.each(0.2) { }
+    elapsed = DNSSD.clock_time - start
+
+    assert_in_delta 0.2, elapsed, 0.1
+  ensure
+    service.stop
+  end
+
+  def test_each_fiber_scheduler
+    skip 'Fiber scheduler unsupported' unless Fiber.respond_to? :set_scheduler
+
+    service   = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+    scheduler = TestScheduler.new
+    events    = []
+
+    Thread.new do
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        service.each(0.2) { }
+        events << :each
+      end
+
+      Fiber.schedule { events << :other }
+    end.join
+
+    assert_equal [:other, :each], events
+    assert_operator scheduler.io_waits, :>, 0
+  ensure
+    service.stop
+  end
+
+  def test_stop_each
+    service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+    waiter  = Thread.new { service.each { } }
+
+    Thread.pass until waiter.status == 'sleep'
+
+    start = DNSSD.clock_time
+    service.stop
+
+    assert waiter.join(0.5), 'each did not notice stop'
+    assert_operator DNSSD.clock_time - start, :<, 0.5
+  end
+
+  def test_stop_each_fiber_scheduler
+    skip 'Fiber scheduler unsupported' unless Fiber.respond_to? :set_scheduler
+    skip 'needs epoll' unless RUBY_PLATFORM =~ /linux/
+
+    service   = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+    scheduler = TestScheduler.new
+    events    = []
+
+    Thread.new do
+      Fiber.set_scheduler scheduler
+
+      Fiber.schedule do
+        service.each { }
+        events << :each
+      end
+
+      Fiber.schedule do
+        service.stop
+        events << :stop
+      end
+    end.join(5)
+
+    assert_equal [:stop, :each], events
+  end
+
+  def test_stop_async_each
+    service = DNSSD::Service.browse "_#{SecureRandom.hex 4}._tcp"
+    service.async_each { }
+    Thread.pass
+
+    start = DNSSD.clock_time
+    service.stop
+
+    assert_operator DNSSD.clock_time - start, :<, 0.5
+    refute DNSSD::Reactor.instance.include? service
+  end
+
+  def test_stop_async_each_running
+    type    = "_#{SecureRandom.hex 4}._tcp"
+    service = DNSSD::Service.browse type
+    running = Latch.new
+    done    = false
+
+    assert_same service, service.async_each { |reply|
+      running.release
+      sleep 0.2
+      done = true
+    }
+
+    register = DNSSD::Service.register SecureRandom.hex, type, nil, 8080
+
+    running.await
+    service.stop
+
+    assert done, 'stop returned while the block was running'
+    assert_same service, service.join(0)
+  ensure
+    register.stop if register
+  end
+
+  def test_each_batch
+    type      = "_#{SecureRandom.hex 4}._tcp"
+    names     = Array.new(3) { SecureRandom.hex }
+    registers = names.map do |name|
+      DNSSD::Service.register name, type, nil, 8080
+    end
+
+    browse = DNSSD::Service.browse type
+    found  = []
+
+    Timeout.timeout 5 do
+      browse.each_batch do |replies|
+        assert_kind_of Array, replies
+        refute replies[0...-1].any? { |r| !r.flags.more_coming? }
+
+        found.concat replies.map { |r| r.name }
+        break if (names - found).empty?
+      end
+    end
+
+    assert_empty names - found
+  ensure
+    browse.stop if browse
+    registers.each { |r| r.stop } if registers
+  end
+
+  def test_each_batch_enum
+    service = DNSSD::Service.browse '_http._tcp'
+
+    assert_kind_of Enumerator, service.each_batch(0.1)
+  ensure
+    service.stop
+  end
+
+  def test_drain_replies
+    service = DNSSD::Service.browse '_http._tcp'
+
+    20.times { |i| service.push i }
+
+    replies = []
+    service.drain_replies { |r| replies << r }
+
+    assert_equal (0...20).to_a, replies
+
+    service.push 20
+    service.push 21
+    service.drain_replies { break }
+
+    replies.clear
+    service.drain_replies { |r| replies << r }
+
+    assert_equal [21], replies
+  ensure
+    service.stop
+  end
+
+  def test_to_io
+    service = DNSSD::Service.browse '_http._tcp'
+
+    assert_same service.to_io, service.to_io
+    refute service.to_io.autoclose?
+  ensure
+    service.stop
+  end
 end
@@ -25,6 +25,30 @@ class TestDNSSDTextRecord < DNSSD::Test
     assert_equal 'key value pair at \'key\' too large to encode', e.message
   end
 
+  def test_encode_bad_key
+    assert_raises DNSSD::Error do
+      TR.new('' => 'v').encode
+    end
+
+    e = assert_raises DNSSD::Error do
+      TR.new('k=' => 'v').encode
+    end
+
+    assert_equal "key 'k=' contains =", e.message
+  end
+
+  def test_encode_multibyte
+    tr = TR.new 'k' => "\u00E9"
+
+    assert_equal "\004k=\xC3\xA9".b, tr.encode.b
+  end
+
+  def test_encode_roundtrip
+    tr = TR.new 'a' => 'b', 'c' => 1, 'd' => nil
+
+    assert_equal({ 'a' => 'b', 'c' => '1', 'd' => nil }, TR.new(tr.encode).to_hash)
+  end
+
   def test_decode
     text_record = "\fstatus=avail\006email=\004jid=\005node=\tversion=1\ttxtvers=1\016port.p2pj=5298\0161st=Eric Hodel\005nick=\004AIM=\005last=-phsh=59272d0c3ed947b4660fabc0dad9d67647507299\004ext="
 
@@ -0,0 +1,204 @@
+require 'helper'
+require 'tmpdir'
+
+class TestDNSSDTrace < DNSSD::Test
+
+  # where the interface index and name length of the first frame are
+  INTERFACE_OFFSET = DNSSD::Trace::MAGIC.bytesize + 21
+  IFNAME_OFFSET    = INTERFACE_OFFSET + 4
+
+  def setup
+    super
+
+    @dir  = Dir.mktmpdir 'dnssd_trace'
+    @path = File.join @dir, 'replies.trace'
+  end
+
+  def teardown
+    DNSSD::Trace.stop
+    FileUtils.rm_rf @dir
+
+    super
+  end
+
+  def record
+    browse  = DNSSD::Service.send :new
+    resolve = DNSSD::Service.send :new
+
+    DNSSD::Trace.record @path do
+      assert DNSSD::Trace.recording?
+
+      browse.send  :_synthesize, :browse,       2
+      resolve.send :_synthesize, :resolve,      1
+      resolve.send :_synthesize, :query_record, 1
+      resolve.send :_synthesize, :getaddrinfo,  1 if
+        defined? DNSSD::Service::IPv4
+    end
+
+    refute DNSSD::Trace.recording?
+
+    browse.shift_replies + resolve.shift_replies
+  end
+
+  def test_class_record_twice
+    DNSSD::Trace.start @path
+
+    assert_raises DNSSD::Error do
+      DNSSD::Trace.start @path
+    end
+
+    assert DNSSD::Trace.stop
+    refute DNSSD::Trace.stop
+  end
+
+  def test_initialize_not_trace
+    File.write @path, 'not a trace'
+
+    e = assert_raises ArgumentError do
+      DNSSD::Trace.new @path
+    end
+
+    assert_match 'not a DNSSD trace', e.message
+  end
+
+  def test_replay
+    recorded = record
+
+    trace = DNSSD::Trace.new @path
+    replayed = []
+
+    assert_equal recorded.length, trace.replay(nil) { |reply| replayed << reply }
+
+    trace.close
+
+    assert_equal recorded.map { |reply| reply.class }, replayed.map { |r| r.class }
+
+    browse, = replayed.grep DNSSD::Reply::Browse
+    assert_equal 'Synthetic Service',    browse.name
+    assert_equal '_http._tcp',           browse.type
+    assert_equal recorded[0].interface,  browse.interface
+    assert_equal recorded[0].flags.to_i, browse.flags.to_i
+
+    resolve, = replayed.grep DNSSD::Reply::Resolve
+    assert_equal 'example.local.', resolve.target
+    assert_equal 8080,             resolve.port
+    assert_equal '/index.html',    resolve.text_record['path']
+
+    query, = replayed.grep DNSSD::Reply::QueryRecord
+    assert_equal DNSSD::Record::SRV, query.record_type
+    assert_equal 120,                query.ttl
+
+    addrinfo, = replayed.grep DNSSD::Reply::AddrInfo
+    assert_equal '192.0.2.7', addrinfo.address if addrinfo
+  end
+
+  def test_class_stop_write_error
+    skip '/dev/full is not available' unless File.writable? '/dev/full'
+
+    service = DNSSD::Service.send :new
+
+    DNSSD::Trace.start '/dev/full'
+    service.send :_synthesize, :browse, 1
+
+    assert_raises Errno::ENOSPC do
+      DNSSD::Trace.stop
+    end
+
+    refute DNSSD::Trace.recording?
+  end
+
+  def test_replay_interface_index_moved
+    recorded = record
+
+    # the interface had another index where the trace was recorded
+    util_patch_first_frame INTERFACE_OFFSET, [999].pack('V')
+
+    browse, = util_replay.grep DNSSD::Reply::Browse
+
+    assert_equal recorded[0].interface, browse.interface
+  end
+
+  def test_replay_interface_unknown
+    record
+
+    length = File.binread(@path, 1, IFNAME_OFFSET).unpack1 'C'
+    util_patch_first_frame IFNAME_OFFSET + 1, 'z' * length
+
+    browse, = util_replay.grep DNSSD::Reply::Browse
+
+    assert_equal DNSSD::InterfaceAny, browse.interface
+  end
+
+  def test_replay_malformed
+    record
+
+    File.open @path, 'r+b' do |io|
+      io.seek DNSSD::Trace::MAGIC.bytesize + 16 # kind of the first frame
+      io.write "\xff"
+    end
+
+    trace = DNSSD::Trace.new @path
+
+    assert_raises ArgumentError do
+      trace.replay nil
+    end
+  ensure
+    trace.close if trace
+  end
+
+  def test_replay_speed
+    service = DNSSD::Service.send :new
+
+    DNSSD::Trace.record @path do
+      service.send :_synthesize, :browse, 1
+      sleep 0.2
+      service.send :_synthesize, :browse, 1
+    end
+
+    trace = DNSSD::Trace.new @path
+
+    start = DNSSD.clock_time
+    assert_equal 2, trace.replay(2.0)
+    elapsed = DNSSD.clock_time - start
+
+    assert_operator elapsed, :>=, 0.09
+    assert_operator elapsed, :<,  0.2
+
+    start = DNSSD.clock_time
+    trace.replay nil
+    assert_operator DNSSD.clock_time - start, :<, 0.05
+  ensure
+    trace.close if trace
+  end
+
+  def test_replay_truncated
+    record
+
+    File.truncate @path, File.size(@path) - 1
+
+    trace = DNSSD::Trace.new @path
+
+    assert_raises ArgumentError do
+      trace.replay nil
+    end
+  ensure
+    trace.close if trace
+  end
+
+  def util_patch_first_frame offset, bytes
+    File.open @path, 'r+b' do |io|
+      io.seek offset
+      io.write bytes
+    end
+  end
+
+  def util_replay
+    trace = DNSSD::Trace.new @path
+    replayed = []
+    trace.replay(nil) { |reply| replayed << reply }
+    replayed
+  ensure
+    trace.close if trace
+  end
+
+end